@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <gmp.h>
+#include "arena.h"
+
+
+#define ARENA_MIN_SHIFT 4                   // smallest class, 16 bytes
+#define ARENA_CLASSES 17                    // up to 1MB
+#define ARENA_MAX_BYTES ((size_t)1 << (ARENA_MIN_SHIFT + ARENA_CLASSES - 1))
+#define ARENA_KEEP_BYTES ((size_t)4 << 20)  // most a pool keeps of one class
+#define ARENA_KEEP_BLOCKS 256               // and most blocks
+
+/*
+    Free blocks of one thread, a list per class. The link is in the block itself.
+*/
+typedef struct arena_block
+{
+    struct arena_block *next;
+} arena_block;
+
+typedef struct
+{
+    arena_block *free[ARENA_CLASSES];
+    unsigned int count[ARENA_CLASSES];
+} arena_pool;
+
+static __thread arena_pool pool;
+static __thread int pool_registered;
+
+static pthread_key_t pool_key;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+
+static atomic_ullong requests;
+static atomic_ullong heap;
+
+
+static int class_of(size_t size)
+{
+    if (size <= ((size_t)1 << ARENA_MIN_SHIFT))
+    {
+        return 0;
+    }
+
+    return 64 - __builtin_clzll((unsigned long long)(size - 1)) - ARENA_MIN_SHIFT;
+}
+
+static size_t class_bytes(int c)
+{
+    return (size_t)1 << (c + ARENA_MIN_SHIFT);
+}
+
+static unsigned int class_keep(int c)
+{
+    size_t keep = ARENA_KEEP_BYTES / class_bytes(c);
+
+    return keep > ARENA_KEEP_BLOCKS ? ARENA_KEEP_BLOCKS : keep < 4 ? 4 : (unsigned int)keep;
+}
+
+/*
+    A thread that ends gives its pool back to the C library.
+*/
+static void pool_release(void *arg)
+{
+    arena_pool *p = (arena_pool*)arg;
+    int c;
+
+    for (c = 0; c < ARENA_CLASSES; c++)
+    {
+        while (p->free[c] != NULL)
+        {
+            arena_block *block = p->free[c];
+
+            p->free[c] = block->next;
+            free(block);
+        }
+        p->count[c] = 0;
+    }
+}
+
+static void pool_key_init()
+{
+    pthread_key_create(&pool_key, pool_release);
+}
+
+/*
+    The first block a thread takes or gives back ties its pool to the destructor.
+*/
+static void pool_register()
+{
+    pthread_once(&pool_once, pool_key_init);
+    pthread_setspecific(pool_key, &pool);
+    pool_registered = 1;
+}
+
+static void* checked(void *ptr, size_t size)
+{
+    if (ptr == NULL)
+    {
+        fprintf(stderr, "arena: out of memory allocating %zu bytes\n", size);
+        abort();
+    }
+
+    return ptr;
+}
+
+/*
+    Block of class @arg c: from the pool, else from malloc().
+*/
+static void* pool_get(int c)
+{
+    arena_block *block = pool.free[c];
+
+    if (block != NULL)
+    {
+        pool.free[c] = block->next;
+        pool.count[c]--;
+
+        return block;
+    }
+
+    if (!pool_registered)
+    {
+        pool_register();
+    }
+
+    atomic_fetch_add_explicit(&heap, 1, memory_order_relaxed);
+
+    return checked(malloc(class_bytes(c)), class_bytes(c));
+}
+
+static void pool_put(void *ptr, int c)
+{
+    if (pool.count[c] >= class_keep(c))
+    {
+        free(ptr);
+
+        return;
+    }
+    if (!pool_registered)
+    {
+        pool_register();
+    }
+
+    arena_block *block = (arena_block*)ptr;
+
+    block->next = pool.free[c];
+    pool.free[c] = block;
+    pool.count[c]++;
+}
+
+static void* arena_alloc(size_t size)
+{
+    atomic_fetch_add_explicit(&requests, 1, memory_order_relaxed);
+
+    if (size > ARENA_MAX_BYTES)
+    {
+        atomic_fetch_add_explicit(&heap, 1, memory_order_relaxed);
+
+        return checked(malloc(size), size);
+    }
+
+    return pool_get(class_of(size));
+}
+
+/*
+    GMP gives the size of every block it frees or grows, so the class is known
+    without a header.
+*/
+static void arena_free(void *ptr, size_t size)
+{
+    if (size > ARENA_MAX_BYTES)
+    {
+        free(ptr);
+
+        return;
+    }
+
+    pool_put(ptr, class_of(size));
+}
+
+static void* arena_realloc(void *ptr, size_t old_size, size_t new_size)
+{
+    atomic_fetch_add_explicit(&requests, 1, memory_order_relaxed);
+
+    if (old_size > ARENA_MAX_BYTES && new_size > ARENA_MAX_BYTES)
+    {
+        atomic_fetch_add_explicit(&heap, 1, memory_order_relaxed);
+
+        return checked(realloc(ptr, new_size), new_size);
+    }
+
+    if (old_size <= ARENA_MAX_BYTES && new_size <= ARENA_MAX_BYTES && class_of(old_size) == class_of(new_size))
+    {
+        return ptr;
+    }
+
+    void *grown;
+
+    if (new_size > ARENA_MAX_BYTES)
+    {
+        atomic_fetch_add_explicit(&heap, 1, memory_order_relaxed);
+        grown = checked(malloc(new_size), new_size);
+    }
+    else
+    {
+        grown = pool_get(class_of(new_size));
+    }
+
+    memcpy(grown, ptr, old_size < new_size ? old_size : new_size);
+    arena_free(ptr, old_size);
+
+    return grown;
+}
+
+void arena_install()
+{
+    mp_set_memory_functions(arena_alloc, arena_realloc, arena_free);
+}
+
+void arena_temps_init(arena_temps *temps, size_t bits)
+{
+    int i;
+
+    for (i = 0; i < ARENA_TEMPS; i++)
+    {
+        mpz_init2(temps->t[i], 2 * bits + GMP_NUMB_BITS);
+    }
+}
+
+void arena_temps_clear(arena_temps *temps)
+{
+    int i;
+
+    for (i = 0; i < ARENA_TEMPS; i++)
+    {
+        mpz_clear(temps->t[i]);
+    }
+}
+
+void arena_get_counts(arena_counts *counts)
+{
+    counts->requests = atomic_load(&requests);
+    counts->heap = atomic_load(&heap);
+}
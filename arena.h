@@ -0,0 +1,58 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <gmp.h>
+
+#define ARENA_TEMPS 2           // the input and result of a block in rsa.c, the only user
+
+/*
+    Scratch arena for the numbers of GMP.
+
+    arena_install() hooks mp_set_memory_functions() to per thread pools of blocks in
+    power of 2 size classes, 16 bytes to 1MB. A freed block goes to the pool of the
+    thread that frees it and serves the next request of its class, and a number that
+    grows within its class keeps its block. Once a loop has run once, the mpz_init()
+    and mpz_clear() of its temporaries and the limbs GMP reallocates cost no malloc or
+    free. Larger blocks, and blocks beyond what a pool keeps, go to the C library.
+
+    arena_install() must be called before the first GMP allocation of the process: first thing in main().
+    Memory GMP hands out (mpz_get_str(NULL, ...), mpz_export(NULL, ...)) then has to be
+    given back through the GMP free function, not free().
+
+    arena_temps are the temporaries of a loop, sized for its modulus up front.
+*/
+
+
+/*
+    GMP allocation calls since the start: every allocation and reallocation asked by
+    GMP, and those of them that reached malloc() or realloc().
+*/
+typedef struct
+{
+    unsigned long long requests;
+    unsigned long long heap;
+} arena_counts;
+
+
+/*
+    Temporaries of a hot loop, sized once for a modulus of @arg bits bits: residues and
+    products of two residues fit, a limb to spare, so the loop never grows them.
+*/
+typedef struct
+{
+    mpz_t t[ARENA_TEMPS];
+} arena_temps;
+
+
+void arena_install();
+
+void arena_temps_init(arena_temps *temps, size_t bits);
+void arena_temps_clear(arena_temps *temps);
+
+/*
+    Counts of every thread so far. Zero if the arena is not installed.
+*/
+void arena_get_counts(arena_counts *counts);
+
+#endif
@@ -0,0 +1,573 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <gmp.h>
+#include "util.h"
+#include "rsa.h"
+#include "dh.h"
+#include "arena.h"
+
+/*
+    End to end benchmark of the RSA and DH tools.
+
+    Cases:
+        keygen      key generation latency by modulus size
+        encrypt     MB/s of plaintext by file size and key size
+        decrypt     MB/s of plaintext by file size and key size (CRT keys)
+        dh          handshakes per second by group size
+        dh_fixed_base  the same with a fixed base table of g, for the RFC 3526 groups
+        dh_short_exp   the same with short private keys (256 bits for modp2048)
+        x25519      X25519 handshakes per second, for comparison with the groups
+
+    Every case runs its warmup iterations first, then its timed repetitions.
+    The median, p99 and min of the repetitions are reported, written as JSON, with the
+    GMP allocations per repetition and those of them that reached the heap (see arena.h).
+    Encrypt and decrypt also report heap allocations per block.
+
+
+    Options:
+     -o path Path to the JSON output file (default: stdout)
+     -r number Repetitions per case (default: 21)
+     -w number Warmup iterations per case (default: 3)
+     -j number Worker threads for keygen, encrypt and decrypt (default: 1)
+     --quick Fewer and smaller cases, for a smoke run
+     -h This help message.
+*/
+
+
+#define DH_BATCH 1000   // handshakes per sample of the word size dh groups
+#define X25519_BATCH 100
+
+
+int reps = 21;
+int warmup = 3;
+int jobs = 1;
+int quick = 0;
+
+/*
+    Summary of the samples of one case, in milliseconds.
+*/
+typedef struct
+{
+    int reps;
+    double median;
+    double p99;
+    double min;
+    double gmp_allocs;      // per repetition
+    double heap_allocs;     // per repetition, those malloc() served
+} bench_stats;
+
+/*
+    One iteration of a case. Returns nonzero on failure.
+*/
+typedef int (*bench_fn)(void *arg);
+
+typedef struct
+{
+    rsa_ctx *ctx;
+    FILE *fin;
+    FILE *fout;
+    int mode;       // 'e' or 'd'
+} stream_case;
+
+typedef struct
+{
+    int bits;
+} keygen_case;
+
+typedef struct
+{
+    const char *name;   // group name
+    mpz_t p;
+    mpz_t g;
+    mpz_t a;
+    mpz_t b;
+    mpz_t A;
+    mpz_t B;
+    mpz_t s;
+    int batch;          // handshakes per sample
+} dh_case;
+
+
+void HELP();
+
+
+static double now_ms()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+static int cmp_double(const void *x, const void *y)
+{
+    double a = *(const double*)x;
+    double b = *(const double*)y;
+
+    return (a > b) - (a < b);
+}
+
+/*
+    Run @arg fn @arg warm times untimed, then @arg count times timed.
+    p99 is the nearest rank: the sample at ceil(0.99 * count).
+
+    @returns 0 on success, -1 if an iteration failed.
+*/
+static int run_case(bench_fn fn, void *arg, int warm, int count, bench_stats *stats)
+{
+    double *samples = (double*)malloc(sizeof(double) * count);
+    int i;
+
+    for (i = 0; i < warm; i++)
+    {
+        if (fn(arg))
+        {
+            free(samples);
+
+            return -1;
+        }
+    }
+
+    arena_counts before;
+    arena_counts after;
+    arena_get_counts(&before);
+
+    for (i = 0; i < count; i++)
+    {
+        double t0 = now_ms();
+        if (fn(arg))
+        {
+            free(samples);
+
+            return -1;
+        }
+        samples[i] = now_ms() - t0;
+    }
+
+    arena_get_counts(&after);
+    qsort(samples, count, sizeof(double), cmp_double);
+
+    int rank = (99 * count + 99) / 100;
+
+    stats->reps = count;
+    stats->median = count % 2 ? samples[count / 2] : (samples[count / 2 - 1] + samples[count / 2]) / 2;
+    stats->p99 = samples[rank - 1];
+    stats->min = samples[0];
+    stats->gmp_allocs = (double)(after.requests - before.requests) / count;
+    stats->heap_allocs = (double)(after.heap - before.heap) / count;
+
+    free(samples);
+
+    return 0;
+}
+
+
+static int keygen_iteration(void *arg)
+{
+    keygen_case *c = (keygen_case*)arg;
+    rsa_key pub;
+    rsa_key priv;
+
+    rsa_key_init(&pub);
+    rsa_key_init(&priv);
+    int result = rsa_keygen(&pub, &priv, c->bits, jobs, 0);
+    rsa_key_clear(&pub);
+    rsa_key_clear(&priv);
+
+    return result;
+}
+
+static int stream_iteration(void *arg)
+{
+    stream_case *c = (stream_case*)arg;
+    uint64_t length;
+
+    rewind(c->fin);
+    rewind(c->fout);
+
+    if (c->mode == 'e')
+    {
+        return encrypt(c->fin, c->fout, c->ctx, jobs, &length);
+    }
+
+    return decrypt(c->fin, c->fout, c->ctx, jobs, &length);
+}
+
+/*
+    @arg batch full handshakes: both public keys and both views of the shared secret.
+*/
+static int dh_iteration(void *arg)
+{
+    dh_case *c = (dh_case*)arg;
+    int i;
+
+    for (i = 0; i < c->batch; i++)
+    {
+        if (dh_exchange(c->A, c->B, c->s, c->g, c->a, c->b, c->p))
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+    @arg batch X25519 handshakes of dh_x25519_exchange(), checked the same way.
+*/
+static int x25519_iteration(void *arg)
+{
+    dh_case *c = (dh_case*)arg;
+    int i;
+
+    for (i = 0; i < c->batch; i++)
+    {
+        if (dh_x25519_exchange(c->A, c->B, c->s, c->a, c->b))
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+static void print_stats(FILE *fp, bench_stats *stats)
+{
+    fprintf(fp, "\"reps\": %d, \"median_ms\": %.4f, \"p99_ms\": %.4f, \"min_ms\": %.4f, "
+            "\"gmp_allocs\": %.1f, \"heap_allocs\": %.1f",
+            stats->reps, stats->median, stats->p99, stats->min, stats->gmp_allocs, stats->heap_allocs);
+}
+
+/*
+    Keygen cases. Key generation is slow, so these run a fifth of the repetitions.
+*/
+static void bench_keygen(FILE *fp, int *first)
+{
+    int sizes[] = {1024, 2048, 3072};
+    int count = quick ? 2 : 3;
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        keygen_case c = {sizes[i]};
+        bench_stats stats;
+        int n = reps / 5 < 3 ? 3 : reps / 5;
+
+        fprintf(stderr, "keygen %d bits...\n", c.bits);
+        if (run_case(keygen_iteration, &c, 1, n, &stats))
+        {
+            continue;
+        }
+
+        fprintf(fp, "%s\n    {\"case\": \"keygen\", \"bits\": %d, ", *first ? "" : ",", c.bits);
+        print_stats(fp, &stats);
+        fprintf(fp, "}");
+        *first = 0;
+    }
+}
+
+/*
+    Encrypt and decrypt cases for every key size and file size.
+    The plaintext is random, the files are anonymous temporary files.
+*/
+static void bench_stream(FILE *fp, int *first)
+{
+    int key_sizes[] = {2048, 3072};
+    size_t file_sizes[] = {16 << 10, 256 << 10};
+    int nkeys = quick ? 1 : 2;
+    int nfiles = quick ? 1 : 2;
+    int i, j;
+
+    gmp_randstate_t st;
+    random_state_init(st);
+
+    for (i = 0; i < nkeys; i++)
+    {
+        rsa_key pub;
+        rsa_key priv;
+        rsa_ctx enc;
+        rsa_ctx dec;
+
+        rsa_key_init(&pub);
+        rsa_key_init(&priv);
+        if (rsa_keygen(&pub, &priv, key_sizes[i], jobs, 0) != 0)
+        {
+            fprintf(stderr, "keygen %d bits: %s\n", key_sizes[i], rsa_strerror(RSA_ERR_RANDOM));
+            rsa_key_clear(&pub);
+            rsa_key_clear(&priv);
+
+            continue;
+        }
+        rsa_ctx_init(&enc, &pub, 0);
+        rsa_ctx_init(&dec, &priv, 1);
+
+        for (j = 0; j < nfiles; j++)
+        {
+            size_t size = file_sizes[j];
+            unsigned char *data = (unsigned char*)malloc(size);
+            size_t k;
+
+            for (k = 0; k < size; k++)
+            {
+                data[k] = (unsigned char)gmp_urandomb_ui(st, 8);
+            }
+
+            FILE *plain = tmpfile();
+            FILE *cipher = tmpfile();
+            FILE *out = tmpfile();
+            if (plain == NULL || cipher == NULL || out == NULL)
+            {
+                fprintf(stderr, "Error opening a temporary file.\n");
+
+                exit(1);
+            }
+            fwrite(data, 1, size, plain);
+            free(data);
+
+            size_t blocks = (size + plain_block_size(pub.n) - 1) / plain_block_size(pub.n);
+            stream_case ec = {&enc, plain, cipher, 'e'};
+            stream_case dc = {&dec, cipher, out, 'd'};
+            stream_case *cases[] = {&ec, &dc};
+            int m;
+
+            for (m = 0; m < 2; m++)
+            {
+                bench_stats stats;
+                const char *name = m == 0 ? "encrypt" : "decrypt";
+
+                fprintf(stderr, "%s %d bits, %zu bytes...\n", name, key_sizes[i], size);
+                if (run_case(stream_iteration, cases[m], warmup, reps, &stats))
+                {
+                    fprintf(stderr, "%s failed.\n", name);
+
+                    continue;
+                }
+
+                fprintf(fp, "%s\n    {\"case\": \"%s\", \"bits\": %d, \"bytes\": %zu, ",
+                        *first ? "" : ",", name, key_sizes[i], size);
+                print_stats(fp, &stats);
+                fprintf(fp, ", \"mb_s\": %.3f, \"heap_allocs_per_block\": %.4f}", size / 1e6 / (stats.median / 1e3),
+                        stats.heap_allocs / blocks);
+                *first = 0;
+            }
+
+            fclose(plain);
+            fclose(cipher);
+            fclose(out);
+        }
+
+        rsa_ctx_clear(&enc);
+        rsa_ctx_clear(&dec);
+        rsa_key_clear(&pub);
+        rsa_key_clear(&priv);
+    }
+
+    gmp_randclear(st);
+}
+
+/*
+    DH handshakes per second for the toy group the tests use, a 64 bit group and the RFC 3526 groups.
+    Secrets are random below p, as full size as the group. The RFC 3526 groups are measured
+    again with a fixed base table of g, so g^a and g^b go through the comb, and with short
+    private keys of dh_exponent_bits(). X25519 runs last.
+*/
+static void bench_dh(FILE *fp, int *first)
+{
+    const char *names[] = {"toy", "word64", "modp1536", "modp2048", "modp3072", "modp4096"};
+    int count = quick ? 4 : 6;
+    int i, variant;
+
+    gmp_randstate_t st;
+    random_state_init(st);
+
+    for (i = 0; i < count; i++)
+    {
+        dh_case c;
+        bench_stats stats;
+
+        c.name = names[i];
+        mpz_inits(c.p, c.g, c.a, c.b, c.A, c.B, c.s, NULL);
+
+        if (i == 0)
+        {
+            mpz_set_ui(c.p, 23);
+            mpz_set_ui(c.g, 5);
+            c.batch = DH_BATCH;
+        }
+        else if (i == 1)
+        {
+            // largest prime below 2^64, on the native word path.
+            mpz_set_str(c.p, "18446744073709551557", 10);
+            mpz_set_ui(c.g, 2);
+            c.batch = DH_BATCH;
+        }
+        else
+        {
+            dh_group_set(c.p, c.g, c.name);
+            c.batch = 1;
+        }
+        mpz_urandomm(c.a, st, c.p);
+        mpz_urandomm(c.b, st, c.p);
+
+        // the RFC 3526 groups run again with a fixed base table of g (dh_fixed_base()),
+        // then with short private keys (dh_private_key())
+        for (variant = 0; variant <= (i >= 2 ? 2 : 0); variant++)
+        {
+            const char *labels[] = {"dh", "dh_fixed_base", "dh_short_exp"};
+            const char *label = labels[variant];
+
+            if (variant == 1)
+            {
+                dh_fixed_base(c.g, c.p, NULL);
+            }
+            if (variant == 2)
+            {
+                dh_fixed_base_clear();
+                dh_private_key(c.a, c.p, dh_exponent_bits(c.p));
+                dh_private_key(c.b, c.p, dh_exponent_bits(c.p));
+            }
+
+            fprintf(stderr, "%s %s...\n", label, c.name);
+            if (run_case(dh_iteration, &c, warmup, reps, &stats))
+            {
+                fprintf(stderr, "%s failed.\n", label);
+            }
+            else
+            {
+                fprintf(fp, "%s\n    {\"case\": \"%s\", \"group\": \"%s\", \"bits\": %zu, \"batch\": %d, ",
+                        *first ? "" : ",", label, c.name, mpz_sizeinbase(c.p, 2), c.batch);
+                print_stats(fp, &stats);
+                fprintf(fp, ", \"handshakes_s\": %.1f}", c.batch / (stats.median / 1e3));
+                *first = 0;
+            }
+        }
+        dh_fixed_base_clear();
+
+        mpz_clears(c.p, c.g, c.a, c.b, c.A, c.B, c.s, NULL);
+    }
+
+    // X25519: p = 2^255 - 19 is only reported, the curve has its own arithmetic.
+    dh_case c;
+    bench_stats stats;
+
+    c.name = DH_X25519;
+    c.batch = X25519_BATCH;
+    mpz_inits(c.p, c.g, c.a, c.b, c.A, c.B, c.s, NULL);
+    mpz_ui_pow_ui(c.p, 2, 255);
+    mpz_sub_ui(c.p, c.p, 19);
+    mpz_urandomb(c.a, st, 256);
+    mpz_urandomb(c.b, st, 256);
+
+    fprintf(stderr, "x25519...\n");
+    if (run_case(x25519_iteration, &c, warmup, reps, &stats))
+    {
+        fprintf(stderr, "x25519 failed.\n");
+    }
+    else
+    {
+        fprintf(fp, "%s\n    {\"case\": \"x25519\", \"group\": \"%s\", \"bits\": %zu, \"batch\": %d, ",
+                *first ? "" : ",", c.name, mpz_sizeinbase(c.p, 2), c.batch);
+        print_stats(fp, &stats);
+        fprintf(fp, ", \"handshakes_s\": %.1f}", c.batch / (stats.median / 1e3));
+        *first = 0;
+    }
+    mpz_clears(c.p, c.g, c.a, c.b, c.A, c.B, c.s, NULL);
+
+    gmp_randclear(st);
+}
+
+
+int main(int argc, char *argv[])
+{
+    // before the first GMP allocation
+    arena_install();
+
+    char *output = NULL;
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--quick") == 0)
+        {
+            quick = 1;
+        }
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+        {
+            output = argv[++i];
+        }
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+        {
+            reps = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+        {
+            warmup = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+        {
+            jobs = atoi(argv[++i]);
+        }
+        else
+        {
+            HELP();
+
+            exit(0);
+        }
+    }
+
+    if (quick && reps == 21)
+    {
+        reps = 5;
+    }
+    if (reps < 1 || warmup < 0 || jobs < 1)
+    {
+        printf("Invalid repetitions, warmup or jobs.\n");
+
+        exit(1);
+    }
+
+    FILE *fp = stdout;
+    if (output != NULL && (fp = fopen(output, "w")) == NULL)
+    {
+        printf("Error opening file.\n");
+
+        exit(1);
+    }
+
+    int first = 1;
+
+    fprintf(fp, "{\n  \"bench\": \"assign1\",\n  \"timestamp\": %lld,\n  \"jobs\": %d,\n  \"warmup\": %d,\n  \"cases\": [",
+            (long long)time(NULL), jobs, warmup);
+
+    bench_keygen(fp, &first);
+    bench_stream(fp, &first);
+    bench_dh(fp, &first);
+
+    fprintf(fp, "\n  ]\n}\n");
+
+    if (fp != stdout)
+    {
+        fclose(fp);
+    }
+
+    return 0;
+}
+
+
+/*
+    Helper function for -h argument.
+*/
+void HELP()
+{
+    fprintf(stdout, "Options:\n\
+     \t-o path Path to the JSON output file (default: stdout)\n\
+     \t-r number Repetitions per case (default: 21)\n\
+     \t-w number Warmup iterations per case (default: 3)\n\
+     \t-j number Worker threads for keygen, encrypt and decrypt (default: 1)\n\
+     \t--quick Fewer and smaller cases, for a smoke run\n\
+     \t-h This help message.\n");
+}
@@ -0,0 +1,1322 @@
+#include <stdlib.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <gmp.h>
+#include "util.h"
+#include "dh.h"
+#include "mont.h"
+#include "mont64.h"
+#include "x25519.h"
+
+
+/*
+    RFC 3526 MODP groups. p = 2^n - 2^(n-64) - 1 + 2^64 * (floor(2^(n-130) * pi) + k).
+*/
+static const char modp1536[] =
+    "FFFFFFFFFFFFFFFFC90FDAA22168C234C4C6628B80DC1CD129024E088A67CC74"
+    "020BBEA63B139B22514A08798E3404DDEF9519B3CD3A431B302B0A6DF25F1437"
+    "4FE1356D6D51C245E485B576625E7EC6F44C42E9A637ED6B0BFF5CB6F406B7ED"
+    "EE386BFB5A899FA5AE9F24117C4B1FE649286651ECE45B3DC2007CB8A163BF05"
+    "98DA48361C55D39A69163FA8FD24CF5F83655D23DCA3AD961C62F356208552BB"
+    "9ED529077096966D670C354E4ABC9804F1746C08CA237327FFFFFFFFFFFFFFFF";
+
+static const char modp2048[] =
+    "FFFFFFFFFFFFFFFFC90FDAA22168C234C4C6628B80DC1CD129024E088A67CC74"
+    "020BBEA63B139B22514A08798E3404DDEF9519B3CD3A431B302B0A6DF25F1437"
+    "4FE1356D6D51C245E485B576625E7EC6F44C42E9A637ED6B0BFF5CB6F406B7ED"
+    "EE386BFB5A899FA5AE9F24117C4B1FE649286651ECE45B3DC2007CB8A163BF05"
+    "98DA48361C55D39A69163FA8FD24CF5F83655D23DCA3AD961C62F356208552BB"
+    "9ED529077096966D670C354E4ABC9804F1746C08CA18217C32905E462E36CE3B"
+    "E39E772C180E86039B2783A2EC07A28FB5C55DF06F4C52C9DE2BCBF695581718"
+    "3995497CEA956AE515D2261898FA051015728E5A8AACAA68FFFFFFFFFFFFFFFF";
+
+static const char modp3072[] =
+    "FFFFFFFFFFFFFFFFC90FDAA22168C234C4C6628B80DC1CD129024E088A67CC74"
+    "020BBEA63B139B22514A08798E3404DDEF9519B3CD3A431B302B0A6DF25F1437"
+    "4FE1356D6D51C245E485B576625E7EC6F44C42E9A637ED6B0BFF5CB6F406B7ED"
+    "EE386BFB5A899FA5AE9F24117C4B1FE649286651ECE45B3DC2007CB8A163BF05"
+    "98DA48361C55D39A69163FA8FD24CF5F83655D23DCA3AD961C62F356208552BB"
+    "9ED529077096966D670C354E4ABC9804F1746C08CA18217C32905E462E36CE3B"
+    "E39E772C180E86039B2783A2EC07A28FB5C55DF06F4C52C9DE2BCBF695581718"
+    "3995497CEA956AE515D2261898FA051015728E5A8AAAC42DAD33170D04507A33"
+    "A85521ABDF1CBA64ECFB850458DBEF0A8AEA71575D060C7DB3970F85A6E1E4C7"
+    "ABF5AE8CDB0933D71E8C94E04A25619DCEE3D2261AD2EE6BF12FFA06D98A0864"
+    "D87602733EC86A64521F2B18177B200CBBE117577A615D6C770988C0BAD946E2"
+    "08E24FA074E5AB3143DB5BFCE0FD108E4B82D120A93AD2CAFFFFFFFFFFFFFFFF";
+
+static const char modp4096[] =
+    "FFFFFFFFFFFFFFFFC90FDAA22168C234C4C6628B80DC1CD129024E088A67CC74"
+    "020BBEA63B139B22514A08798E3404DDEF9519B3CD3A431B302B0A6DF25F1437"
+    "4FE1356D6D51C245E485B576625E7EC6F44C42E9A637ED6B0BFF5CB6F406B7ED"
+    "EE386BFB5A899FA5AE9F24117C4B1FE649286651ECE45B3DC2007CB8A163BF05"
+    "98DA48361C55D39A69163FA8FD24CF5F83655D23DCA3AD961C62F356208552BB"
+    "9ED529077096966D670C354E4ABC9804F1746C08CA18217C32905E462E36CE3B"
+    "E39E772C180E86039B2783A2EC07A28FB5C55DF06F4C52C9DE2BCBF695581718"
+    "3995497CEA956AE515D2261898FA051015728E5A8AAAC42DAD33170D04507A33"
+    "A85521ABDF1CBA64ECFB850458DBEF0A8AEA71575D060C7DB3970F85A6E1E4C7"
+    "ABF5AE8CDB0933D71E8C94E04A25619DCEE3D2261AD2EE6BF12FFA06D98A0864"
+    "D87602733EC86A64521F2B18177B200CBBE117577A615D6C770988C0BAD946E2"
+    "08E24FA074E5AB3143DB5BFCE0FD108E4B82D120A92108011A723C12A787E6D7"
+    "88719A10BDBA5B2699C327186AF4E23C1A946834B6150BDA2583E9CA2AD44CE8"
+    "DBBBC2DB04DE8EF92E8EFC141FBECAA6287C59474E6BC05D99B2964FA090C3A2"
+    "233BA186515BE7ED1F612970CEE2D7AFB81BDD762170481CD0069127D5B05AA9"
+    "93B4EA988D8FDDC186FFB7DC90A6C08F4DF435C934063199FFFFFFFFFFFFFFFF";
+
+static const char modp6144[] =
+    "FFFFFFFFFFFFFFFFC90FDAA22168C234C4C6628B80DC1CD129024E088A67CC74"
+    "020BBEA63B139B22514A08798E3404DDEF9519B3CD3A431B302B0A6DF25F1437"
+    "4FE1356D6D51C245E485B576625E7EC6F44C42E9A637ED6B0BFF5CB6F406B7ED"
+    "EE386BFB5A899FA5AE9F24117C4B1FE649286651ECE45B3DC2007CB8A163BF05"
+    "98DA48361C55D39A69163FA8FD24CF5F83655D23DCA3AD961C62F356208552BB"
+    "9ED529077096966D670C354E4ABC9804F1746C08CA18217C32905E462E36CE3B"
+    "E39E772C180E86039B2783A2EC07A28FB5C55DF06F4C52C9DE2BCBF695581718"
+    "3995497CEA956AE515D2261898FA051015728E5A8AAAC42DAD33170D04507A33"
+    "A85521ABDF1CBA64ECFB850458DBEF0A8AEA71575D060C7DB3970F85A6E1E4C7"
+    "ABF5AE8CDB0933D71E8C94E04A25619DCEE3D2261AD2EE6BF12FFA06D98A0864"
+    "D87602733EC86A64521F2B18177B200CBBE117577A615D6C770988C0BAD946E2"
+    "08E24FA074E5AB3143DB5BFCE0FD108E4B82D120A92108011A723C12A787E6D7"
+    "88719A10BDBA5B2699C327186AF4E23C1A946834B6150BDA2583E9CA2AD44CE8"
+    "DBBBC2DB04DE8EF92E8EFC141FBECAA6287C59474E6BC05D99B2964FA090C3A2"
+    "233BA186515BE7ED1F612970CEE2D7AFB81BDD762170481CD0069127D5B05AA9"
+    "93B4EA988D8FDDC186FFB7DC90A6C08F4DF435C93402849236C3FAB4D27C7026"
+    "C1D4DCB2602646DEC9751E763DBA37BDF8FF9406AD9E530EE5DB382F413001AE"
+    "B06A53ED9027D831179727B0865A8918DA3EDBEBCF9B14ED44CE6CBACED4BB1B"
+    "DB7F1447E6CC254B332051512BD7AF426FB8F401378CD2BF5983CA01C64B92EC"
+    "F032EA15D1721D03F482D7CE6E74FEF6D55E702F46980C82B5A84031900B1C9E"
+    "59E7C97FBEC7E8F323A97A7E36CC88BE0F1D45B7FF585AC54BD407B22B4154AA"
+    "CC8F6D7EBF48E1D814CC5ED20F8037E0A79715EEF29BE32806A1D58BB7C5DA76"
+    "F550AA3D8A1FBFF0EB19CCB1A313D55CDA56C9EC2EF29632387FE8D76E3C0468"
+    "043E8F663F4860EE12BF2D5B0B7474D6E694F91E6DCC4024FFFFFFFFFFFFFFFF";
+
+static const char modp8192[] =
+    "FFFFFFFFFFFFFFFFC90FDAA22168C234C4C6628B80DC1CD129024E088A67CC74"
+    "020BBEA63B139B22514A08798E3404DDEF9519B3CD3A431B302B0A6DF25F1437"
+    "4FE1356D6D51C245E485B576625E7EC6F44C42E9A637ED6B0BFF5CB6F406B7ED"
+    "EE386BFB5A899FA5AE9F24117C4B1FE649286651ECE45B3DC2007CB8A163BF05"
+    "98DA48361C55D39A69163FA8FD24CF5F83655D23DCA3AD961C62F356208552BB"
+    "9ED529077096966D670C354E4ABC9804F1746C08CA18217C32905E462E36CE3B"
+    "E39E772C180E86039B2783A2EC07A28FB5C55DF06F4C52C9DE2BCBF695581718"
+    "3995497CEA956AE515D2261898FA051015728E5A8AAAC42DAD33170D04507A33"
+    "A85521ABDF1CBA64ECFB850458DBEF0A8AEA71575D060C7DB3970F85A6E1E4C7"
+    "ABF5AE8CDB0933D71E8C94E04A25619DCEE3D2261AD2EE6BF12FFA06D98A0864"
+    "D87602733EC86A64521F2B18177B200CBBE117577A615D6C770988C0BAD946E2"
+    "08E24FA074E5AB3143DB5BFCE0FD108E4B82D120A92108011A723C12A787E6D7"
+    "88719A10BDBA5B2699C327186AF4E23C1A946834B6150BDA2583E9CA2AD44CE8"
+    "DBBBC2DB04DE8EF92E8EFC141FBECAA6287C59474E6BC05D99B2964FA090C3A2"
+    "233BA186515BE7ED1F612970CEE2D7AFB81BDD762170481CD0069127D5B05AA9"
+    "93B4EA988D8FDDC186FFB7DC90A6C08F4DF435C93402849236C3FAB4D27C7026"
+    "C1D4DCB2602646DEC9751E763DBA37BDF8FF9406AD9E530EE5DB382F413001AE"
+    "B06A53ED9027D831179727B0865A8918DA3EDBEBCF9B14ED44CE6CBACED4BB1B"
+    "DB7F1447E6CC254B332051512BD7AF426FB8F401378CD2BF5983CA01C64B92EC"
+    "F032EA15D1721D03F482D7CE6E74FEF6D55E702F46980C82B5A84031900B1C9E"
+    "59E7C97FBEC7E8F323A97A7E36CC88BE0F1D45B7FF585AC54BD407B22B4154AA"
+    "CC8F6D7EBF48E1D814CC5ED20F8037E0A79715EEF29BE32806A1D58BB7C5DA76"
+    "F550AA3D8A1FBFF0EB19CCB1A313D55CDA56C9EC2EF29632387FE8D76E3C0468"
+    "043E8F663F4860EE12BF2D5B0B7474D6E694F91E6DBE115974A3926F12FEE5E4"
+    "38777CB6A932DF8CD8BEC4D073B931BA3BC832B68D9DD300741FA7BF8AFC47ED"
+    "2576F6936BA424663AAB639C5AE4F5683423B4742BF1C978238F16CBE39D652D"
+    "E3FDB8BEFC848AD922222E04A4037C0713EB57A81A23F0C73473FC646CEA306B"
+    "4BCBC8862F8385DDFA9D4B7FA2C087E879683303ED5BDD3A062B3CF5B3A278A6"
+    "6D2A13F83F44F82DDF310EE074AB6A364597E899A0255DC164F31CC50846851D"
+    "F9AB48195DED7EA1B1D510BD7EE74D73FAF36BC31ECFA268359046F4EB879F92"
+    "4009438B481C6CD7889A002ED5EE382BC9190DA6FC026E479558E4475677E9AA"
+    "9E3050E2765694DFC81F56E880B96E7160C980DD98EDD3DFFFFFFFFFFFFFFFFF";
+
+const dh_group dh_groups[] =
+{
+    {"modp1536", 1536, modp1536, 2},
+    {"modp2048", 2048, modp2048, 2},
+    {"modp3072", 3072, modp3072, 2},
+    {"modp4096", 4096, modp4096, 2},
+    {"modp6144", 6144, modp6144, 2},
+    {"modp8192", 8192, modp8192, 2}
+};
+
+const int dh_group_count = sizeof(dh_groups) / sizeof(dh_groups[0]);
+
+
+const dh_group* dh_group_find(const char *name)
+{
+    int i;
+
+    for (i = 0; i < dh_group_count; i++)
+    {
+        if (strcmp(dh_groups[i].name, name) == 0)
+        {
+            return &dh_groups[i];
+        }
+    }
+
+    return NULL;
+}
+
+int dh_group_set(mpz_t p, mpz_t g, const char *name)
+{
+    const dh_group *group = dh_group_find(name);
+
+    if (group == NULL)
+    {
+        return DH_ERR_GROUP;
+    }
+
+    mpz_set_str(p, group->prime, 16);
+    mpz_set_ui(g, group->generator);
+
+    return 0;
+}
+
+const char* dh_error_string(int error)
+{
+    switch (error)
+    {
+        case DH_ERR_PRIME:
+            return "p is not a prime, or beyond 64 bits not a safe prime";
+        case DH_ERR_GENERATOR:
+            return "g is not a primitive root of p, or beyond 64 bits not in 1 < g < p - 1";
+        case DH_ERR_GROUP:
+            return "no group of that name";
+        case DH_ERR_MISMATCH:
+            return "not matching common key";
+        case DH_ERR_TABLE:
+            return "the fixed base table can not be written";
+        case DH_ERR_RANDOM:
+            return "no system randomness for a private key";
+        case DH_ERR_ROW:
+            return "not a row of p,g,a,b or group,a,b with secrets below p";
+        case DH_ERR_IO:
+            return "the file can not be read or written";
+        case DH_ERR_PUBLIC:
+            return "public key out of range";
+        default:
+            return "unknown error";
+    }
+}
+
+/*
+    Validate p and g.
+
+    p of a machine word is checked to be a prime and g a primitive root of p, which
+    checkIfPrimitiveRoot() decides from the factors of p - 1.
+
+    Beyond 64 bits p - 1 can not be factored in general, so p has to be a safe prime,
+    p = 2q + 1 with q a prime too. The order of g then divides 2q, and any g other than
+    1 and p - 1 has order q or 2q: it generates the subgroup of order q or the whole
+    group. That is all the RFC 3526 groups promise for g = 2, which is a quadratic
+    residue of their p and so of order q, so g is not required to be a primitive root.
+*/
+int dh_check_params(mpz_t p, mpz_t g)
+{
+    if (mpz_sgn(p) <= 0)
+    {
+        return DH_ERR_PRIME;
+    }
+
+    if (mpz_sizeinbase(p, 2) <= 64)
+    {
+        uint64_t pv = mpz_getlimbn(p, 0);
+
+        if (!checkIfPrime(pv))
+        {
+            return DH_ERR_PRIME;
+        }
+        if (mpz_sgn(g) <= 0 || mpz_cmp(g, p) >= 0 || !checkIfPrimitiveRoot(pv, mpz_getlimbn(g, 0)))
+        {
+            return DH_ERR_GENERATOR;
+        }
+
+        return 0;
+    }
+
+    if (!mpz_probab_prime_p(p, 25))
+    {
+        return DH_ERR_PRIME;
+    }
+
+    mpz_t p_1;
+    mpz_init(p_1);
+    mpz_sub_ui(p_1, p, 1);
+
+    int valid = mpz_cmp_ui(g, 1) > 0 && mpz_cmp(g, p_1) < 0;
+
+    // q = (p - 1) / 2
+    mpz_tdiv_q_2exp(p_1, p_1, 1);
+    int safe = mpz_probab_prime_p(p_1, 25) != 0;
+
+    mpz_clear(p_1);
+
+    if (!safe)
+    {
+        return DH_ERR_PRIME;
+    }
+
+    return valid ? 0 : DH_ERR_GENERATOR;
+}
+
+
+/*
+    Parameter cache file. An append only log of validation results.
+
+    Header: "DHPC", u32 version.
+    Record: u64 hash of (p, g), u32 bytes of p, u32 bytes of g, i32 result, u32 zero,
+    then p and g big endian (mpz_export), zero padded to 8 bytes.
+    Integers are in host byte order. A file of the other byte order fails the version check.
+
+    The hash only speeds up the scan. A hit needs p and g to match byte for byte.
+*/
+#define CACHE_MAGIC "DHPC"
+#define CACHE_VERSION 2         // 1 accepted any prime beyond 64 bits, not only safe ones
+#define CACHE_HEADER_SIZE 8
+#define CACHE_RECORD_SIZE 24
+
+#define CACHE_MISS 1            // cache_find() found no record
+#define CACHE_FOREIGN 2         // the file is not a parameter cache
+
+/*
+    FNV-1a of p and g.
+*/
+static uint64_t cache_hash(const unsigned char *key, size_t length)
+{
+    uint64_t h = 14695981039346656037ull;
+    size_t i;
+
+    for (i = 0; i < length; i++)
+    {
+        h = (h ^ key[i]) * 1099511628211ull;
+    }
+
+    return h;
+}
+
+/*
+    Look up @arg key, p then g in @arg plen and @arg glen bytes, in the cache file @arg fd.
+    @arg end gets the offset past the last whole record, where the next one goes.
+
+    @returns the cached result, CACHE_MISS or CACHE_FOREIGN.
+*/
+static int cache_find(int fd, const unsigned char *key, size_t plen, size_t glen, uint64_t h, size_t *end)
+{
+    struct stat st;
+    int result = CACHE_MISS;
+
+    *end = 0;
+    if (fstat(fd, &st) != 0)
+    {
+        return CACHE_FOREIGN;
+    }
+    if (st.st_size < CACHE_HEADER_SIZE)
+    {
+        // empty, or a header cut short by a crash
+        return CACHE_MISS;
+    }
+
+    size_t size = st.st_size;
+    unsigned char *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    uint32_t version;
+
+    if (map == MAP_FAILED)
+    {
+        return CACHE_FOREIGN;
+    }
+    memcpy(&version, map + 4, 4);
+    if (memcmp(map, CACHE_MAGIC, 4) == 0 && version >= 1 && version < CACHE_VERSION)
+    {
+        // verdicts of older rules: the next append starts the file over
+        munmap(map, size);
+
+        return CACHE_MISS;
+    }
+    if (memcmp(map, CACHE_MAGIC, 4) != 0 || version != CACHE_VERSION)
+    {
+        munmap(map, size);
+
+        return CACHE_FOREIGN;
+    }
+
+    size_t offset = CACHE_HEADER_SIZE;
+    while (offset + CACHE_RECORD_SIZE <= size)
+    {
+        uint64_t rh;
+        uint32_t rp, rg;
+        int32_t rr;
+
+        memcpy(&rh, map + offset, 8);
+        memcpy(&rp, map + offset + 8, 4);
+        memcpy(&rg, map + offset + 12, 4);
+        memcpy(&rr, map + offset + 16, 4);
+
+        size_t total = CACHE_RECORD_SIZE + (((size_t)rp + rg + 7) & ~(size_t)7);
+        if (total > size - offset)
+        {
+            // a record cut short by a crash. The next append overwrites it
+            break;
+        }
+
+        // a verdict dh_check_params() can not return is not trusted, the entry is a miss
+        if (result == CACHE_MISS && rh == h && rp == plen && rg == glen
+            && (rr == 0 || rr == DH_ERR_PRIME || rr == DH_ERR_GENERATOR)
+            && memcmp(map + offset + CACHE_RECORD_SIZE, key, plen + glen) == 0)
+        {
+            result = rr;
+        }
+        offset += total;
+    }
+
+    munmap(map, size);
+    *end = offset;
+
+    return result;
+}
+
+/*
+    Write @arg record at @arg end, past the last whole record of the cache file @arg fd.
+    A record cut short by a crash lies past @arg end and is dropped first.
+    Called with the exclusive lock held.
+    @returns 0 on success, -1 on a write error.
+*/
+static int cache_append(int fd, const unsigned char *record, size_t length, size_t end)
+{
+    if (end == 0)
+    {
+        uint32_t header[2] = {0, CACHE_VERSION};
+
+        memcpy(header, CACHE_MAGIC, 4);
+        if (pwrite(fd, header, CACHE_HEADER_SIZE, 0) != CACHE_HEADER_SIZE)
+        {
+            return -1;
+        }
+        end = CACHE_HEADER_SIZE;
+    }
+
+    if (ftruncate(fd, end) != 0 || pwrite(fd, record, length, end) != (ssize_t)length)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+    dh_check_params() through the cache file at @arg path.
+
+    Lookups hold a shared lock and appends an exclusive one (flock()), so parallel
+    processes read together and never see half a record. The check itself runs with
+    no lock held. Whoever takes the exclusive lock first stores the result, and later
+    ones find it there. The file is created readable by its owner only: the verdicts in
+    it are trusted as far as their range goes, so the path should be private to the user.
+*/
+int dh_check_params_cached(mpz_t p, mpz_t g, const char *path)
+{
+    if (mpz_sgn(p) <= 0 || mpz_sgn(g) < 0)
+    {
+        return dh_check_params(p, g);
+    }
+
+    size_t pbytes = (mpz_sizeinbase(p, 2) + 7) / 8;
+    size_t gbytes = mpz_sgn(g) ? (mpz_sizeinbase(g, 2) + 7) / 8 : 0;
+    size_t length = CACHE_RECORD_SIZE + ((pbytes + gbytes + 7) & ~(size_t)7);
+    unsigned char *record = (unsigned char*)calloc(length, 1);
+    size_t end;
+
+    if (record == NULL)
+    {
+        return dh_check_params(p, g);
+    }
+
+    unsigned char *key = record + CACHE_RECORD_SIZE;
+
+    mpz_export(key, NULL, 1, 1, 0, 0, p);
+    mpz_export(key + pbytes, NULL, 1, 1, 0, 0, g);
+    uint64_t h = cache_hash(key, pbytes + gbytes);
+
+    int fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0 || flock(fd, LOCK_SH) != 0)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        free(record);
+
+        return dh_check_params(p, g);
+    }
+
+    int result = cache_find(fd, key, pbytes, gbytes, h, &end);
+    flock(fd, LOCK_UN);
+
+    if (result == CACHE_MISS || result == CACHE_FOREIGN)
+    {
+        int found = result;
+
+        result = dh_check_params(p, g);
+
+        if (found == CACHE_MISS)
+        {
+            // no exclusive lock, no append: a later call checks again
+            if (flock(fd, LOCK_EX) == 0 && cache_find(fd, key, pbytes, gbytes, h, &end) == CACHE_MISS)
+            {
+                int32_t stored = result;
+                uint32_t lengths[2] = {pbytes, gbytes};
+
+                memcpy(record, &h, 8);
+                memcpy(record + 8, lengths, 8);
+                memcpy(record + 16, &stored, 4);
+                cache_append(fd, record, length, end);
+            }
+            flock(fd, LOCK_UN);
+        }
+    }
+
+    close(fd);
+    free(record);
+
+    return result;
+}
+
+
+/*
+    Word size fast path. Taken when p is an odd single limb, which covers every
+    p below 2^64. The context of the last modulus is kept per thread: a handshake
+    runs four exponentiations with the same p, and the setup costs a 128 bit division.
+
+    @returns the context of p, NULL if the caller has to use mpz_powm().
+*/
+static const mont64* dh_word_ctx(mpz_t p)
+{
+#if GMP_NUMB_BITS == 64
+    static __thread mont64 ctx;
+
+    if (mpz_size(p) == 1 && mpz_odd_p(p) && mpz_cmp_ui(p, 1) > 0)
+    {
+        uint64_t m = mpz_getlimbn(p, 0);
+
+        if (ctx.m != m)
+        {
+            mont64_init(&ctx, m);
+        }
+
+        return &ctx;
+    }
+#endif
+
+    return NULL;
+}
+
+/*
+    Short exponent sizes: the low end of the exponent ranges of RFC 3526 section 8, up to the
+    next multiple of 64 bits. Each is at least twice the security strength of its group.
+*/
+static const int exponent_bits[][2] =
+{
+    {1024, 192}, {1536, 192}, {2048, 256}, {3072, 320}, {4096, 448}, {6144, 512}, {8192, 576}
+};
+
+int dh_exponent_bits(mpz_t p)
+{
+    size_t bits = mpz_sizeinbase(p, 2);
+    int count = sizeof(exponent_bits) / sizeof(exponent_bits[0]);
+    int i;
+
+    if (bits < 1024)
+    {
+        return 0;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        if (bits <= (size_t)exponent_bits[i][0])
+        {
+            return exponent_bits[i][1];
+        }
+    }
+
+    return exponent_bits[count - 1][1];
+}
+
+/*
+    Rejection sampling: draw as many random bits as the bound and retry on anything out of
+    range, so every key of the range is equally likely.
+*/
+int dh_private_key(mpz_t key, mpz_t p, int bits)
+{
+    size_t pbits = mpz_sizeinbase(p, 2);
+    int full = bits <= 0 || (size_t)bits >= pbits;
+    size_t nbits = full ? pbits : (size_t)bits;
+    int result = 0;
+
+    if (mpz_cmp_ui(p, 5) < 0)
+    {
+        return DH_ERR_PRIME;
+    }
+
+    mpz_t top;
+    mpz_init(top);
+    mpz_sub_ui(top, p, 2);
+
+    do
+    {
+        if (random_bits(key, nbits) != 0)
+        {
+            result = DH_ERR_RANDOM;
+
+            break;
+        }
+    }
+    while (mpz_cmp_ui(key, 2) < 0 || (full && mpz_cmp(key, top) > 0));
+
+    mpz_clear(top);
+
+    return result;
+}
+
+
+static mont_comb dh_comb;
+static int dh_comb_set;
+
+/*
+    Scratch of the table per thread, kept from one exponentiation to the next. Its size
+    only depends on the limbs of p, so a table of another p of the same size reuses it.
+    A thread that ends frees it.
+*/
+static __thread mont_scratch comb_scratch;
+static __thread mp_size_t comb_scratch_size;    // limbs it is sized for, 0 if none
+static pthread_key_t comb_scratch_key;
+static pthread_once_t comb_scratch_once = PTHREAD_ONCE_INIT;
+
+static void comb_scratch_release(void *arg)
+{
+    mont_scratch_clear((mont_scratch*)arg);
+}
+
+static void comb_scratch_key_init()
+{
+    pthread_key_create(&comb_scratch_key, comb_scratch_release);
+}
+
+static mont_scratch* dh_comb_scratch()
+{
+    if (comb_scratch_size != dh_comb.ctx.size)
+    {
+        if (comb_scratch_size != 0)
+        {
+            mont_scratch_clear(&comb_scratch);
+        }
+        else
+        {
+            pthread_once(&comb_scratch_once, comb_scratch_key_init);
+            pthread_setspecific(comb_scratch_key, &comb_scratch);
+        }
+
+        mont_scratch_init(&comb_scratch, &dh_comb.ctx);
+        comb_scratch_size = dh_comb.ctx.size;
+    }
+
+    return &comb_scratch;
+}
+
+int dh_fixed_base(mpz_t g, mpz_t p, const char *path)
+{
+    size_t bits = mpz_sizeinbase(p, 2);
+
+    if (mpz_cmp_ui(p, 1) <= 0 || mpz_even_p(p))
+    {
+        return DH_ERR_PRIME;
+    }
+
+    dh_fixed_base_clear();
+
+    if (path != NULL && mont_comb_load(&dh_comb, g, p, bits, path) == 0)
+    {
+        dh_comb_set = 1;
+
+        return 0;
+    }
+
+    mont_comb_init(&dh_comb, g, p, bits);
+    dh_comb_set = 1;
+
+    if (path != NULL && mont_comb_write(&dh_comb, path) != 0)
+    {
+        return DH_ERR_TABLE;
+    }
+
+    return 0;
+}
+
+void dh_fixed_base_clear()
+{
+    if (dh_comb_set)
+    {
+        mont_comb_clear(&dh_comb);
+        dh_comb_set = 0;
+    }
+}
+
+/*
+    r = base^exp mod p, on the word size path when it applies, else through the
+    fixed base table when base and p are the ones of the table.
+*/
+static void dh_powm(mpz_t r, mpz_t base, mpz_t exp, mpz_t p)
+{
+    const mont64 *ctx = dh_word_ctx(p);
+
+    if (ctx != NULL && mpz_sgn(exp) >= 0 && mpz_size(exp) <= 1)
+    {
+        mpz_set_ui(r, mont64_powm(ctx, mpz_fdiv_ui(base, ctx->m), mpz_getlimbn(exp, 0)));
+
+        return;
+    }
+
+    if (dh_comb_set && mpz_sgn(exp) >= 0 && mpz_cmp(base, dh_comb.base) == 0
+        && mpz_cmp(p, dh_comb.ctx.m) == 0 && mpz_sizeinbase(exp, 2) <= mont_comb_bits(&dh_comb))
+    {
+        mont_comb_powm(r, exp, &dh_comb, dh_comb_scratch());
+
+        return;
+    }
+
+    mpz_powm(r, base, exp, p);
+}
+
+/*
+    Do the math to calculate the public key.
+*/
+void dh_public_key(mpz_t A, mpz_t g, mpz_t key, mpz_t p)
+{
+    dh_powm(A, g, key, p);
+}
+
+/*
+    Do the math to calculate the secret key.
+*/
+void dh_shared_secret(mpz_t s, mpz_t pKey, mpz_t sKey, mpz_t p)
+{
+    dh_powm(s, pKey, sKey, p);
+}
+
+/*
+    Both sides of an exchange. On the word size path the two public keys, then
+    the two views of the secret, run as interleaved pairs (mont64_powm2()).
+*/
+int dh_exchange(mpz_t A, mpz_t B, mpz_t s, mpz_t g, mpz_t a, mpz_t b, mpz_t p)
+{
+    const mont64 *ctx = dh_word_ctx(p);
+    int match;
+
+    if (ctx != NULL && mpz_sgn(a) >= 0 && mpz_size(a) <= 1 && mpz_sgn(b) >= 0 && mpz_size(b) <= 1)
+    {
+        uint64_t ea = mpz_getlimbn(a, 0);
+        uint64_t eb = mpz_getlimbn(b, 0);
+        uint64_t ga = mpz_fdiv_ui(g, ctx->m);
+        uint64_t ka, kb, sa, sb;
+
+        mont64_powm2(ctx, ga, ea, ga, eb, &ka, &kb);
+        mont64_powm2(ctx, kb, ea, ka, eb, &sa, &sb);
+
+        mpz_set_ui(A, ka);
+        mpz_set_ui(B, kb);
+        mpz_set_ui(s, sb);
+        match = sa == sb;
+    }
+    else
+    {
+        mpz_t check;
+        mpz_init(check);
+
+        dh_powm(A, g, a, p);
+        dh_powm(B, g, b, p);
+        dh_powm(s, A, b, p);
+        dh_powm(check, B, a, p);
+
+        match = mpz_cmp(s, check) == 0;
+        mpz_clear(check);
+    }
+
+    return match ? 0 : DH_ERR_MISMATCH;
+}
+
+
+int dh_x25519_private_key(mpz_t key)
+{
+    unsigned char buffer[X25519_BYTES];
+
+    if (random_bytes(buffer, X25519_BYTES) != 0)
+    {
+        return DH_ERR_RANDOM;
+    }
+
+    mpz_import(key, X25519_BYTES, -1, 1, 0, 0, buffer);
+    memset(buffer, 0, X25519_BYTES);
+
+    return 0;
+}
+
+/*
+    Integer to a 32 byte little endian string and back. Bits from 256 up are dropped.
+*/
+static void x25519_export(uint8_t out[X25519_BYTES], mpz_t x)
+{
+    size_t count = 0;
+    mpz_t low;
+
+    mpz_init(low);
+    mpz_fdiv_r_2exp(low, x, 8 * X25519_BYTES);
+    memset(out, 0, X25519_BYTES);
+    mpz_export(out, &count, -1, 1, 0, 0, low);
+    mpz_clear(low);
+}
+
+static void x25519_import(mpz_t x, const uint8_t in[X25519_BYTES])
+{
+    mpz_import(x, X25519_BYTES, -1, 1, 0, 0, in);
+}
+
+int dh_x25519_exchange(mpz_t A, mpz_t B, mpz_t s, mpz_t a, mpz_t b)
+{
+    uint8_t ka[X25519_BYTES], kb[X25519_BYTES];
+    uint8_t pa[X25519_BYTES], pb[X25519_BYTES], secret[X25519_BYTES];
+
+    x25519_export(ka, a);
+    x25519_export(kb, b);
+
+    int result = x25519_exchange(pa, pb, secret, ka, kb);
+
+    x25519_import(A, pa);
+    x25519_import(B, pb);
+    x25519_import(s, secret);
+
+    memset(ka, 0, X25519_BYTES);
+    memset(kb, 0, X25519_BYTES);
+
+    return result == 0 ? 0 : DH_ERR_MISMATCH;
+}
+
+
+/*
+    Half of an X25519 exchange: out = X25519(scalar, u), u = 9 if @arg u is NULL.
+*/
+static int x25519_half(mpz_t out, mpz_t scalar, mpz_t u)
+{
+    uint8_t k[X25519_BYTES], point[X25519_BYTES] = {9}, r[X25519_BYTES];
+
+    if (u != NULL && mpz_sizeinbase(u, 2) > 8 * X25519_BYTES)
+    {
+        return DH_ERR_PUBLIC;
+    }
+
+    x25519_export(k, scalar);
+    if (u != NULL)
+    {
+        x25519_export(point, u);
+    }
+
+    int result = x25519(r, k, point);
+    x25519_import(out, r);
+    memset(k, 0, X25519_BYTES);
+
+    return result == 0 ? 0 : DH_ERR_PUBLIC;
+}
+
+/*
+    Group of a handshake into @arg p and @arg g.
+    @returns 1 for x25519, 0 for a MODP group, DH_ERR_GROUP.
+*/
+static int half_group(mpz_t p, mpz_t g, const char *group)
+{
+    if (strcmp(group, DH_X25519) == 0)
+    {
+        return 1;
+    }
+
+    return dh_group_set(p, g, group);
+}
+
+/*
+    1 < key < p - 1: not 0, 1 or p - 1, which give away the secret.
+*/
+static int public_in_range(mpz_t key, mpz_t p)
+{
+    int valid;
+    mpz_t p_1;
+
+    mpz_init(p_1);
+    mpz_sub_ui(p_1, p, 1);
+    valid = mpz_cmp_ui(key, 1) > 0 && mpz_cmp(key, p_1) < 0;
+    mpz_clear(p_1);
+
+    return valid;
+}
+
+int dh_initiate(mpz_t a, mpz_t A, const char *group, int bits)
+{
+    mpz_t p, g;
+    int result;
+
+    mpz_inits(p, g, NULL);
+
+    if ((result = half_group(p, g, group)) == 1)
+    {
+        result = dh_x25519_private_key(a);
+        result = result != 0 ? result : x25519_half(A, a, NULL);
+    }
+    else if (result == 0 && (result = dh_private_key(a, p, bits < 0 ? dh_exponent_bits(p) : bits)) == 0)
+    {
+        dh_public_key(A, g, a, p);
+    }
+
+    mpz_clears(p, g, NULL);
+
+    return result;
+}
+
+int dh_respond(mpz_t B, mpz_t s, mpz_t A, const char *group, int bits)
+{
+    mpz_t p, g, b;
+    int result;
+
+    mpz_inits(p, g, b, NULL);
+
+    if ((result = half_group(p, g, group)) == 1)
+    {
+        result = dh_x25519_private_key(b);
+        result = result != 0 ? result : x25519_half(B, b, NULL);
+        result = result != 0 ? result : x25519_half(s, b, A);
+    }
+    else if (result == 0 && !public_in_range(A, p))
+    {
+        result = DH_ERR_PUBLIC;
+    }
+    else if (result == 0 && (result = dh_private_key(b, p, bits < 0 ? dh_exponent_bits(p) : bits)) == 0)
+    {
+        dh_public_key(B, g, b, p);
+        dh_shared_secret(s, A, b, p);
+    }
+
+    mpz_set_ui(b, 0);
+    mpz_clears(p, g, b, NULL);
+
+    return result;
+}
+
+int dh_finish(mpz_t s, mpz_t B, mpz_t a, const char *group)
+{
+    mpz_t p, g;
+    int result;
+
+    mpz_inits(p, g, NULL);
+
+    if ((result = half_group(p, g, group)) == 1)
+    {
+        result = x25519_half(s, a, B);
+    }
+    else if (result == 0 && !public_in_range(B, p))
+    {
+        result = DH_ERR_PUBLIC;
+    }
+    else if (result == 0)
+    {
+        dh_shared_secret(s, B, a, p);
+    }
+
+    mpz_clears(p, g, NULL);
+
+    return result;
+}
+
+
+/*
+    Batch of exchanges, as the block pool of rsa.c. While the workers compute chunk i,
+    this thread writes the results of chunk i - 1 and reads chunk i + 1. Rows of a chunk
+    differ in cost by orders of magnitude (toy groups next to modp8192), so workers take
+    them one at a time from a shared index rather than in fixed slices.
+*/
+#define BATCH_ROWS 16           // rows per worker per chunk
+
+typedef struct
+{
+    int jobs;
+    int bits;
+    const char *cache;
+
+    char **rows;                // lines of the current chunk
+    size_t *lines;              // their line numbers
+    char **results;             // output lines of the current chunk
+    size_t count;
+    atomic_size_t next;         // next row to take
+
+    int stop;
+    pthread_barrier_t start;
+    pthread_barrier_t done;
+} batch_pool;
+
+typedef struct
+{
+    pthread_t thread;
+    batch_pool *pool;
+    unsigned long long failed;
+} batch_worker_t;
+
+/*
+    Numbers of one worker. (vp, vg) are the last p and g that passed validation.
+*/
+typedef struct
+{
+    mpz_t p, g, a, b, A, B, s;
+    mpz_t vp, vg;
+    int valid;
+} batch_scratch;
+
+
+static char* batch_trim(char *s)
+{
+    char *end;
+
+    while (isspace((unsigned char)*s))
+    {
+        s++;
+    }
+
+    end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1]))
+    {
+        end--;
+    }
+    *end = '\0';
+
+    return s;
+}
+
+/*
+    Split @arg line at commas in place, into trimmed fields.
+    @returns the number of fields, max + 1 if there are more than @arg max.
+*/
+static int batch_fields(char *line, char *fields[], int max)
+{
+    int count = 0;
+
+    while (1)
+    {
+        char *end = strchr(line, ',');
+
+        if (count == max)
+        {
+            return max + 1;
+        }
+        if (end != NULL)
+        {
+            *end = '\0';
+        }
+        fields[count++] = batch_trim(line);
+
+        if (end == NULL)
+        {
+            return count;
+        }
+        line = end + 1;
+    }
+}
+
+/*
+    Private key from a field. An empty field is generated.
+*/
+static int batch_key(mpz_t key, const char *field, mpz_t p, int bits, int x25519)
+{
+    if (*field == '\0')
+    {
+        if (x25519)
+        {
+            return dh_x25519_private_key(key);
+        }
+
+        return dh_private_key(key, p, bits < 0 ? dh_exponent_bits(p) : bits);
+    }
+
+    if (mpz_set_str(key, field, 0) != 0 || mpz_sgn(key) < 0)
+    {
+        return DH_ERR_ROW;
+    }
+    if (x25519 ? mpz_sizeinbase(key, 2) > 256 : mpz_cmp(key, p) >= 0)
+    {
+        return DH_ERR_ROW;
+    }
+
+    return 0;
+}
+
+/*
+    One exchange of a row into s->A, s->B and s->s.
+    @returns 0 on success or a DH_ERR_* code.
+*/
+static int batch_row(batch_scratch *s, char *line, batch_pool *pool)
+{
+    char *fields[4];
+    int count = batch_fields(line, fields, 4);
+    int x25519 = 0;
+    int result;
+
+    if (count == 3)
+    {
+        x25519 = strcmp(fields[0], DH_X25519) == 0;
+        if (!x25519 && dh_group_set(s->p, s->g, fields[0]) != 0)
+        {
+            return DH_ERR_GROUP;
+        }
+    }
+    else if (count == 4)
+    {
+        if (mpz_set_str(s->p, fields[0], 0) != 0 || mpz_set_str(s->g, fields[1], 0) != 0)
+        {
+            return DH_ERR_ROW;
+        }
+
+        if (!s->valid || mpz_cmp(s->p, s->vp) != 0 || mpz_cmp(s->g, s->vg) != 0)
+        {
+            s->valid = 0;
+            result = pool->cache != NULL ? dh_check_params_cached(s->p, s->g, pool->cache)
+                                         : dh_check_params(s->p, s->g);
+            if (result != 0)
+            {
+                return result;
+            }
+
+            mpz_set(s->vp, s->p);
+            mpz_set(s->vg, s->g);
+            s->valid = 1;
+        }
+    }
+    else
+    {
+        return DH_ERR_ROW;
+    }
+
+    if ((result = batch_key(s->a, fields[count - 2], s->p, pool->bits, x25519)) != 0
+        || (result = batch_key(s->b, fields[count - 1], s->p, pool->bits, x25519)) != 0)
+    {
+        return result;
+    }
+
+    if (x25519)
+    {
+        return dh_x25519_exchange(s->A, s->B, s->s, s->a, s->b);
+    }
+
+    return dh_exchange(s->A, s->B, s->s, s->g, s->a, s->b, s->p);
+}
+
+/*
+    Output line of a row: the three numbers, or the reason it was rejected.
+*/
+static char* batch_result(batch_scratch *s, int result, size_t line)
+{
+    size_t size = 96;
+    char *out;
+
+    if (result == 0)
+    {
+        size = mpz_sizeinbase(s->A, 10) + mpz_sizeinbase(s->B, 10) + mpz_sizeinbase(s->s, 10) + 16;
+    }
+
+    out = (char*)malloc(size);
+
+    if (result == 0)
+    {
+        gmp_snprintf(out, size, "<%Zd>,<%Zd>,<%Zd>\n", s->A, s->B, s->s);
+    }
+    else
+    {
+        snprintf(out, size, "# line %zu: %s\n", line, dh_error_string(result));
+    }
+
+    return out;
+}
+
+static void* batch_worker(void *arg)
+{
+    batch_worker_t *worker = (batch_worker_t*)arg;
+    batch_pool *pool = worker->pool;
+    batch_scratch s;
+
+    mpz_inits(s.p, s.g, s.a, s.b, s.A, s.B, s.s, s.vp, s.vg, NULL);
+    s.valid = 0;
+
+    while (1)
+    {
+        pthread_barrier_wait(&pool->start);
+        if (pool->stop)
+        {
+            break;
+        }
+
+        size_t i;
+        while ((i = atomic_fetch_add(&pool->next, 1)) < pool->count)
+        {
+            int result = batch_row(&s, pool->rows[i], pool);
+
+            pool->results[i] = batch_result(&s, result, pool->lines[i]);
+            worker->failed += result != 0;
+        }
+
+        pthread_barrier_wait(&pool->done);
+    }
+
+    mpz_set_ui(s.a, 0);
+    mpz_set_ui(s.b, 0);
+    mpz_clears(s.p, s.g, s.a, s.b, s.A, s.B, s.s, s.vp, s.vg, NULL);
+
+    return NULL;
+}
+
+/*
+    Read up to @arg max rows, skipping blank lines and comments.
+    @returns the number of rows. 0 at the end of the input.
+*/
+static size_t batch_read(FILE *in, char **rows, size_t *lines, size_t max, size_t *line, int *error)
+{
+    size_t count = 0;
+
+    while (count < max)
+    {
+        char *row = NULL;
+        size_t size = 0;
+
+        if (getline(&row, &size, in) < 0)
+        {
+            free(row);
+            if (ferror(in))
+            {
+                *error = DH_ERR_IO;
+            }
+
+            break;
+        }
+        (*line)++;
+
+        char *start = row;
+        while (isspace((unsigned char)*start))
+        {
+            start++;
+        }
+        if (*start == '\0' || *start == '#')
+        {
+            free(row);
+
+            continue;
+        }
+
+        rows[count] = row;
+        lines[count] = *line;
+        count++;
+    }
+
+    return count;
+}
+
+static void batch_write(FILE *out, char **results, char **rows, size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        fputs(results[i], out);
+        free(results[i]);
+        free(rows[i]);
+    }
+
+    // stream: every chunk reaches the file as soon as it is done
+    fflush(out);
+}
+
+int dh_batch(FILE *in, FILE *out, int jobs, int bits, const char *cache, dh_batch_stats *stats)
+{
+    size_t chunk;
+    char **rows[2];
+    char **results[2];
+    size_t *lines[2];
+    size_t count[2];
+    size_t pending = 0;
+    size_t line = 0;
+    int cur = 0;
+    int error = 0;
+    int i;
+
+    jobs = jobs < 1 ? 1 : jobs;
+    chunk = BATCH_ROWS * (size_t)jobs;
+
+    for (i = 0; i < 2; i++)
+    {
+        rows[i] = (char**)malloc(sizeof(char*) * chunk);
+        results[i] = (char**)malloc(sizeof(char*) * chunk);
+        lines[i] = (size_t*)malloc(sizeof(size_t) * chunk);
+    }
+
+    batch_pool pool;
+    batch_worker_t *workers = (batch_worker_t*)malloc(sizeof(batch_worker_t) * jobs);
+
+    pool.jobs = jobs;
+    pool.bits = bits;
+    pool.cache = cache;
+    pool.stop = 0;
+    pthread_barrier_init(&pool.start, NULL, jobs + 1);
+    pthread_barrier_init(&pool.done, NULL, jobs + 1);
+
+    for (i = 0; i < jobs; i++)
+    {
+        workers[i].pool = &pool;
+        workers[i].failed = 0;
+        pthread_create(&workers[i].thread, NULL, batch_worker, &workers[i]);
+    }
+
+    stats->rows = 0;
+    stats->failed = 0;
+
+    count[cur] = batch_read(in, rows[cur], lines[cur], chunk, &line, &error);
+
+    while (count[cur] > 0)
+    {
+        pool.rows = rows[cur];
+        pool.lines = lines[cur];
+        pool.results = results[cur];
+        pool.count = count[cur];
+        atomic_store(&pool.next, 0);
+        pthread_barrier_wait(&pool.start);
+
+        batch_write(out, results[cur ^ 1], rows[cur ^ 1], pending);
+        count[cur ^ 1] = error ? 0 : batch_read(in, rows[cur ^ 1], lines[cur ^ 1], chunk, &line, &error);
+
+        pthread_barrier_wait(&pool.done);
+
+        pending = count[cur];
+        stats->rows += pending;
+        cur ^= 1;
+    }
+
+    batch_write(out, results[cur ^ 1], rows[cur ^ 1], pending);
+
+    pool.stop = 1;
+    pthread_barrier_wait(&pool.start);
+
+    for (i = 0; i < jobs; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        stats->failed += workers[i].failed;
+    }
+
+    pthread_barrier_destroy(&pool.start);
+    pthread_barrier_destroy(&pool.done);
+
+    free(workers);
+    for (i = 0; i < 2; i++)
+    {
+        free(rows[i]);
+        free(results[i]);
+        free(lines[i]);
+    }
+
+    return error != 0 || ferror(out) ? DH_ERR_IO : 0;
+}
@@ -0,0 +1,208 @@
+#ifndef DH_H
+#define DH_H
+
+#include <stdio.h>
+#include <gmp.h>
+
+/*
+    Diffie-Hellman key exchange over a prime p with generator g.
+    Used by the dh_assign_1 tool and by the bench.
+
+    Parameters are given by the user or taken from the MODP groups of RFC 3526:
+    safe primes p = 2q + 1 of 1536 to 8192 bits with g = 2.
+*/
+
+
+/*
+    Errors returned by dh_check_params() and dh_group_set(). 0 is success.
+*/
+#define DH_ERR_PRIME -1         // p is not a prime, or beyond 64 bits not a safe prime
+#define DH_ERR_GENERATOR -2     // g is not a primitive root of p, or beyond 64 bits 1 or p - 1
+#define DH_ERR_GROUP -3         // no group of that name
+#define DH_ERR_MISMATCH -4      // both sides computed different secrets
+#define DH_ERR_TABLE -5         // the fixed base table file can not be written
+#define DH_ERR_RANDOM -6        // no system randomness for a private key
+#define DH_ERR_ROW -7           // a batch row is not p,g,a,b or group,a,b, or a secret is not below p
+#define DH_ERR_IO -8            // a batch file can not be read or written
+#define DH_ERR_PUBLIC -9        // a public key of the other side is out of range
+
+/*
+    Message of a DH_ERR_* code.
+*/
+const char* dh_error_string(int error);
+
+
+/*
+    Built in group. @arg prime is p in hexadecimal.
+*/
+typedef struct
+{
+    const char *name;
+    int bits;
+    const char *prime;
+    unsigned long generator;
+} dh_group;
+
+extern const dh_group dh_groups[];
+extern const int dh_group_count;
+
+
+/*
+    Group of name @arg name ("modp2048", ...). NULL if there is none.
+*/
+const dh_group* dh_group_find(const char *name);
+
+/*
+    Set p and g to the group of name @arg name.
+    @returns 0 on success, DH_ERR_GROUP if there is no such group.
+*/
+int dh_group_set(mpz_t p, mpz_t g, const char *name);
+
+/*
+    Validate user given parameters.
+
+    p up to 64 bits must be a prime and g a primitive root of p.
+    Larger p must be a safe prime, p = 2q + 1 with p and q probable primes, and
+    1 < g < p - 1. g then generates the subgroup of order q or the whole group,
+    which is not checked to be a primitive root.
+
+    @returns 0 on success, DH_ERR_PRIME or DH_ERR_GENERATOR.
+*/
+int dh_check_params(mpz_t p, mpz_t g);
+
+/*
+    dh_check_params() with the result kept in the cache file at @arg path, keyed by a
+    hash of (p, g). A later call with the same p and g, from any process, is a single
+    lookup. The file is created if missing, mode 0600, and is safe to share by parallel
+    processes of the same user. A record whose verdict is not one of the codes below is
+    ignored and the check runs again.
+
+    If the cache can not be used (no access, not a cache file) the check runs uncached.
+    @returns 0 on success, DH_ERR_PRIME or DH_ERR_GENERATOR.
+*/
+int dh_check_params_cached(mpz_t p, mpz_t g, const char *path);
+
+/*
+    Size of a short private exponent for @arg p, from the ranges RFC 3526 gives for its
+    groups: 256 bits for a 2048 bit p, 576 for 8192 bits.
+    @returns 0 for p below 1024 bits, where only full size exponents make sense.
+*/
+int dh_exponent_bits(mpz_t p);
+
+/*
+    Private key from the system random source (/dev/urandom).
+
+    @arg bits 0: uniform in [2, p - 2], as long as p.
+    @arg bits > 0: a short exponent, uniform in [2, 2^bits). Each exponentiation then costs
+    bits squarings instead of the size of p. Only for safe primes such as the MODP groups,
+    where g generates a subgroup of large prime order. Falls back to full size when bits
+    is not below the size of p.
+
+    @returns 0 on success, DH_ERR_PRIME if p < 5, DH_ERR_RANDOM if there is no randomness.
+*/
+int dh_private_key(mpz_t key, mpz_t p, int bits);
+
+/*
+    Fixed base table of @arg g for @arg p (mont_comb of mont.h). Mapped from the file at
+    @arg path if it holds the table of this g and p, else built and written there.
+    A NULL path keeps the table in memory only.
+
+    While it is set, dh_public_key() and dh_exchange() raise g through it, 4 to 6 times
+    faster than mpz_powm() for MODP sizes. Set it before threads start using it.
+
+    @returns 0 on success, DH_ERR_PRIME if p is not odd, DH_ERR_TABLE if the file can not
+    be written. The table is set in memory anyway.
+*/
+int dh_fixed_base(mpz_t g, mpz_t p, const char *path);
+void dh_fixed_base_clear();
+
+/*
+    Public key A = g^key mod p of a secret integer @arg key.
+    p below 2^64 runs on native 64 bit Montgomery arithmetic (mont64.h).
+*/
+void dh_public_key(mpz_t A, mpz_t g, mpz_t key, mpz_t p);
+
+/*
+    Shared secret s = pKey^sKey mod p from the public key of the other side
+    and our own secret integer.
+*/
+void dh_shared_secret(mpz_t s, mpz_t pKey, mpz_t sKey, mpz_t p);
+
+/*
+    Full exchange between secrets @arg a and @arg b: A = g^a, B = g^b and s = A^b mod p,
+    checked against B^a. Below 2^64 both sides run interleaved.
+
+    @returns 0 on success, DH_ERR_MISMATCH if the two views of the secret differ.
+*/
+int dh_exchange(mpz_t A, mpz_t B, mpz_t s, mpz_t g, mpz_t a, mpz_t b, mpz_t p);
+
+
+/*
+    X25519 (x25519.h) in place of a prime and generator, as the group of this name.
+
+    Keys and secrets are the integers of the 32 byte little endian strings of RFC 7748,
+    so they print and parse like the numbers of the p and g mode. Private keys are below
+    2^256 and are clamped by X25519 itself.
+*/
+#define DH_X25519 "x25519"
+
+/*
+    Private key of 32 bytes from the system random source.
+    @returns 0 on success, DH_ERR_RANDOM if there is no randomness.
+*/
+int dh_x25519_private_key(mpz_t key);
+
+/*
+    Full X25519 exchange between private keys @arg a and @arg b, below 2^256:
+    A = X25519(a, 9), B = X25519(b, 9) and s = X25519(b, A), checked against X25519(a, B).
+
+    @returns 0 on success, DH_ERR_MISMATCH if the two views differ or the secret is zero.
+*/
+int dh_x25519_exchange(mpz_t A, mpz_t B, mpz_t s, mpz_t a, mpz_t b);
+
+
+/*
+    The two halves of an exchange between two processes, in a group of dh_group_find()
+    or x25519. Keys are drawn as dh_private_key() does, @arg bits -1 for
+    dh_exponent_bits(p). Not meant for the word size groups, which are for tests.
+
+    dh_initiate(): private key @arg a and public key @arg A of the initiator.
+    dh_respond(): private key b drawn and dropped, public key @arg B and secret @arg s
+    for the public key @arg A of the initiator, which must be in 1 < A < p - 1.
+    dh_finish(): secret @arg s of the initiator from @arg B.
+
+    @returns 0 on success, DH_ERR_GROUP, DH_ERR_RANDOM, or DH_ERR_PUBLIC for an A or B
+    out of range or a zero x25519 secret.
+*/
+int dh_initiate(mpz_t a, mpz_t A, const char *group, int bits);
+int dh_respond(mpz_t B, mpz_t s, mpz_t A, const char *group, int bits);
+int dh_finish(mpz_t s, mpz_t B, mpz_t a, const char *group);
+
+
+/*
+    Counts of a dh_batch() run.
+*/
+typedef struct
+{
+    unsigned long long rows;        // exchanges asked for
+    unsigned long long failed;      // rows that were rejected
+} dh_batch_stats;
+
+/*
+    Many exchanges from a CSV file, on @arg jobs threads.
+
+    Every line of @arg in is a row "p,g,a,b" or "group,a,b", where group is a name of
+    dh_group_find() or x25519. Numbers are as for the tool, decimal or 0x hexadecimal.
+    An empty a or b is generated: @arg bits as for dh_private_key(), -1 for
+    dh_exponent_bits(p). Blank lines and lines starting with # are skipped.
+
+    Each row writes one line "<A>,<B>,<s>" to @arg out, in input order, as the rows are
+    done. A rejected row writes "# line N: reason" instead and the run goes on.
+    p and g of "p,g,a,b" rows are validated, through the cache file at @arg cache if it
+    is not NULL. A worker validates the same p and g of consecutive rows once.
+
+    @returns 0 on success, DH_ERR_IO if a file fails.
+*/
+int dh_batch(FILE *in, FILE *out, int jobs, int bits, const char *cache, dh_batch_stats *stats);
+
+#endif
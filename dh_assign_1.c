@@ -1,58 +1,106 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <math.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <gmp.h>
 #include "util.h"
+#include "dh.h"
+#include "dhnet.h"
+#include "tgdh.h"
+#include "arena.h"
+#include "sieve.h"
 
 /*
- * Prime numbers p and g (g previous prime from p)
+ * Prime number p and g a primitive root of p. Beyond 64 bits p must be a safe
+ * prime 2q + 1 and g generates the subgroup of order q or the whole group
  *
  * a : secret integer a<p
  * b : secret integer b<p
+ *     generated from /dev/urandom when not given, full size or short (-e)
  * 
  * A = g^a mod p
  * B = g^b mod p
  * 
  * s = B^a mod p
  * s = A^b mod p
+ *
+ * -G x25519 runs X25519 of RFC 7748 instead, with no p and g:
+ * a, b : 32 byte scalars, below 2^256
+ * A = X25519(a, 9), B = X25519(b, 9), s = X25519(a, B) = X25519(b, A)
+ * The numbers are the integers of the little endian strings of the RFC.
  
 
 
     Options:
      -o path Path to outpout file
      -p number Prime number
-     -g number Primitive Root for previous prime number
-     -a number Private key A
-     -b number Private key B
+     -g number Primitive Root of p (beyond 64 bits: 1 < g < p - 1, p a safe prime)
+     -G name Built in RFC 3526 group instead of -p and -g (modp1536 ... modp8192),
+             or x25519 for X25519 key agreement
+     -a number Private key A (optional: generated if missing)
+     -b number Private key B (optional: generated if missing)
+     -e bits|auto Bits of generated private keys. auto sizes them by p, 256 for 2048 bits.
+                  Default is as long as p
+     -c path Cache file of validated -p and -g, shared by every run (optional)
+     -t path Fixed base table file of g for p, built on the first run (optional)
+     --batch path CSV file of exchanges, one per line: p,g,a,b or group,a,b.
+                  a or b may be empty to generate them (-e applies). -p -g -G -a -b -t unused
+     --serve address Handshake server on a Unix socket path (with a '/') or [host:]port,
+                  127.0.0.1 by default, until Ctrl-C. Clients send group,A and get B (dhnet.h).
+                  -e sizes the private keys of the server. Load it with dhload.
+     --tgdh number Group key of that many members with tree based DH, simulated in this
+                  process on the -p -g or -G group. Writes <group key> to -o if given and the
+                  work of the members to stdout. -e sizes their private keys
+     -j number Worker threads of --batch, --serve and --tgdh (default: every core)
      -h This hellp message.
+
+    Numbers are decimal, or hexadecimal with a 0x prefix. They are arbitrary precision.
 */
 
-long long int p = 0;
-long long int g = 0;;
-long long int a,b;
+mpz_t p;
+mpz_t g;
+mpz_t a, b;
 char *output;
+char *group;
+char *cache;
+char *table;
+char *exponent;
+char *batch;
+char *serve;
+int tgdh;
+int jobs;
+atomic_int stop;
 
-long long int A;
-long long int B;
-long long int KEY;
+mpz_t A;
+mpz_t B;
+mpz_t KEY;
 
 
-long long int createPublicKey(long long int key);
-long long int discoverSecret(long long int pKey, long long int sKey);
-
 void HELP();
+void runBatch();
+void runServe();
+void runTgdh();
 void printData();
 void print_Data(FILE *fp, char *filename);
+void printNearestPrimes();
 
-int main(int argv, char* argc[])
+/*
+    Parse a number argument into @arg x.
+    @returns 1 on success, 0 if it is not a number.
+*/
+int parseNumber(mpz_t x, char *arg)
 {
+    return mpz_set_str(x, arg, 0) == 0 && mpz_sgn(x) >= 0;
+}
 
-    if (argv != 11)
-    {
-        HELP();
+int main(int argv, char* argc[])
+{
+    // before the first GMP allocation
+    arena_install();
 
-        exit(0);
-    }
-  
+    int has_p = 0, has_g = 0, has_a = 0, has_b = 0;
     int i = 0;
 
     for (i = 1; i < argv; i++)
@@ -65,6 +113,8 @@ int main(int argv, char* argc[])
         }
     }
 
+    mpz_inits(p, g, a, b, A, B, KEY, NULL);
+
     for (i = 1; i < argv - 1; i++)
     {
         if (argc[i][0] == '-')
@@ -75,64 +125,223 @@ int main(int argv, char* argc[])
                 output = argc[i + 1];
             }
 
-            if (argc[i][1] == 'p')
+            if (argc[i][1] == 'G')
             {
-                p = atof(argc[i + 1]);
-                if (!checkIfPrime(p))
-                {
-                    printf("False input. G is not a prime!.\n");
+                group = argc[i + 1];
+            }
 
-                    exit(1);
-                }
+            if (argc[i][1] == 'c')
+            {
+                cache = argc[i + 1];
             }
 
-            if (argc[i][1] == 'g')
+            if (argc[i][1] == 't')
             {
-                g = atof(argc[i + 1]);
+                table = argc[i + 1];
+            }
 
-                if (!checkIfPrimitiveRoot(getPrevPrime(p), g))
+            if (argc[i][1] == 'e')
+            {
+                exponent = argc[i + 1];
+            }
+
+            if (argc[i][1] == 'j')
+            {
+                jobs = atoi(argc[i + 1]);
+                if (jobs < 1)
                 {
-                    printf("False input. P is not a primitive root of G\n");
+                    printf("Invalid number of threads.\nProgram will exit...\n");
 
                     exit(1);
                 }
             }
 
+            if (strcmp(argc[i], "--batch") == 0)
+            {
+                batch = argc[i + 1];
+            }
 
-            if (argc[i][1] == 'a')
+            if (strcmp(argc[i], "--serve") == 0)
             {
-                a = atof(argc[i + 1]);
-                if (a >= p)
+                serve = argc[i + 1];
+            }
+
+            if (strcmp(argc[i], "--tgdh") == 0)
+            {
+                tgdh = atoi(argc[i + 1]);
+                if (tgdh < 2)
                 {
-                    printf("Invalid secret integer.\nMust be less than the prime root p.\n");
+                    printf("A group needs at least 2 members.\nProgram will exit...\n");
+
                     exit(1);
                 }
             }
 
+            if (argc[i][1] == 'p')
+            {
+                has_p = parseNumber(p, argc[i + 1]);
+            }
+
+            if (argc[i][1] == 'g')
+            {
+                has_g = parseNumber(g, argc[i + 1]);
+            }
+
+            // -1: given but not a number
+            if (argc[i][1] == 'a')
+            {
+                has_a = parseNumber(a, argc[i + 1]) ? 1 : -1;
+            }
 
             if (argc[i][1] == 'b')
             {
-                b = atof(argc[i + 1]);
-                if (b >= p)
-                {
-                    printf("Invalid secret integer.\nMust be less than the prime root p.\n");
-                    exit(1);
-                }
+                has_b = parseNumber(b, argc[i + 1]) ? 1 : -1;
             }
         }
     }
 
-    //printData();
+    if (serve != NULL)
+    {
+        runServe();
 
-    A = createPublicKey(a);
-    B = createPublicKey(b);
-    KEY = discoverSecret(A, b);
+        mpz_clears(p, g, a, b, A, B, KEY, NULL);
 
-    // check
-    if (discoverSecret(B, a) != discoverSecret(A, b))
+        return 0;
+    }
+
+    if (output != NULL && batch != NULL)
     {
-        printf("Error... not matching common key!\n");
-        exit(1);
+        runBatch();
+
+        mpz_clears(p, g, a, b, A, B, KEY, NULL);
+
+        return 0;
+    }
+
+    if ((output == NULL && tgdh == 0) || has_a < 0 || has_b < 0 || (group == NULL && (!has_p || !has_g)))
+    {
+        HELP();
+
+        exit(0);
+    }
+
+    if (group != NULL && strcmp(group, DH_X25519) == 0)
+    {
+        if (tgdh > 0)
+        {
+            printf("--tgdh needs a prime group, -p and -g or a MODP group.\nProgram will exit...\n");
+
+            exit(1);
+        }
+
+        if ((!has_a && dh_x25519_private_key(a) != 0) || (!has_b && dh_x25519_private_key(b) != 0))
+        {
+            printf("Could not generate private keys: no system randomness.\nProgram will exit...\n");
+
+            exit(1);
+        }
+
+        if (mpz_sizeinbase(a, 2) > 256 || mpz_sizeinbase(b, 2) > 256)
+        {
+            printf("Invalid secret integer.\nMust be less than 2^256 for x25519.\n");
+            exit(1);
+        }
+
+        if (dh_x25519_exchange(A, B, KEY, a, b) != 0)
+        {
+            printf("Error... not matching common key!\n");
+            exit(1);
+        }
+    }
+    else
+    {
+        if (group != NULL)
+        {
+            if (dh_group_set(p, g, group) != 0)
+            {
+                printf("False input. No group named %s.\n", group);
+
+                exit(1);
+            }
+        }
+        else
+        {
+            int result = cache != NULL ? dh_check_params_cached(p, g, cache) : dh_check_params(p, g);
+
+            int large = mpz_sizeinbase(p, 2) > 64;
+
+            if (result == DH_ERR_PRIME)
+            {
+                printf(large ? "False input. P is not a safe prime!.\n" : "False input. G is not a prime!.\n");
+                if (!large)
+                {
+                    printNearestPrimes();
+                }
+
+                exit(1);
+            }
+            if (result == DH_ERR_GENERATOR)
+            {
+                printf(large ? "False input. G must be above 1 and below P - 1\n"
+                             : "False input. P is not a primitive root of G\n");
+
+                exit(1);
+            }
+        }
+
+        if (tgdh > 0)
+        {
+            runTgdh();
+
+            dh_fixed_base_clear();
+            mpz_clears(p, g, a, b, A, B, KEY, NULL);
+
+            return 0;
+        }
+
+        if (!has_a || !has_b)
+        {
+            int bits = 0;
+            char *end = NULL;
+
+            if (exponent != NULL)
+            {
+                bits = strcmp(exponent, "auto") == 0 ? dh_exponent_bits(p) : (int)strtol(exponent, &end, 10);
+            }
+            if (bits < 0 || (end != NULL && *end != '\0'))
+            {
+                printf("Invalid size of private keys: %s.\nProgram will exit...\n", exponent);
+
+                exit(1);
+            }
+
+            if ((!has_a && dh_private_key(a, p, bits) != 0) || (!has_b && dh_private_key(b, p, bits) != 0))
+            {
+                printf("Could not generate private keys: no system randomness or p below 5.\nProgram will exit...\n");
+
+                exit(1);
+            }
+        }
+
+        if (mpz_cmp(a, p) >= 0 || mpz_cmp(b, p) >= 0)
+        {
+            printf("Invalid secret integer.\nMust be less than the prime root p.\n");
+            exit(1);
+        }
+
+        //printData();
+
+        if (table != NULL && dh_fixed_base(g, p, table) == DH_ERR_TABLE)
+        {
+            printf("Could not write the table file %s. It will be built again next run.\n", table);
+        }
+
+        // compute both sides and check
+        if (dh_exchange(A, B, KEY, g, a, b, p) != 0)
+        {
+            printf("Error... not matching common key!\n");
+            exit(1);
+        }
     }
 
 
@@ -145,7 +354,7 @@ int main(int argv, char* argc[])
     }
 
     // save to a file
-    fprintf(fp, "<%lld>,<%lld>,<%lld>", A, B, KEY);
+    gmp_fprintf(fp, "<%Zd>,<%Zd>,<%Zd>", A, B, KEY);
 
     fflush(fp);
 
@@ -155,38 +364,226 @@ int main(int argv, char* argc[])
 
     fclose(fp);
 
+    dh_fixed_base_clear();
+    mpz_clears(p, g, a, b, A, B, KEY, NULL);
 
     return 0;
 }
 
 
 /*
-    Do the math to calculate the secret key.
+    Helper function for -h argument.
+*/
+void HELP(){
+    fprintf(stdout, "Options:\n\
+     \t-o path Path to output file\n\
+     \t-p number Prime number\n\
+     \t-g number Primitive Root of p (beyond 64 bits: 1 < g < p - 1, p a safe prime)\n\
+     \t-G name RFC 3526 group instead of -p and -g: modp1536 modp2048 modp3072 modp4096 modp6144 modp8192\n\
+     \t        or x25519 for X25519 key agreement (-a and -b below 2^256, -c -t -e unused)\n\
+     \t-a number Private key A (optional: generated if missing)\n\
+     \t-b number Private key B (optional: generated if missing)\n\
+     \t-e bits|auto Bits of generated private keys. auto sizes them by p, 256 for 2048 bits.\n\
+     \t             Default is as long as p\n\
+     \t-c path Cache file of validated -p and -g, shared by every run (optional)\n\
+     \t-t path Fixed base table file of g for p, built on the first run (optional)\n\
+     \t--batch path CSV file of exchanges, one per line: p,g,a,b or group,a,b.\n\
+     \t             a or b may be empty to generate them (-e applies). -p -g -G -a -b -t unused\n\
+     \t--serve address Handshake server on a Unix socket path (with a '/') or [host:]port,\n\
+     \t             127.0.0.1 by default, until Ctrl-C. Clients send group,A and get B (dhnet.h).\n\
+     \t             -e sizes the private keys of the server. Load it with dhload.\n\
+     \t--tgdh number Group key of that many members with tree based DH, simulated in this\n\
+     \t             process on the -p -g or -G group. Writes <group key> to -o if given and the\n\
+     \t             work of the members to stdout. -e sizes their private keys\n\
+     \t-j number Worker threads of --batch, --serve and --tgdh (default: every core)\n\
+     \t-h This hellp message.\n");
+}
+
+
+/*
+    -e of --batch and --serve: bits of dh_private_key(), -1 for auto. Picks -j if not given.
 */
-long long int discoverSecret(long long int pKey, long long int sKey)
+int poolOptions()
 {
-    return fmod(pow(pKey, sKey), p);
+    int bits = 0;
+    char *end = NULL;
+
+    if (exponent != NULL)
+    {
+        bits = strcmp(exponent, "auto") == 0 ? -1 : (int)strtol(exponent, &end, 10);
+    }
+    if (bits < -1 || (end != NULL && (*end != '\0' || bits < 0)))
+    {
+        printf("Invalid size of private keys: %s.\nProgram will exit...\n", exponent);
+
+        exit(1);
+    }
+
+    if (jobs == 0)
+    {
+        jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = jobs < 1 ? 1 : jobs;
+    }
+
+    return bits;
 }
+
 /*
-    Do the math to calculate the public key.
+    --batch: every row of the CSV file through dh_batch(), results streamed to the output
+    file in input order, then a summary of the rate on stdout.
 */
-long long int createPublicKey(long long int sKey)
+void runBatch()
 {
-    return fmod(pow(g, sKey), p);
+    int bits = poolOptions();
+
+    FILE *fin, *fout;
+    if ((fin = fopen(batch, "r")) == NULL || (fout = fopen(output, "w")) == NULL)
+    {
+        fprintf(stdout, "Error opening file.\n");
+
+        exit(1);
+    }
+
+    dh_batch_stats stats;
+    struct timespec t0, t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int result = dh_batch(fin, fout, jobs, bits, cache, &stats);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    fclose(fin);
+    fclose(fout);
+
+    if (result != 0)
+    {
+        printf("Error reading %s or writing %s.\nProgram will exit...\n", batch, output);
+
+        exit(1);
+    }
+
+    double seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    unsigned long long done = stats.rows - stats.failed;
+
+    printf("%llu exchanges, %llu rejected, in %.3f s on %d threads: %.1f exchanges/s\n",
+           done, stats.failed, seconds, jobs, seconds > 0 ? done / seconds : 0.0);
 }
 
 
+void onSignal(int sig)
+{
+    atomic_store(&stop, 1);
+}
+
 /*
-    Helper function for -h argument.
+    --serve: handshakes for dhload or any client of dhnet.h until SIGINT or SIGTERM,
+    then the counts on stdout.
 */
-void HELP(){
-    fprintf(stdout, "Options:\n\
-     \t-o path Path to output file\n\
-     \t-p number Prime number\n\
-     \t-g number Primitive Root for previous prime number\n\
-     \t-a number Private key A\n\
-     \t-b number Private key B\n\
-     \t-h This hellp message.\n");
+void runServe()
+{
+    int bits = poolOptions();
+    int fd = dhnet_listen(serve);
+
+    if (fd < 0)
+    {
+        printf("Could not listen on %s.\nProgram will exit...\n", serve);
+
+        exit(1);
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onSignal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    printf("Serving handshakes on %s with %d threads. Ctrl-C to stop.\n", serve, jobs);
+    fflush(stdout);
+
+    dhnet_stats stats;
+    int result = dhnet_serve(fd, jobs, bits, &stop, &stats);
+
+    close(fd);
+    if (strchr(serve, '/') != NULL)
+    {
+        unlink(serve);
+    }
+
+    printf("%llu handshakes, %llu errors, on %llu connections.\n",
+           stats.handshakes, stats.errors, stats.connections);
+
+    if (result != 0)
+    {
+        printf("Could not start the server threads.\nProgram will exit...\n");
+
+        exit(1);
+    }
+}
+
+
+/*
+    --tgdh: group key of tgdh members over p and g, all simulated here. Prints the work of
+    the members: exponentiations and their CPU time, the fewest, the mean and the most.
+*/
+void runTgdh()
+{
+    int bits = poolOptions();
+    tgdh_tree tree;
+    struct timespec t0, t1;
+    int i;
+
+    if (table != NULL && dh_fixed_base(g, p, table) == DH_ERR_TABLE)
+    {
+        printf("Could not write the table file %s. It will be built again next run.\n", table);
+    }
+
+    tgdh_init(&tree, tgdh, p, g);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int result = tgdh_run(&tree, KEY, jobs, bits);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    if (result != 0)
+    {
+        printf("Error... %s!\n", dh_error_string(result));
+        exit(1);
+    }
+
+    tgdh_cost least = tree.cost[0], most = tree.cost[0], total = {0, 0};
+
+    for (i = 0; i < tgdh; i++)
+    {
+        least.exps = tree.cost[i].exps < least.exps ? tree.cost[i].exps : least.exps;
+        least.ms = tree.cost[i].ms < least.ms ? tree.cost[i].ms : least.ms;
+        most.exps = tree.cost[i].exps > most.exps ? tree.cost[i].exps : most.exps;
+        most.ms = tree.cost[i].ms > most.ms ? tree.cost[i].ms : most.ms;
+        total.exps += tree.cost[i].exps;
+        total.ms += tree.cost[i].ms;
+    }
+
+    printf("%d members, tree height %d, %zu bit p, %d threads: group key in %.3f ms\n",
+           tgdh, tree.height, mpz_sizeinbase(p, 2), jobs,
+           (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6);
+    printf("total: %lu exponentiations, %.3f ms CPU, %lu blinded keys broadcast\n",
+           total.exps, total.ms, tree.broadcasts);
+    printf("per member: exponentiations %lu / %.1f / %lu, ms CPU %.3f / %.3f / %.3f (min / mean / max)\n",
+           least.exps, (double)total.exps / tgdh, most.exps, least.ms, total.ms / tgdh, most.ms);
+    printf("pairwise: %d exchanges per member, %ld for the group\n", tgdh - 1, (long)tgdh * (tgdh - 1) / 2);
+
+    tgdh_clear(&tree);
+
+    if (output != NULL)
+    {
+        FILE *fp;
+        if ((fp = fopen(output, "w")) == NULL)
+        {
+            fprintf(stdout, "Error opening file.\n");
+
+            exit(1);
+        }
+
+        gmp_fprintf(fp, "<%Zd>", KEY);
+        fclose(fp);
+    }
 }
 
 
@@ -195,7 +592,34 @@ void HELP(){
 */
 void printData()
 {
-    fprintf(stdout, "o: %s\np:%lld\ng:%lld\na:%lld\nb:%lld\n", output, p, g, a, b);
+    gmp_fprintf(stdout, "o: %s\np:%Zd\ng:%Zd\na:%Zd\nb:%Zd\n", output, p, g, a, b);
+}
+
+/*
+    Print the primes next to a p of up to 64 bits that is not one, found by the sieve
+    iterator in each direction.
+*/
+void printNearestPrimes()
+{
+    uint64_t pv = mpz_getlimbn(p, 0);
+    prime_iter it;
+
+    prime_iter_init(&it, pv, -1);
+    uint64_t below = prime_iter_next(&it);
+    prime_iter_clear(&it);
+
+    prime_iter_init(&it, pv, 1);
+    uint64_t above = prime_iter_next(&it);
+    prime_iter_clear(&it);
+
+    if (below != 0)
+    {
+        printf("Nearest prime below: %llu\n", (unsigned long long)below);
+    }
+    if (above != 0)
+    {
+        printf("Nearest prime above: %llu\n", (unsigned long long)above);
+    }
 }
 
 /*
@@ -214,22 +638,13 @@ void print_Data(FILE *fp, char *filename)
     rewind(fp);
 
 
-    char ch;
-    
-    char buffer[1000];
-    int i=0;
-    
+    int ch;
+
+    // numbers of large groups are thousands of digits. Stream them.
     while ((ch = fgetc(fp)) != EOF)
     {
-        if (ch != EOF)
-        {
-            buffer[i++] = ch;
-            //printf("%c",ch);
-        }
+        putchar(ch);
     }
-    buffer[i] = '\0';
-
-    printf("%s\n", buffer);
 
     printf("\n");
 
@@ -0,0 +1,400 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <gmp.h>
+#include "dh.h"
+#include "dhnet.h"
+#include "arena.h"
+
+/*
+    Load generator of the handshake server (dh_assign_1 --serve).
+
+    Opens N sessions to the server and keeps one handshake in flight on each, from a
+    single epoll loop, until the total is done. The latency of a handshake runs from
+    the request going out to the whole answer being in, plus the connect with -r.
+    Every session sends the public key of its own key pair, made before the clock starts,
+    so the client costs nothing but I/O while it measures.
+
+    Reports handshakes per second, the p50, p90, p99 and p999 latencies and a histogram
+    of them in power of 2 buckets.
+
+    Options:
+     -a address Server address: a Unix socket path (with a '/'), or [host:]port on TCP
+     -G name Group of the handshakes: modp1536 ... modp8192 or x25519 (default: modp2048)
+     -c number Parallel sessions (default: 16)
+     -n number Handshakes in total (default: 10000)
+     -r A new connection for every handshake instead of one per session
+     -h This help message.
+*/
+
+
+#define LOAD_EVENTS 64
+#define LOAD_TIMEOUT_MS 10000   // longest wait for any answer before giving up
+#define LOAD_BUCKETS 40         // latency buckets of [2^k, 2^(k+1)) microseconds
+#define LOAD_BAR 50             // width of the longest histogram bar
+
+
+/*
+    One client connection and the handshake in flight on it.
+*/
+typedef struct
+{
+    int fd;
+    char request[DHNET_LINE];
+    char in[DHNET_LINE];
+    size_t inlen;
+    double start;
+} session;
+
+
+void HELP();
+
+
+static double now_ms()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+static int cmp_double(const void *x, const void *y)
+{
+    double a = *(const double*)x;
+    double b = *(const double*)y;
+
+    return (a > b) - (a < b);
+}
+
+/*
+    Sample at rank ceil(@arg q * count) of sorted samples, as the bench computes p99.
+*/
+static double percentile(double *sorted, size_t count, double q)
+{
+    size_t rank = (size_t)(q * count);
+
+    rank += rank < q * count;
+
+    return sorted[(rank > 0 ? rank : 1) - 1];
+}
+
+/*
+    Send the request of @arg s, connecting first if it has no connection.
+    @returns 0 on success, -1 if the server can not be reached.
+*/
+static int start_handshake(int ep, session *s, const char *address)
+{
+    size_t length = strlen(s->request);
+    size_t sent = 0;
+
+    s->start = now_ms();
+
+    if (s->fd < 0)
+    {
+        struct epoll_event ev;
+
+        if ((s->fd = dhnet_connect(address)) < 0)
+        {
+            return -1;
+        }
+
+        ev.events = EPOLLIN;
+        ev.data.ptr = s;
+        if (epoll_ctl(ep, EPOLL_CTL_ADD, s->fd, &ev) != 0)
+        {
+            close(s->fd);
+            s->fd = -1;
+
+            return -1;
+        }
+    }
+
+    // a blocking socket: a request of a few KB fits the socket buffer at once
+    while (sent < length)
+    {
+        ssize_t put = send(s->fd, s->request + sent, length - sent, MSG_NOSIGNAL);
+
+        if (put < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (put <= 0)
+        {
+            return -1;
+        }
+        sent += put;
+    }
+
+    s->inlen = 0;
+
+    return 0;
+}
+
+static void close_session(int ep, session *s)
+{
+    if (s->fd >= 0)
+    {
+        epoll_ctl(ep, EPOLL_CTL_DEL, s->fd, NULL);
+        close(s->fd);
+        s->fd = -1;
+    }
+}
+
+static void print_histogram(double *sorted, size_t count)
+{
+    size_t buckets[LOAD_BUCKETS] = {0};
+    size_t most = 0;
+    size_t i;
+    int first = LOAD_BUCKETS, last = 0, k;
+
+    for (i = 0; i < count; i++)
+    {
+        double us = sorted[i] * 1e3;
+
+        for (k = 0; k < LOAD_BUCKETS - 1 && us >= (double)(2ull << k); k++)
+        {
+        }
+        buckets[k]++;
+    }
+
+    for (k = 0; k < LOAD_BUCKETS; k++)
+    {
+        if (buckets[k] > 0)
+        {
+            first = k < first ? k : first;
+            last = k;
+            most = buckets[k] > most ? buckets[k] : most;
+        }
+    }
+
+    printf("histogram (ms):\n");
+    for (k = first; k <= last; k++)
+    {
+        int bar = (int)((buckets[k] * LOAD_BAR + most - 1) / most);
+
+        printf("  [%9.3f, %9.3f) %9zu ", (k == 0 ? 0 : (double)(1ull << k)) / 1e3,
+               (double)(2ull << k) / 1e3, buckets[k]);
+        while (bar-- > 0)
+        {
+            putchar('#');
+        }
+        putchar('\n');
+    }
+}
+
+
+int main(int argc, char *argv[])
+{
+    // before the first GMP allocation
+    arena_install();
+
+    char *address = NULL;
+    char *group = "modp2048";
+    long sessions = 16;
+    long total = 10000;
+    int reconnect = 0;
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (argv[i][0] == '-' && argv[i][1] == 'h')
+        {
+            HELP();
+
+            exit(0);
+        }
+        if (argv[i][0] == '-' && argv[i][1] == 'r')
+        {
+            reconnect = 1;
+        }
+    }
+
+    for (i = 1; i < argc - 1; i++)
+    {
+        if (argv[i][0] == '-')
+        {
+            if (argv[i][1] == 'a')
+            {
+                address = argv[i + 1];
+            }
+
+            if (argv[i][1] == 'G')
+            {
+                group = argv[i + 1];
+            }
+
+            if (argv[i][1] == 'c')
+            {
+                sessions = strtol(argv[i + 1], NULL, 10);
+            }
+
+            if (argv[i][1] == 'n')
+            {
+                total = strtol(argv[i + 1], NULL, 10);
+            }
+        }
+    }
+
+    if (address == NULL)
+    {
+        HELP();
+
+        exit(0);
+    }
+    if (sessions < 1 || total < 1)
+    {
+        printf("Invalid number of sessions or handshakes.\nProgram will exit...\n");
+
+        exit(1);
+    }
+    sessions = sessions < total ? sessions : total;
+
+    session *list = (session*)malloc(sizeof(session) * sessions);
+    double *latency = (double*)malloc(sizeof(double) * total);
+    if (list == NULL || latency == NULL)
+    {
+        printf("Out of memory.\nProgram will exit...\n");
+
+        exit(1);
+    }
+
+    mpz_t a, A;
+    mpz_inits(a, A, NULL);
+
+    for (i = 0; i < sessions; i++)
+    {
+        int result = dh_initiate(a, A, group, -1);
+
+        if (result != 0)
+        {
+            printf("%s.\nProgram will exit...\n", dh_error_string(result));
+
+            exit(1);
+        }
+
+        gmp_snprintf(list[i].request, DHNET_LINE, "%s,%Zx\n", group, A);
+        list[i].fd = -1;
+    }
+    mpz_clears(a, A, NULL);
+
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    if (ep < 0)
+    {
+        printf("Could not create the epoll instance.\nProgram will exit...\n");
+
+        exit(1);
+    }
+
+    struct epoll_event events[LOAD_EVENTS];
+    long issued = 0, done = 0, errors = 0;
+    double t0 = now_ms();
+
+    for (i = 0; i < sessions; i++, issued++)
+    {
+        if (start_handshake(ep, &list[i], address) != 0)
+        {
+            printf("Could not connect to %s.\nProgram will exit...\n", address);
+
+            exit(1);
+        }
+    }
+
+    while (done < total)
+    {
+        int count = epoll_wait(ep, events, LOAD_EVENTS, LOAD_TIMEOUT_MS);
+
+        if (count == 0)
+        {
+            printf("No answer for %d s.\nProgram will exit...\n", LOAD_TIMEOUT_MS / 1000);
+
+            exit(1);
+        }
+
+        for (i = 0; i < count; i++)
+        {
+            session *s = (session*)events[i].data.ptr;
+            ssize_t got = recv(s->fd, s->in + s->inlen, DHNET_LINE - s->inlen, 0);
+
+            if (got <= 0)
+            {
+                printf("The server closed a connection.\nProgram will exit...\n");
+
+                exit(1);
+            }
+            s->inlen += got;
+
+            char *newline = (char*)memchr(s->in, '\n', s->inlen);
+            if (newline == NULL && s->inlen == DHNET_LINE)
+            {
+                // the next recv() would ask for 0 bytes and look like a closed connection
+                printf("The server sent an answer line over %d bytes.\nProgram will exit...\n", DHNET_LINE);
+
+                exit(1);
+            }
+            if (newline == NULL)
+            {
+                continue;
+            }
+
+            latency[done++] = now_ms() - s->start;
+            errors += strncmp(s->in, "error", 5) == 0;
+
+            if (reconnect)
+            {
+                close_session(ep, s);
+            }
+            if (issued < total)
+            {
+                if (start_handshake(ep, s, address) != 0)
+                {
+                    printf("Could not connect to %s.\nProgram will exit...\n", address);
+
+                    exit(1);
+                }
+                issued++;
+            }
+        }
+    }
+
+    double seconds = (now_ms() - t0) / 1e3;
+
+    for (i = 0; i < sessions; i++)
+    {
+        close_session(ep, &list[i]);
+    }
+    close(ep);
+
+    qsort(latency, total, sizeof(double), cmp_double);
+
+    printf("%ld handshakes of %s on %ld sessions in %.3f s: %.1f handshakes/s, %ld errors\n",
+           total, group, sessions, seconds, total / seconds, errors);
+    printf("latency (ms): p50 %.3f  p90 %.3f  p99 %.3f  p999 %.3f  max %.3f\n",
+           percentile(latency, total, 0.5), percentile(latency, total, 0.9),
+           percentile(latency, total, 0.99), percentile(latency, total, 0.999), latency[total - 1]);
+    print_histogram(latency, total);
+
+    free(list);
+    free(latency);
+
+    return errors > 0;
+}
+
+
+/*
+    Helper function for -h argument.
+*/
+void HELP()
+{
+    fprintf(stdout, "Options:\n\
+     \t-a address Server address: a Unix socket path (with a '/'), or [host:]port on TCP\n\
+     \t-G name Group of the handshakes: modp1536 ... modp8192 or x25519 (default: modp2048)\n\
+     \t-c number Parallel sessions (default: 16)\n\
+     \t-n number Handshakes in total (default: 10000)\n\
+     \t-r A new connection for every handshake instead of one per session\n\
+     \t-h This help message.\n");
+}
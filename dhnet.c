@@ -0,0 +1,543 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <gmp.h>
+#include "dh.h"
+#include "dhnet.h"
+
+
+#define DHNET_EVENTS 64         // events taken per epoll_wait()
+#define DHNET_TICK_MS 100       // how often a server thread looks at the stop flag
+
+/*
+    Connection of a server thread. Connections of a thread are in a list, to close
+    them when the server stops.
+*/
+typedef struct dhnet_conn
+{
+    int fd;
+    uint32_t events;            // epoll interest: EPOLLIN, or EPOLLOUT while an answer is pending
+    char in[DHNET_LINE];
+    size_t inlen;
+    char out[DHNET_LINE];
+    size_t outlen;
+    size_t outsent;
+    struct dhnet_conn *prev;
+    struct dhnet_conn *next;
+} dhnet_conn;
+
+typedef struct
+{
+    pthread_t thread;
+    int listen;
+    int bits;
+    atomic_int *stop;
+    int failed;                 // the epoll loop could not be set up
+    dhnet_stats stats;
+} dhnet_worker;
+
+
+/*
+    Socket address of @arg address.
+    @returns the length of the address, 0 if it is not valid.
+*/
+static socklen_t dhnet_address(const char *address, struct sockaddr_storage *sa)
+{
+    memset(sa, 0, sizeof(*sa));
+
+    if (strchr(address, '/') != NULL)
+    {
+        struct sockaddr_un *un = (struct sockaddr_un*)sa;
+
+        if (strlen(address) >= sizeof(un->sun_path))
+        {
+            return 0;
+        }
+        un->sun_family = AF_UNIX;
+        strcpy(un->sun_path, address);
+
+        return sizeof(*un);
+    }
+
+    struct sockaddr_in *in = (struct sockaddr_in*)sa;
+    char host[64] = "127.0.0.1";
+    const char *port = address;
+    const char *colon = strrchr(address, ':');
+    char *end;
+
+    if (colon != NULL)
+    {
+        size_t length = colon - address;
+
+        if (length >= sizeof(host))
+        {
+            return 0;
+        }
+        memcpy(host, address, length);
+        host[length] = '\0';
+        port = colon + 1;
+    }
+
+    long value = strtol(port, &end, 10);
+    if (*port == '\0' || *end != '\0' || value < 1 || value > 65535)
+    {
+        return 0;
+    }
+
+    in->sin_family = AF_INET;
+    in->sin_port = htons((uint16_t)value);
+    if (inet_pton(AF_INET, host, &in->sin_addr) != 1)
+    {
+        return 0;
+    }
+
+    return sizeof(*in);
+}
+
+static void dhnet_nodelay(int fd)
+{
+    int one = 1;
+
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+int dhnet_listen(const char *address)
+{
+    struct sockaddr_storage sa;
+    socklen_t length = dhnet_address(address, &sa);
+    struct stat st;
+    int one = 1;
+
+    if (length == 0)
+    {
+        return -1;
+    }
+
+    int fd = socket(sa.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    if (sa.ss_family == AF_UNIX)
+    {
+        // only ever remove a socket, never a file that happens to have the name
+        if (stat(address, &st) == 0 && S_ISSOCK(st.st_mode))
+        {
+            unlink(address);
+        }
+    }
+    else
+    {
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    }
+
+    if (bind(fd, (struct sockaddr*)&sa, length) != 0 || listen(fd, SOMAXCONN) != 0)
+    {
+        close(fd);
+
+        return -1;
+    }
+
+    return fd;
+}
+
+int dhnet_connect(const char *address)
+{
+    struct sockaddr_storage sa;
+    socklen_t length = dhnet_address(address, &sa);
+
+    if (length == 0)
+    {
+        return -1;
+    }
+
+    int fd = socket(sa.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    if (connect(fd, (struct sockaddr*)&sa, length) != 0)
+    {
+        close(fd);
+
+        return -1;
+    }
+
+    if (sa.ss_family == AF_INET)
+    {
+        dhnet_nodelay(fd);
+    }
+
+    return fd;
+}
+
+/*
+    Answer of the request @arg line into the output buffer of @arg c.
+    @returns 0, or the DH_ERR_* code the request was answered with.
+*/
+static int dhnet_answer(dhnet_conn *c, char *line, int bits, mpz_t A, mpz_t B, mpz_t s)
+{
+    char *comma = strchr(line, ',');
+    size_t length = strlen(line);
+    int result;
+
+    if (length > 0 && line[length - 1] == '\r')
+    {
+        line[length - 1] = '\0';
+    }
+
+    if (comma == NULL)
+    {
+        c->outlen = snprintf(c->out, DHNET_LINE, "error: not a request of group,A\n");
+
+        return DH_ERR_ROW;
+    }
+
+    *comma = '\0';
+    if (mpz_set_str(A, comma + 1, 16) != 0 || mpz_sgn(A) < 0)
+    {
+        result = DH_ERR_PUBLIC;
+    }
+    else
+    {
+        result = dh_respond(B, s, A, line, bits);
+    }
+
+    if (result == 0)
+    {
+        c->outlen = gmp_snprintf(c->out, DHNET_LINE, "%Zx\n", B);
+    }
+    else
+    {
+        c->outlen = snprintf(c->out, DHNET_LINE, "error: %s\n", dh_error_string(result));
+    }
+
+    return result;
+}
+
+/*
+    Read what arrived on @arg c, answer every complete line and write what the socket takes.
+    Answers go out in order: no request is taken while an answer is pending, and epoll
+    then waits for the socket to be writable instead of readable.
+
+    @returns 0, or -1 when the connection is to be closed.
+*/
+static int dhnet_event(int ep, dhnet_conn *c, uint32_t events, dhnet_worker *w, mpz_t A, mpz_t B, mpz_t s)
+{
+    if ((events & (EPOLLERR | EPOLLHUP)) && !(events & EPOLLIN))
+    {
+        return -1;
+    }
+
+    if (c->outlen == 0 && (events & EPOLLIN))
+    {
+        ssize_t got = recv(c->fd, c->in + c->inlen, DHNET_LINE - c->inlen, 0);
+
+        if (got == 0 || (got < 0 && errno != EAGAIN && errno != EINTR))
+        {
+            return -1;
+        }
+        c->inlen += got > 0 ? got : 0;
+    }
+
+    while (1)
+    {
+        if (c->outlen > 0)
+        {
+            ssize_t put = send(c->fd, c->out + c->outsent, c->outlen - c->outsent, MSG_NOSIGNAL);
+
+            if (put < 0 && errno != EAGAIN && errno != EINTR)
+            {
+                return -1;
+            }
+            c->outsent += put > 0 ? put : 0;
+            if (c->outsent < c->outlen)
+            {
+                break;
+            }
+            c->outlen = 0;
+            c->outsent = 0;
+        }
+
+        char *newline = (char*)memchr(c->in, '\n', c->inlen);
+        if (newline == NULL)
+        {
+            // a request longer than any group needs
+            if (c->inlen == DHNET_LINE)
+            {
+                return -1;
+            }
+
+            break;
+        }
+
+        *newline = '\0';
+        if (dhnet_answer(c, c->in, w->bits, A, B, s) == 0)
+        {
+            w->stats.handshakes++;
+        }
+        else
+        {
+            w->stats.errors++;
+        }
+
+        size_t used = newline + 1 - c->in;
+        memmove(c->in, newline + 1, c->inlen - used);
+        c->inlen -= used;
+    }
+
+    uint32_t want = c->outlen > 0 ? EPOLLOUT : EPOLLIN;
+    if (want != c->events)
+    {
+        struct epoll_event ev;
+
+        ev.events = want;
+        ev.data.ptr = c;
+        if (epoll_ctl(ep, EPOLL_CTL_MOD, c->fd, &ev) != 0)
+        {
+            return -1;
+        }
+        c->events = want;
+    }
+
+    return 0;
+}
+
+static void dhnet_close(int ep, dhnet_conn **list, dhnet_conn *c)
+{
+    epoll_ctl(ep, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+
+    if (c->prev != NULL)
+    {
+        c->prev->next = c->next;
+    }
+    else
+    {
+        *list = c->next;
+    }
+    if (c->next != NULL)
+    {
+        c->next->prev = c->prev;
+    }
+
+    free(c);
+}
+
+/*
+    Take every pending connection of the listening socket. A connection there is no
+    memory or epoll slot for is closed right away.
+*/
+static void dhnet_accept(int ep, dhnet_conn **list, dhnet_worker *w, int tcp)
+{
+    int fd;
+
+    while ((fd = accept4(w->listen, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+        dhnet_conn *c = (dhnet_conn*)malloc(sizeof(dhnet_conn));
+        struct epoll_event ev;
+
+        if (c == NULL)
+        {
+            close(fd);
+            w->stats.errors++;
+
+            continue;
+        }
+
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        if (epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) != 0)
+        {
+            close(fd);
+            free(c);
+            w->stats.errors++;
+
+            continue;
+        }
+
+        c->fd = fd;
+        c->events = EPOLLIN;
+        c->inlen = 0;
+        c->outlen = 0;
+        c->outsent = 0;
+        c->prev = NULL;
+        c->next = *list;
+        if (*list != NULL)
+        {
+            (*list)->prev = c;
+        }
+        *list = c;
+
+        if (tcp)
+        {
+            dhnet_nodelay(fd);
+        }
+
+        w->stats.connections++;
+    }
+}
+
+static void* dhnet_worker_run(void *arg)
+{
+    dhnet_worker *w = (dhnet_worker*)arg;
+    struct epoll_event ev, events[DHNET_EVENTS];
+    struct sockaddr_storage sa;
+    socklen_t length = sizeof(sa);
+    dhnet_conn *list = NULL;
+    mpz_t A, B, s;
+    int i;
+
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    int tcp = getsockname(w->listen, (struct sockaddr*)&sa, &length) == 0 && sa.ss_family == AF_INET;
+
+    // the listening socket is the event without a connection
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.ptr = NULL;
+    if (ep < 0 || epoll_ctl(ep, EPOLL_CTL_ADD, w->listen, &ev) != 0)
+    {
+        if (ep >= 0)
+        {
+            close(ep);
+        }
+        w->failed = 1;
+        atomic_store(w->stop, 1);
+
+        return NULL;
+    }
+
+    mpz_inits(A, B, s, NULL);
+
+    while (!atomic_load(w->stop))
+    {
+        int count = epoll_wait(ep, events, DHNET_EVENTS, DHNET_TICK_MS);
+
+        for (i = 0; i < count; i++)
+        {
+            dhnet_conn *c = (dhnet_conn*)events[i].data.ptr;
+
+            if (c == NULL)
+            {
+                dhnet_accept(ep, &list, w, tcp);
+            }
+            else if (dhnet_event(ep, c, events[i].events, w, A, B, s) != 0)
+            {
+                dhnet_close(ep, &list, c);
+            }
+        }
+    }
+
+    while (list != NULL)
+    {
+        dhnet_close(ep, &list, list);
+    }
+
+    close(ep);
+    mpz_clears(A, B, s, NULL);
+
+    return NULL;
+}
+
+int dhnet_serve(int fd, int jobs, int bits, atomic_int *stop, dhnet_stats *stats)
+{
+    dhnet_worker *workers = (dhnet_worker*)calloc(jobs, sizeof(dhnet_worker));
+    int started = 0;
+    int failed = 0;
+    int i;
+
+    memset(stats, 0, sizeof(*stats));
+    if (workers == NULL)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < jobs; i++)
+    {
+        workers[i].listen = fd;
+        workers[i].bits = bits;
+        workers[i].stop = stop;
+
+        if (pthread_create(&workers[i].thread, NULL, dhnet_worker_run, &workers[i]) != 0)
+        {
+            atomic_store(stop, 1);
+
+            break;
+        }
+        started++;
+    }
+
+    for (i = 0; i < started; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        failed |= workers[i].failed;
+        stats->connections += workers[i].stats.connections;
+        stats->handshakes += workers[i].stats.handshakes;
+        stats->errors += workers[i].stats.errors;
+    }
+
+    free(workers);
+
+    return started == jobs && !failed ? 0 : -1;
+}
+
+int dhnet_request(int fd, const char *request, char *answer, size_t size)
+{
+    size_t length = strlen(request);
+    size_t sent = 0;
+    size_t got = 0;
+
+    while (sent < length)
+    {
+        ssize_t put = send(fd, request + sent, length - sent, MSG_NOSIGNAL);
+
+        if (put < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (put <= 0)
+        {
+            return -1;
+        }
+        sent += put;
+    }
+
+    // the server answers one line per request, so nothing past the newline is lost
+    while (got < size)
+    {
+        ssize_t n = recv(fd, answer + got, size - got, 0);
+
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return -1;
+        }
+
+        char *newline = (char*)memchr(answer + got, '\n', n);
+        got += n;
+
+        if (newline != NULL)
+        {
+            *newline = '\0';
+
+            return 0;
+        }
+    }
+
+    return -1;
+}
@@ -0,0 +1,71 @@
+#ifndef DHNET_H
+#define DHNET_H
+
+#include <stdatomic.h>
+
+/*
+    DH handshakes over loopback sockets, for the server mode of dh_assign_1 and the
+    dhload load generator.
+
+    Protocol: lines of text. The client sends "group,A" with group a name of
+    dh_group_find() or x25519 and A its public key in hexadecimal. The server answers
+    "B" in hexadecimal, or "error: reason". A connection carries any number of
+    handshakes, one after the other.
+
+    Addresses are a path for a Unix socket (anything with a '/'), else [host:]port on
+    TCP with the host 127.0.0.1 by default.
+*/
+
+#define DHNET_LINE 4096         // longest request or answer, newline included
+
+
+/*
+    Counts of a server run.
+*/
+typedef struct
+{
+    unsigned long long connections;
+    unsigned long long handshakes;
+    unsigned long long errors;      // requests answered with an error
+} dhnet_stats;
+
+
+/*
+    Listening socket on @arg address. A Unix socket path left by an old server is
+    replaced.
+    @returns the socket, -1 on failure.
+*/
+int dhnet_listen(const char *address);
+
+/*
+    Blocking connection to @arg address.
+    @returns the socket, -1 on failure.
+*/
+int dhnet_connect(const char *address);
+
+/*
+    Serve handshakes on the listening socket @arg fd until @arg stop turns non zero.
+
+    Every one of @arg jobs threads runs its own epoll loop over the connections it
+    accepted; the listening socket is shared with EPOLLEXCLUSIVE, so a new connection
+    wakes one thread. Private keys are drawn per handshake, @arg bits as for dh_respond().
+
+    The handshake runs inline on the epoll thread that read its line. While it computes,
+    every other connection of that thread waits, so a handshake of a large group such as
+    modp8192 delays the answers of the cheap ones behind it. Run at least as many jobs as
+    cores, and keep groups of very different sizes on separate servers when the latency
+    of the small ones matters.
+
+    @returns 0, or -1 if the threads or their epoll loops could not start. Every thread
+    then stops.
+*/
+int dhnet_serve(int fd, int jobs, int bits, atomic_int *stop, dhnet_stats *stats);
+
+/*
+    One handshake on a blocking connection: send @arg request (a full line), read the
+    answer line into @arg answer of @arg size bytes, without the newline.
+    @returns 0 on success, -1 if the connection failed or the line is too long.
+*/
+int dhnet_request(int fd, const char *request, char *answer, size_t size);
+
+#endif
@@ -0,0 +1,601 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <gmp.h>
+#include "util.h"
+#include "sieve.h"
+#include "arena.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+    Microbenchmark of the util.c primitives over input size sweeps.
+
+    Every (function, size) point is timed by batches of calls. A batch is sized so
+    it runs for about a millisecond. Per call it reports:
+        ns          wall clock time
+        tsc         time stamp counter ticks (rdtsc)
+        cycles, instructions, cache_misses, branch_misses
+                    hardware counters from perf_event_open, user space only.
+                    null when the kernel does not grant them (perf_event_paranoid, VMs).
+    Every number is the median of the batches. Written as JSON.
+
+
+    Options:
+     -o path Path to the JSON output file (default: stdout)
+     -r number Batches per point (default: 15)
+     --quick Smaller sweeps, for a smoke run
+     -h This help message.
+*/
+
+
+#define BATCH_NS 1e6        // target length of one batch
+#define MAX_BATCH 1000000   // calls per batch at most
+#define PRIMES 64           // candidates per checkIfPrimeBatch() call
+
+enum counter
+{
+    CNT_CYCLES, CNT_INSTRUCTIONS, CNT_CACHE_MISSES, CNT_BRANCH_MISSES, COUNTERS
+};
+
+static const char *counter_names[COUNTERS] = {"cycles", "instructions", "cache_misses", "branch_misses"};
+static const uint64_t counter_configs[COUNTERS] =
+{
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+};
+
+int counter_fd[COUNTERS];
+int reps = 15;
+int quick = 0;
+
+/*
+    One point of a sweep: the call under test and its input.
+*/
+typedef struct
+{
+    unsigned long long x;   // machine word input
+    unsigned long long y;
+    mpz_t p;                // multiple precision inputs
+    mpz_t q;
+    mpz_t r;                // output
+    size_t n[PRIMES];       // candidates of checkIfPrimeBatch()
+    int result[PRIMES];
+} micro_input;
+
+typedef void (*micro_fn)(micro_input *in);
+
+/*
+    Per call measurement of one batch.
+*/
+typedef struct
+{
+    double ns;
+    double tsc;
+    double counters[COUNTERS];
+} micro_sample;
+
+
+volatile unsigned long long sink;
+
+
+void HELP();
+
+
+static inline uint64_t read_tsc()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return (uint64_t)t.tv_sec * 1000000000ull + t.tv_nsec;
+#endif
+}
+
+static double now_ns()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+/*
+    Open one counter per hardware event for this thread, user space only.
+    Events the kernel refuses keep fd -1 and are reported as null.
+*/
+static void counters_open()
+{
+    int i;
+
+    for (i = 0; i < COUNTERS; i++)
+    {
+        struct perf_event_attr attr;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = counter_configs[i];
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        counter_fd[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+}
+
+static void counters_close()
+{
+    int i;
+
+    for (i = 0; i < COUNTERS; i++)
+    {
+        if (counter_fd[i] >= 0)
+        {
+            close(counter_fd[i]);
+        }
+    }
+}
+
+static void counters_start()
+{
+    int i;
+
+    for (i = 0; i < COUNTERS; i++)
+    {
+        if (counter_fd[i] >= 0)
+        {
+            ioctl(counter_fd[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(counter_fd[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+static void counters_stop(double values[COUNTERS])
+{
+    int i;
+
+    for (i = 0; i < COUNTERS; i++)
+    {
+        uint64_t value;
+
+        values[i] = -1;
+        if (counter_fd[i] >= 0)
+        {
+            ioctl(counter_fd[i], PERF_EVENT_IOC_DISABLE, 0);
+            if (read(counter_fd[i], &value, sizeof(value)) == sizeof(value))
+            {
+                values[i] = (double)value;
+            }
+        }
+    }
+}
+
+
+static void run_prime(micro_input *in)
+{
+    sink += checkIfPrime(in->x);
+}
+
+static void run_prime_map(micro_input *in)
+{
+    sink += prime_map_test(in->x);
+}
+
+/*
+    PRIMES calls of checkIfPrime(), to compare with one checkIfPrimeBatch().
+*/
+static void run_primes(micro_input *in)
+{
+    int i;
+
+    for (i = 0; i < PRIMES; i++)
+    {
+        sink += checkIfPrime(in->n[i]);
+    }
+}
+
+static void run_prime_batch(micro_input *in)
+{
+    checkIfPrimeBatch(in->n, in->result, PRIMES);
+    sink += in->result[0];
+}
+
+static void run_primitive_root(micro_input *in)
+{
+    sink += checkIfPrimitiveRoot(in->x, in->y);
+}
+
+static void run_prev_prime(micro_input *in)
+{
+    sink += getPrevPrime(in->x);
+}
+
+/*
+    Primes in [x, x + y), from the segmented sieve and from checkIfPrime() on every
+    odd number. The bounds are compared as offsets from x, so x + y may wrap past 2^64.
+*/
+static void run_scan_sieve(micro_input *in)
+{
+    prime_iter it;
+    uint64_t p;
+
+    prime_iter_init(&it, in->x, 1);
+    while ((p = prime_iter_next(&it)) != 0 && p - in->x < in->y)
+    {
+        sink++;
+    }
+    prime_iter_clear(&it);
+}
+
+static void run_scan_check(micro_input *in)
+{
+    unsigned long long n;
+
+    for (n = in->x | 1; n - in->x < in->y; n += 2)
+    {
+        sink += checkIfPrime(n);
+    }
+}
+
+static void run_gcd(micro_input *in)
+{
+    sink += gcd(in->x, in->y);
+}
+
+static void run_lambda(micro_input *in)
+{
+    lambda_euler_function(in->r, in->p, in->q);
+}
+
+static void run_forge(micro_input *in)
+{
+    mpz_t lambda;
+    mpz_init(lambda);
+    lambda_euler_function(lambda, in->p, in->q);
+    forge_d_key(in->r, lambda);
+    mpz_clear(lambda);
+}
+
+
+static int cmp_double(const void *x, const void *y)
+{
+    double a = *(const double*)x;
+    double b = *(const double*)y;
+
+    return (a > b) - (a < b);
+}
+
+static double median(double *values, int count)
+{
+    qsort(values, count, sizeof(double), cmp_double);
+
+    return count % 2 ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2;
+}
+
+/*
+    Time one batch of @arg calls calls. Counters and the tsc bracket the batch only.
+*/
+static void run_batch(micro_fn fn, micro_input *in, long calls, micro_sample *sample)
+{
+    long i;
+    int c;
+
+    double t0 = now_ns();
+    counters_start();
+    uint64_t tsc0 = read_tsc();
+
+    for (i = 0; i < calls; i++)
+    {
+        fn(in);
+    }
+
+    uint64_t tsc1 = read_tsc();
+    counters_stop(sample->counters);
+    double t1 = now_ns();
+
+    sample->ns = (t1 - t0) / calls;
+    sample->tsc = (double)(tsc1 - tsc0) / calls;
+    for (c = 0; c < COUNTERS; c++)
+    {
+        if (sample->counters[c] >= 0)
+        {
+            sample->counters[c] /= calls;
+        }
+    }
+}
+
+/*
+    Measure one point of a sweep and print it as a JSON object.
+    Untimed batches of doubling size warm the caches and size the batch.
+*/
+static void measure(FILE *fp, int *first, const char *name, int bits, micro_fn fn, micro_input *in)
+{
+    micro_sample *samples = (micro_sample*)malloc(sizeof(micro_sample) * reps);
+    double *column = (double*)malloc(sizeof(double) * reps);
+    int i, c;
+
+    long calls = 1;
+    for (;;)
+    {
+        double t0 = now_ns();
+        for (i = 0; i < calls; i++)
+        {
+            fn(in);
+        }
+        if (now_ns() - t0 >= BATCH_NS || calls >= MAX_BATCH)
+        {
+            break;
+        }
+        calls *= 2;
+    }
+
+    for (i = 0; i < reps; i++)
+    {
+        run_batch(fn, in, calls, &samples[i]);
+    }
+
+    fprintf(fp, "%s\n    {\"function\": \"%s\", \"bits\": %d, \"calls\": %ld", *first ? "" : ",", name, bits, calls);
+
+    for (i = 0; i < reps; i++)
+    {
+        column[i] = samples[i].ns;
+    }
+    fprintf(fp, ", \"ns\": %.2f", median(column, reps));
+
+    for (i = 0; i < reps; i++)
+    {
+        column[i] = samples[i].tsc;
+    }
+    fprintf(fp, ", \"tsc\": %.1f", median(column, reps));
+
+    for (c = 0; c < COUNTERS; c++)
+    {
+        if (counter_fd[c] < 0)
+        {
+            fprintf(fp, ", \"%s\": null", counter_names[c]);
+
+            continue;
+        }
+        for (i = 0; i < reps; i++)
+        {
+            column[i] = samples[i].counters[c];
+        }
+        fprintf(fp, ", \"%s\": %.2f", counter_names[c], median(column, reps));
+    }
+    fprintf(fp, "}");
+    fflush(fp);
+
+    *first = 0;
+    free(samples);
+    free(column);
+}
+
+
+/*
+    Largest prime below 2^bits.
+*/
+static unsigned long long prime_below(int bits)
+{
+    mpz_t x;
+    mpz_init(x);
+    mpz_set_ui(x, 1);
+    mpz_mul_2exp(x, x, bits);
+
+    do
+    {
+        mpz_sub_ui(x, x, 1);
+    } while (!mpz_probab_prime_p(x, 25));
+
+    unsigned long long p = mpz_getlimbn(x, 0);
+    mpz_clear(x);
+
+    return p;
+}
+
+/*
+    Least primitive root of the prime @arg p, so every factor of p - 1 gets tested.
+*/
+static unsigned long long least_root(unsigned long long p)
+{
+    unsigned long long g = 1;
+
+    while (!checkIfPrimitiveRoot(p, ++g))
+    {
+    }
+
+    return g;
+}
+
+
+int main(int argc, char *argv[])
+{
+    // before the first GMP allocation
+    arena_install();
+
+    char *output = NULL;
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--quick") == 0)
+        {
+            quick = 1;
+        }
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+        {
+            output = argv[++i];
+        }
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+        {
+            reps = atoi(argv[++i]);
+        }
+        else
+        {
+            HELP();
+
+            exit(0);
+        }
+    }
+
+    if (quick && reps == 15)
+    {
+        reps = 5;
+    }
+    if (reps < 1)
+    {
+        printf("Invalid repetitions.\n");
+
+        exit(1);
+    }
+
+    FILE *fp = stdout;
+    if (output != NULL && (fp = fopen(output, "w")) == NULL)
+    {
+        printf("Error opening file.\n");
+
+        exit(1);
+    }
+
+    counters_open();
+
+    micro_input in;
+    mpz_inits(in.p, in.q, in.r, NULL);
+    int first = 1;
+    int bits;
+
+    fprintf(fp, "{\n  \"bench\": \"util\",\n  \"timestamp\": %lld,\n  \"reps\": %d,\n  \"points\": [",
+            (long long)time(NULL), reps);
+
+    // checkIfPrime on the worst case input: a prime, so every Miller-Rabin round runs.
+    for (bits = 8; bits <= 64; bits += quick ? 28 : 8)
+    {
+        in.x = prime_below(bits);
+        fprintf(stderr, "checkIfPrime %d bits...\n", bits);
+        measure(fp, &first, "checkIfPrime", bits, run_prime, &in);
+    }
+
+    // One bit of the prime map, when a map is found (see primemap). checkIfPrime above
+    // takes the same path for the sizes the map covers.
+    for (bits = 8; bits <= 64 && prime_below(bits) < prime_map_limit(); bits += 8)
+    {
+        in.x = prime_below(bits);
+        fprintf(stderr, "prime_map_test %d bits...\n", bits);
+        measure(fp, &first, "prime_map_test", bits, run_prime_map, &in);
+    }
+
+    // PRIMES primes one by one, then as one batch.
+    for (bits = 16; bits <= 64; bits += quick ? 48 : 16)
+    {
+        mpz_t x;
+        mpz_init_set_ui(x, 1);
+        mpz_mul_2exp(x, x, bits - 1);
+        for (i = 0; i < PRIMES; i++)
+        {
+            mpz_nextprime(x, x);
+            in.n[i] = mpz_getlimbn(x, 0);
+        }
+        mpz_clear(x);
+
+        fprintf(stderr, "checkIfPrime x%d %d bits...\n", PRIMES, bits);
+        measure(fp, &first, "checkIfPrime_x64", bits, run_primes, &in);
+        fprintf(stderr, "checkIfPrimeBatch x%d %d bits...\n", PRIMES, bits);
+        measure(fp, &first, "checkIfPrimeBatch_x64", bits, run_prime_batch, &in);
+    }
+
+    // checkIfPrimitiveRoot on a true root, so every prime factor of p - 1 gets tested.
+    for (bits = 8; bits <= 64; bits += quick ? 28 : 8)
+    {
+        in.x = prime_below(bits);
+        in.y = least_root(in.x);
+        fprintf(stderr, "checkIfPrimitiveRoot %d bits...\n", bits);
+        measure(fp, &first, "checkIfPrimitiveRoot", bits, run_primitive_root, &in);
+    }
+
+    for (bits = 8; bits <= 62; bits += quick ? 27 : 9)
+    {
+        in.x = 1ull << bits;
+        fprintf(stderr, "getPrevPrime %d bits...\n", bits);
+        measure(fp, &first, "getPrevPrime", bits, run_prev_prime, &in);
+    }
+
+    // Every prime of a window of 2^20 numbers.
+    for (bits = 24; bits <= 64; bits += quick ? 40 : 8)
+    {
+        in.x = bits < 64 ? 1ull << bits : 0 - (1ull << 20);
+        in.y = 1ull << 20;
+        fprintf(stderr, "prime scan %d bits...\n", bits);
+        measure(fp, &first, "prime_scan_sieve", bits, run_scan_sieve, &in);
+        measure(fp, &first, "prime_scan_checkIfPrime", bits, run_scan_check, &in);
+    }
+
+    // gcd on consecutive Fibonacci numbers, the longest Euclid chain of a size.
+    // fmod keeps it exact up to 2^53.
+    for (bits = 8; bits <= 52; bits += quick ? 22 : 4)
+    {
+        unsigned long long f0 = 1, f1 = 1;
+        while (f0 + f1 < (1ull << bits))
+        {
+            unsigned long long t = f0 + f1;
+            f0 = f1;
+            f1 = t;
+        }
+        in.x = f1;
+        in.y = f0;
+        fprintf(stderr, "gcd %d bits...\n", bits);
+        measure(fp, &first, "gcd", bits, run_gcd, &in);
+    }
+
+    // lambda_euler_function and forge_d_key on RSA primes of half the modulus size each.
+    for (bits = 256; bits <= (quick ? 1024 : 2048); bits *= 2)
+    {
+        if (large_prime_generator(in.p, bits / 2) != 0 || large_prime_generator(in.q, bits - bits / 2) != 0)
+        {
+            printf("No system randomness available.\nProgram will exit...\n");
+
+            exit(1);
+        }
+
+        fprintf(stderr, "lambda_euler_function %d bits...\n", bits);
+        measure(fp, &first, "lambda_euler_function", bits, run_lambda, &in);
+
+        fprintf(stderr, "forge_d_key %d bits...\n", bits);
+        measure(fp, &first, "forge_d_key", bits, run_forge, &in);
+    }
+
+    fprintf(fp, "\n  ]\n}\n");
+
+    mpz_clears(in.p, in.q, in.r, NULL);
+    counters_close();
+
+    if (fp != stdout)
+    {
+        fclose(fp);
+    }
+
+    return 0;
+}
+
+
+/*
+    Helper function for -h argument.
+*/
+void HELP()
+{
+    fprintf(stdout, "Options:\n\
+     \t-o path Path to the JSON output file (default: stdout)\n\
+     \t-r number Batches per point (default: 15)\n\
+     \t--quick Smaller sweeps, for a smoke run\n\
+     \t-h This help message.\n");
+}
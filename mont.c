@@ -0,0 +1,496 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <gmp.h>
+#include "mont.h"
+#include "util.h"
+
+
+#define COMB_TEETH 8            // 256 entries a table
+#define COMB_BLOCKS 4           // 256KB of tables for a 2048 bit modulus
+
+/*
+    Comb table file.
+
+    Header: "MCMB", then u32 version, limb bytes, limbs of m, teeth, blocks, span, checksum.
+    Then m, the base mod m and the tables, each as limbs of m. Everything is in host
+    byte order and limb size, so the tables are used in place. A file from another
+    machine fails the version or limb size check.
+
+    The checksum covers every limb after the header. A table entry that went bad on disk
+    would otherwise give wrong public keys and secrets with no error.
+*/
+#define COMB_MAGIC "MCMB"
+#define COMB_VERSION 2          // 1 had no checksum
+#define COMB_HEADER_SIZE 32
+
+
+/*
+    Montgomery reduction (REDC). r = t * R^-1 mod m, t < m * R of 2 * size limbs.
+    t is destroyed.
+
+    Every step clears the lowest limb of t by adding a multiple of m. The carry out
+    of that step belongs size limbs higher, so it is parked in the cleared limb and
+    all carries are added in one go at the end.
+*/
+static void mont_redc(mp_limb_t *r, mp_limb_t *t, const mont_ctx *ctx)
+{
+    mp_size_t n = ctx->size;
+    mp_size_t i;
+
+    for (i = 0; i < n; i++)
+    {
+        t[i] = mpn_addmul_1(t + i, ctx->mod, n, t[i] * ctx->ninv);
+    }
+
+    if (mpn_add_n(r, t + n, t, n) || mpn_cmp(r, ctx->mod, n) >= 0)
+    {
+        mpn_sub_n(r, r, ctx->mod, n);
+    }
+}
+
+/*
+    r = a * b * R^-1 mod m. r may alias a or b.
+*/
+static void mont_mul(mp_limb_t *r, const mp_limb_t *a, const mp_limb_t *b,
+                     const mont_ctx *ctx, mont_scratch *s)
+{
+    mpn_mul_n(s->t, a, b, ctx->size);
+    mont_redc(r, s->t, ctx);
+}
+
+/*
+    r = a * a * R^-1 mod m. r may alias a.
+*/
+static void mont_sqr(mp_limb_t *r, const mp_limb_t *a, const mont_ctx *ctx, mont_scratch *s)
+{
+    mpn_sqr(s->t, a, ctx->size);
+    mont_redc(r, s->t, ctx);
+}
+
+/*
+    Build a context for odd modulus @arg m.
+
+    R^2 mod m and -m^-1 come from montgomery_constants().
+    R^3 mod m is derived from R^2 with one Montgomery squaring. It brings a double size
+    base into Montgomery form with a reduction and a multiplication instead of a division.
+*/
+void mont_ctx_init(mont_ctx *ctx, mpz_t m)
+{
+    mont_scratch s;
+    mpz_t r2;
+
+    mpz_init_set(ctx->m, m);
+    ctx->size = mpz_size(m);
+    ctx->mod = mpz_limbs_read(ctx->m);
+
+    mpz_init(r2);
+    montgomery_constants(r2, &ctx->ninv, m);
+
+    ctx->rr = (mp_limb_t*)calloc(ctx->size, sizeof(mp_limb_t));
+    ctx->rrr = (mp_limb_t*)calloc(ctx->size, sizeof(mp_limb_t));
+    mpn_copyi(ctx->rr, mpz_limbs_read(r2), mpz_size(r2));
+    mpz_clear(r2);
+
+    mont_scratch_init(&s, ctx);
+    mont_sqr(ctx->rrr, ctx->rr, ctx, &s);
+    mont_scratch_clear(&s);
+}
+
+void mont_ctx_clear(mont_ctx *ctx)
+{
+    mpz_clear(ctx->m);
+    free(ctx->rr);
+    free(ctx->rrr);
+}
+
+void mont_scratch_init(mont_scratch *s, mont_ctx *ctx)
+{
+    mp_size_t n = ctx->size;
+
+    s->t = (mp_limb_t*)malloc(sizeof(mp_limb_t) * 2 * n);
+    s->acc = (mp_limb_t*)malloc(sizeof(mp_limb_t) * n);
+    s->q = (mp_limb_t*)malloc(sizeof(mp_limb_t) * (n + 1));
+}
+
+void mont_scratch_clear(mont_scratch *s)
+{
+    free(s->t);
+    free(s->acc);
+    free(s->q);
+}
+
+/*
+    Bring @arg base into Montgomery form in @arg x.
+
+    base < m:               x = base * R^2 * R^-1
+    base < m * R:           x = REDC(base) * R^3 * R^-1
+    else (up to 2 limbs):   reduce by division first.
+*/
+static void to_mont(mp_limb_t *x, mpz_t base, const mont_ctx *ctx, mont_scratch *s)
+{
+    mp_size_t n = ctx->size;
+    mp_size_t bn = mpz_size(base);
+    const mp_limb_t *bp = mpz_limbs_read(base);
+
+    if (bn <= n)
+    {
+        mpn_zero(x, n);
+        mpn_copyi(x, bp, bn);
+
+        if (mpn_cmp(x, ctx->mod, n) < 0)
+        {
+            mont_mul(x, x, ctx->rr, ctx, s);
+
+            return;
+        }
+    }
+
+    mpn_zero(s->t, 2 * n);
+    if (bn <= 2 * n)
+    {
+        mpn_copyi(s->t, bp, bn);
+
+        if (mpn_cmp(s->t + n, ctx->mod, n) < 0)
+        {
+            mont_redc(x, s->t, ctx);
+            mont_mul(x, x, ctx->rrr, ctx, s);
+
+            return;
+        }
+
+        mpn_tdiv_qr(s->q, x, 0, s->t, 2 * n, ctx->mod, n);
+    }
+    else
+    {
+        mpz_t reduced;
+        mpz_init(reduced);
+        mpz_mod(reduced, base, ctx->m);
+        mpn_zero(x, n);
+        mpn_copyi(x, mpz_limbs_read(reduced), mpz_size(reduced));
+        mpz_clear(reduced);
+    }
+
+    mont_mul(x, x, ctx->rr, ctx, s);
+}
+
+
+/*
+    Running checksum of the limbs of a table file, a limb at a time: FNV-1a with limbs
+    for bytes. Start at COMB_CHECKSUM_SEED and fold to 32 bits at the end.
+*/
+#define COMB_CHECKSUM_SEED 14695981039346656037ull
+
+static uint64_t comb_checksum(uint64_t h, const mp_limb_t *limbs, size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        h = (h ^ limbs[i]) * 1099511628211ull;
+    }
+
+    return h;
+}
+
+static uint32_t comb_checksum_fold(uint64_t h)
+{
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+/*
+    Teeth, blocks and span for exponents of @arg bits bits.
+*/
+static void comb_shape(mont_comb *comb, size_t bits)
+{
+    size_t rows = COMB_TEETH * COMB_BLOCKS;
+
+    comb->teeth = COMB_TEETH;
+    comb->blocks = COMB_BLOCKS;
+    comb->span = bits > 0 ? (bits + rows - 1) / rows : 1;
+}
+
+static void comb_modulus(mont_comb *comb, mpz_t base, mpz_t m)
+{
+    mont_ctx_init(&comb->ctx, m);
+
+    mpz_init(comb->base);
+    mpz_mod(comb->base, base, m);
+    comb->owned = NULL;
+    comb->map = NULL;
+}
+
+size_t mont_comb_bits(const mont_comb *comb)
+{
+    return (size_t)comb->teeth * comb->blocks * comb->span;
+}
+
+/*
+    Every entry of a table is the product of the powers of its set bits, so the powers
+    base^(2^(row * blocks * span + s * span)) come first, from a single chain of
+    squarings, and every other entry is one multiplication of two smaller ones.
+*/
+void mont_comb_init(mont_comb *comb, mpz_t base, mpz_t m, size_t bits)
+{
+    mont_scratch s;
+
+    comb_modulus(comb, base, m);
+    comb_shape(comb, bits);
+
+    mp_size_t n = comb->ctx.size;
+    size_t entries = (size_t)1 << comb->teeth;
+    size_t row = (size_t)comb->blocks * comb->span;
+    size_t total = mont_comb_bits(comb);
+    mp_limb_t *x = (mp_limb_t*)malloc(sizeof(mp_limb_t) * n);
+    size_t pos;
+    int b;
+
+    comb->owned = (mp_limb_t*)malloc(sizeof(mp_limb_t) * n * entries * comb->blocks);
+    comb->table = comb->owned;
+    mont_scratch_init(&s, &comb->ctx);
+
+    to_mont(x, comb->base, &comb->ctx, &s);
+    for (pos = 0; pos < total; pos++)
+    {
+        if (pos % comb->span == 0)
+        {
+            size_t block = pos % row / comb->span;
+            size_t tooth = pos / row;
+
+            mpn_copyi(comb->owned + (block * entries + ((size_t)1 << tooth)) * n, x, n);
+        }
+        mont_sqr(x, x, &comb->ctx, &s);
+    }
+
+    // entry 0 is 1 in Montgomery form, R mod m
+    mpz_t one;
+    mpz_init_set_ui(one, 1);
+    to_mont(x, one, &comb->ctx, &s);
+    mpz_clear(one);
+
+    for (b = 0; b < comb->blocks; b++)
+    {
+        mp_limb_t *table = comb->owned + b * entries * n;
+        size_t j;
+
+        mpn_copyi(table, x, n);
+        for (j = 3; j < entries; j++)
+        {
+            if (j & (j - 1))
+            {
+                mont_mul(table + j * n, table + (j & (j - 1)) * n, table + (j & -j) * n, &comb->ctx, &s);
+            }
+        }
+    }
+
+    mont_scratch_clear(&s);
+    free(x);
+}
+
+int mont_comb_load(mont_comb *comb, mpz_t base, mpz_t m, size_t bits, const char *path)
+{
+    struct stat st;
+    uint32_t header[COMB_HEADER_SIZE / 4];
+    mp_size_t n = mpz_size(m);
+    mpz_t reduced;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    if (fstat(fd, &st) != 0 || st.st_size < COMB_HEADER_SIZE)
+    {
+        close(fd);
+
+        return -1;
+    }
+
+    unsigned char *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    memcpy(header, map, COMB_HEADER_SIZE);
+    mpz_init(reduced);
+    mpz_mod(reduced, base, m);
+
+    const mp_limb_t *limbs = (const mp_limb_t*)(map + COMB_HEADER_SIZE);
+    size_t entries = header[4] < 16 ? (size_t)header[3] * ((size_t)1 << header[4]) * header[5] : 0;
+    int valid = memcmp(map, COMB_MAGIC, 4) == 0 && header[1] == COMB_VERSION
+                && header[2] == sizeof(mp_limb_t) && header[3] == (uint32_t)n && n > 0
+                && header[4] >= 1 && header[4] < 16 && header[5] >= 1 && header[6] >= 1
+                && (size_t)header[4] * header[5] * header[6] >= bits
+                && (size_t)st.st_size == COMB_HEADER_SIZE + sizeof(mp_limb_t) * (2 * n + entries)
+                && mpn_cmp(limbs, mpz_limbs_read(m), n) == 0
+                && comb_checksum_fold(comb_checksum(COMB_CHECKSUM_SEED, limbs, 2 * n + entries)) == header[7];
+
+    if (valid)
+    {
+        mp_limb_t *b = (mp_limb_t*)calloc(n, sizeof(mp_limb_t));
+
+        mpn_copyi(b, mpz_limbs_read(reduced), mpz_size(reduced));
+        valid = mpn_cmp(limbs + n, b, n) == 0;
+        free(b);
+    }
+    mpz_clear(reduced);
+
+    if (!valid)
+    {
+        munmap(map, st.st_size);
+
+        return -1;
+    }
+
+    comb_modulus(comb, base, m);
+    comb->teeth = header[4];
+    comb->blocks = header[5];
+    comb->span = header[6];
+    comb->table = limbs + 2 * n;
+    comb->map = map;
+    comb->map_size = st.st_size;
+
+    return 0;
+}
+
+int mont_comb_write(mont_comb *comb, const char *path)
+{
+    mp_size_t n = comb->ctx.size;
+    size_t entries = (size_t)comb->blocks << comb->teeth;
+    uint32_t header[COMB_HEADER_SIZE / 4] = {0, COMB_VERSION, sizeof(mp_limb_t), (uint32_t)n,
+                                             (uint32_t)comb->teeth, (uint32_t)comb->blocks,
+                                             (uint32_t)comb->span, 0};
+    mp_limb_t *b = (mp_limb_t*)calloc(n, sizeof(mp_limb_t));
+    int result = 0;
+
+    memcpy(header, COMB_MAGIC, 4);
+    mpn_copyi(b, mpz_limbs_read(comb->base), mpz_size(comb->base));
+
+    uint64_t h = comb_checksum(COMB_CHECKSUM_SEED, comb->ctx.mod, n);
+    h = comb_checksum(h, b, n);
+    header[7] = comb_checksum_fold(comb_checksum(h, comb->table, entries * n));
+
+    size_t length = strlen(path) + 16;
+    char *temp = (char*)malloc(length);
+    snprintf(temp, length, "%s.%d", path, (int)getpid());
+
+    FILE *fp = fopen(temp, "wb");
+    if (fp == NULL)
+    {
+        free(temp);
+        free(b);
+
+        return -1;
+    }
+
+    if (fwrite(header, COMB_HEADER_SIZE, 1, fp) != 1
+        || fwrite(comb->ctx.mod, sizeof(mp_limb_t), n, fp) != (size_t)n
+        || fwrite(b, sizeof(mp_limb_t), n, fp) != (size_t)n
+        || fwrite(comb->table, sizeof(mp_limb_t) * n, entries, fp) != entries)
+    {
+        result = -1;
+    }
+
+    if (fclose(fp) != 0 || result != 0 || rename(temp, path) != 0)
+    {
+        unlink(temp);
+        result = -1;
+    }
+
+    free(temp);
+    free(b);
+
+    return result;
+}
+
+void mont_comb_clear(mont_comb *comb)
+{
+    mont_ctx_clear(&comb->ctx);
+    mpz_clear(comb->base);
+    free(comb->owned);
+    if (comb->map != NULL)
+    {
+        munmap(comb->map, comb->map_size);
+    }
+}
+
+/*
+    Columns from the top. Every column squares the accumulator once, then multiplies
+    in one entry of each table. The first entry loads the accumulator directly.
+*/
+void mont_comb_powm(mpz_t r, mpz_t exp, mont_comb *comb, mont_scratch *s)
+{
+    mp_size_t n = comb->ctx.size;
+    const mp_limb_t *ep = mpz_limbs_read(exp);
+    size_t en = mpz_size(exp);
+    size_t entries = (size_t)1 << comb->teeth;
+    size_t row = (size_t)comb->blocks * comb->span;
+    mp_limb_t *acc = s->acc;
+    int started = 0;
+    size_t k;
+    int b, i;
+
+    for (k = comb->span; k-- > 0;)
+    {
+        if (started)
+        {
+            mont_sqr(acc, acc, &comb->ctx, s);
+        }
+
+        for (b = comb->blocks - 1; b >= 0; b--)
+        {
+            size_t index = 0;
+
+            for (i = 0; i < comb->teeth; i++)
+            {
+                size_t pos = i * row + b * comb->span + k;
+                size_t limb = pos / GMP_NUMB_BITS;
+
+                if (limb < en)
+                {
+                    index |= (size_t)((ep[limb] >> (pos % GMP_NUMB_BITS)) & 1) << i;
+                }
+            }
+
+            if (index == 0)
+            {
+                continue;
+            }
+
+            const mp_limb_t *entry = comb->table + (b * entries + index) * n;
+            if (started)
+            {
+                mont_mul(acc, acc, entry, &comb->ctx, s);
+            }
+            else
+            {
+                mpn_copyi(acc, entry, n);
+                started = 1;
+            }
+        }
+    }
+
+    if (!started)
+    {
+        mpz_set_ui(r, 1);
+        mpz_mod(r, r, comb->ctx.m);
+
+        return;
+    }
+
+    // leave Montgomery form
+    mpn_zero(s->t, 2 * n);
+    mpn_copyi(s->t, acc, n);
+
+    mp_limb_t *rp = mpz_limbs_write(r, n);
+    mont_redc(rp, s->t, &comb->ctx);
+    mpz_limbs_finish(r, n);
+}
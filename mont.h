@@ -0,0 +1,105 @@
+#ifndef MONT_H
+#define MONT_H
+
+#include <gmp.h>
+
+/*
+    Montgomery arithmetic with a fixed modulus.
+
+    A context is built once per modulus and holds its Montgomery constants. Per
+    thread scratch space holds the products, so an exponentiation does no
+    allocation.
+*/
+
+
+typedef struct
+{
+    mpz_t m;            // modulus
+    mp_size_t size;     // limbs of the modulus
+    const mp_limb_t *mod;
+    mp_limb_t ninv;     // -m^-1 mod 2^GMP_NUMB_BITS
+    mp_limb_t *rr;      // R^2 mod m
+    mp_limb_t *rrr;     // R^3 mod m
+} mont_ctx;
+
+typedef struct
+{
+    mp_limb_t *t;       // double size product
+    mp_limb_t *acc;
+    mp_limb_t *q;       // quotient of the rare base reduction by division
+} mont_scratch;
+
+
+/*
+    Build a context for odd modulus @arg m.
+*/
+void mont_ctx_init(mont_ctx *ctx, mpz_t m);
+void mont_ctx_clear(mont_ctx *ctx);
+
+/*
+    Scratch space for mont_comb_powm() with @arg ctx. One per thread.
+*/
+void mont_scratch_init(mont_scratch *s, mont_ctx *ctx);
+void mont_scratch_clear(mont_scratch *s);
+
+
+/*
+    Fixed base exponentiation: the base and modulus are fixed, the exponent varies.
+
+    Lim-Lee comb. An exponent of teeth * blocks * span bits is a matrix of teeth rows,
+    each row blocks * span bits long. Table s holds, for every set of rows, the product
+    of base^(2^(row * blocks * span + s * span)) over that set. Column k of block s of
+    the exponent is then one table index, and an exponentiation costs span - 1
+    squarings and at most blocks * span multiplications, 4 to 6 times less than a
+    sliding window.
+
+    The table only depends on the base and the modulus, so it can be written to a file
+    and mapped by later runs instead of built again.
+*/
+typedef struct
+{
+    mont_ctx ctx;           // modulus
+    mpz_t base;             // base mod m
+    int teeth;              // rows, bits of a table index
+    int blocks;             // tables
+    size_t span;            // exponent bits of a row in one block
+    const mp_limb_t *table; // blocks * 2^teeth entries of ctx.size limbs, Montgomery form
+    mp_limb_t *owned;       // the table when built in memory
+    void *map;              // the file when mapped
+    size_t map_size;
+} mont_comb;
+
+
+/*
+    Build the table of @arg base for odd modulus @arg m and exponents of up to @arg bits bits.
+*/
+void mont_comb_init(mont_comb *comb, mpz_t base, mpz_t m, size_t bits);
+
+/*
+    Map a table file written by mont_comb_write() for the same base and modulus, with
+    room for exponents of @arg bits bits.
+    @returns 0 on success, -1 if the file is missing, does not match or fails its checksum.
+    comb is then left uninitialized.
+*/
+int mont_comb_load(mont_comb *comb, mpz_t base, mpz_t m, size_t bits, const char *path);
+
+/*
+    Write the table to @arg path. The file is written aside and renamed in place.
+    @returns 0 on success, -1 on a write error.
+*/
+int mont_comb_write(mont_comb *comb, const char *path);
+
+void mont_comb_clear(mont_comb *comb);
+
+/*
+    Largest exponent size in bits the table covers.
+*/
+size_t mont_comb_bits(const mont_comb *comb);
+
+/*
+    r = base^exp mod m for 0 <= exp < 2^mont_comb_bits(). @arg s comes from
+    mont_scratch_init() with &comb->ctx.
+*/
+void mont_comb_powm(mpz_t r, mpz_t exp, mont_comb *comb, mont_scratch *s);
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef MONT64_H
+#define MONT64_H
+
+#include <stdint.h>
+
+/*
+    Montgomery arithmetic for odd moduli of up to 64 bits, R = 2^64.
+
+    Products are unsigned __int128, so a multiplication is one mul instruction and
+    a reduction two more, with no division. Everything is static inline so the
+    callers get the loops specialized and inlined at compile time.
+*/
+
+
+typedef unsigned __int128 u128;
+
+typedef struct
+{
+    uint64_t m;         // modulus, odd
+    uint64_t minv;      // m^-1 mod 2^64
+    uint64_t one;       // R mod m
+    uint64_t r2;        // R^2 mod m
+} mont64;
+
+
+/*
+    Setup for odd modulus @arg m > 1.
+    m^-1 mod 2^64 comes from Newton's iteration, like montgomery_constants().
+*/
+static inline void mont64_init(mont64 *ctx, uint64_t m)
+{
+    uint64_t x = m;
+    int i;
+
+    for (i = 3; i < 64; i *= 2)
+    {
+        x *= 2 - m * x;
+    }
+
+    ctx->m = m;
+    ctx->minv = x;
+    ctx->one = (0 - m) % m;
+    ctx->r2 = (uint64_t)(((u128)ctx->one * ctx->one) % m);
+}
+
+/*
+    t * R^-1 mod m for t < m * 2^64.
+
+    q * m agrees with t in the low 64 bits, so t - q * m is exact in the high half
+    and never overflows, whatever the size of m.
+*/
+static inline uint64_t mont64_redc(const mont64 *ctx, u128 t)
+{
+    uint64_t q = (uint64_t)t * ctx->minv;
+    uint64_t hi = (uint64_t)(t >> 64);
+    uint64_t qm = (uint64_t)(((u128)q * ctx->m) >> 64);
+
+    return hi >= qm ? hi - qm : hi - qm + ctx->m;
+}
+
+static inline uint64_t mont64_mul(const mont64 *ctx, uint64_t a, uint64_t b)
+{
+    return mont64_redc(ctx, (u128)a * b);
+}
+
+static inline uint64_t mont64_to(const mont64 *ctx, uint64_t x)
+{
+    return mont64_mul(ctx, x % ctx->m, ctx->r2);
+}
+
+static inline uint64_t mont64_from(const mont64 *ctx, uint64_t x)
+{
+    return mont64_redc(ctx, x);
+}
+
+/*
+    base^exp mod m. Left to right binary exponentiation in Montgomery form.
+*/
+static inline uint64_t mont64_powm(const mont64 *ctx, uint64_t base, uint64_t exp)
+{
+    if (exp == 0)
+    {
+        return 1;
+    }
+
+    uint64_t x = mont64_to(ctx, base);
+    uint64_t r = x;
+    int i;
+
+    // the top bit loads r directly
+    for (i = 62 - __builtin_clzll(exp); i >= 0; i--)
+    {
+        r = mont64_mul(ctx, r, r);
+        if ((exp >> i) & 1)
+        {
+            r = mont64_mul(ctx, r, x);
+        }
+    }
+
+    return mont64_from(ctx, r);
+}
+
+/*
+    Two exponentiations with the same modulus, interleaved: r1 = b1^e1, r2 = b2^e2 mod m.
+
+    One exponentiation is a single chain of dependent multiplications and waits on
+    their latency. Two independent chains in the same loop fill those waits, so the
+    pair costs little more than one.
+*/
+static inline void mont64_powm2(const mont64 *ctx, uint64_t b1, uint64_t e1, uint64_t b2, uint64_t e2,
+                                uint64_t *r1, uint64_t *r2)
+{
+    uint64_t x1 = mont64_to(ctx, b1);
+    uint64_t x2 = mont64_to(ctx, b2);
+    uint64_t a1 = ctx->one;
+    uint64_t a2 = ctx->one;
+    int i;
+
+    for (i = 63 - __builtin_clzll(e1 | e2 | 1); i >= 0; i--)
+    {
+        a1 = mont64_mul(ctx, a1, a1);
+        a2 = mont64_mul(ctx, a2, a2);
+        if ((e1 >> i) & 1)
+        {
+            a1 = mont64_mul(ctx, a1, x1);
+        }
+        if ((e2 >> i) & 1)
+        {
+            a2 = mont64_mul(ctx, a2, x2);
+        }
+    }
+
+    *r1 = mont64_from(ctx, a1);
+    *r2 = mont64_from(ctx, a2);
+}
+
+/*
+    base^exp mod m for an odd modulus m > 1, without a kept context.
+*/
+static inline uint64_t powm_u64(uint64_t base, uint64_t exp, uint64_t m)
+{
+    mont64 ctx;
+    mont64_init(&ctx, m);
+
+    return mont64_powm(&ctx, base, exp);
+}
+
+#endif
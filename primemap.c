@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "util.h"
+#include "sieve.h"
+#include "arena.h"
+
+/*
+    Build the prime map file of sieve.h: one bit per odd number below a limit.
+
+    checkIfPrime() and getPrevPrime() of every tool pick it up from PRIME_MAP, when
+    set, and answer from it for numbers below the limit.
+
+    Options:
+     -o path Path to the map file (default: primes.map)
+     -l number Limit of the map, rounded up to a multiple of 128 (default: 2^32, 256MB)
+     -h This help message.
+
+    The limit is decimal, or hexadecimal with a 0x prefix, up to 2^40.
+*/
+
+
+void HELP();
+
+
+int main(int argc, char *argv[])
+{
+    // before the first GMP allocation
+    arena_install();
+
+    char *output = PRIME_MAP_PATH;
+    unsigned long long limit = 1ull << 32;
+    char *end;
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (argv[i][0] == '-' && argv[i][1] == 'h')
+        {
+            HELP();
+
+            exit(0);
+        }
+    }
+
+    for (i = 1; i < argc - 1; i++)
+    {
+        if (argv[i][0] == '-')
+        {
+            if (argv[i][1] == 'o')
+            {
+                output = argv[i + 1];
+            }
+
+            if (argv[i][1] == 'l')
+            {
+                limit = strtoull(argv[i + 1], &end, 0);
+                if (*end != '\0' || limit == 0 || limit > PRIME_MAP_MAX)
+                {
+                    printf("Invalid limit. Must be between 1 and 2^40.\nProgram will exit...\n");
+
+                    exit(1);
+                }
+            }
+        }
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    if (prime_map_build(output, limit) != 0)
+    {
+        printf("Error writing %s.\nProgram will exit...\n", output);
+
+        exit(1);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    if (prime_map_load(output) != 0)
+    {
+        printf("Error reading back %s.\nProgram will exit...\n", output);
+
+        exit(1);
+    }
+
+    printf("%s: primes below %llu, %llu bytes, built in %.2f s.\n", output,
+           (unsigned long long)prime_map_limit(), (unsigned long long)(prime_map_limit() / 16 + 32),
+           (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+
+    return 0;
+}
+
+
+/*
+    Helper function for -h argument.
+*/
+void HELP()
+{
+    fprintf(stdout, "Options:\n\
+     \t-o path Path to the map file (default: primes.map)\n\
+     \t-l number Limit of the map, rounded up to a multiple of 128 (default: 2^32, 256MB)\n\
+     \t-h This help message.\n");
+}
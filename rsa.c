@@ -0,0 +1,1029 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <gmp.h>
+#include "util.h"
+#include "rsa.h"
+#include "arena.h"
+
+
+/*
+    Cipher file: frames of an 8 byte big endian plaintext length followed by the cipher
+    blocks of that many plaintext bytes, one frame per chunk, up to the end of the file.
+    Files of a single frame (one header, then every block) are read the same way.
+*/
+#define HEADER_SIZE 8
+#define CHUNK_BLOCKS 1024
+
+/*
+    Binary key file.
+
+    Header: "RSAK", u16 version, u16 flags, u32 bit length of n, u32 field count.
+    Fields: u32 tag, u32 byte length, big endian bytes of the number (mpz_export).
+    Every integer of the header and of the fields is big endian.
+*/
+#define KEY_MAGIC "RSAK"
+#define KEY_VERSION 1
+#define KEY_HEADER_SIZE 16
+
+#define KEY_FLAG_PRIVATE 1
+#define KEY_FLAG_CRT 2
+
+/*
+    Older files also carry flag 4 and tags 8 to 13, Montgomery constants of n, p and q.
+    Nothing uses them: the flag is ignored and the tags are skipped as unknown.
+*/
+enum key_tag
+{
+    TAG_N = 1, TAG_EXP, TAG_P, TAG_Q, TAG_DP, TAG_DQ, TAG_QINV
+};
+
+/*
+    Pool of worker threads that transform the blocks of one chunk in parallel.
+    Every worker takes a contiguous slice of the chunk and holds its own scratch numbers.
+*/
+typedef struct
+{
+    rsa_ctx *ctx;
+    int mode;               // 'e' to encrypt, 'd' to decrypt
+    int jobs;               // number of workers
+    size_t k;               // plaintext block size
+    size_t cb;              // cipher block size
+    uint64_t left;          // plaintext bytes left in the current frame
+
+    unsigned char *src;     // current chunk
+    unsigned char *dst;     // transformed chunk
+    size_t size;            // plaintext bytes of current chunk
+    size_t count;           // blocks of current chunk
+
+    int stop;
+    int error;
+    pthread_barrier_t start;
+    pthread_barrier_t done;
+} block_pool;
+
+typedef struct
+{
+    pthread_t thread;
+    int id;
+    block_pool *pool;
+} block_worker_t;
+
+
+/*
+    Message of an RSA_ERR_* code.
+*/
+const char* rsa_strerror(int error)
+{
+    switch (error)
+    {
+        case 0: return "Success";
+        case RSA_ERR_FILE: return "Error opening or writing file";
+        case RSA_ERR_KEY: return "Invalid key";
+        case RSA_ERR_CIPHER: return "Cipher is truncated or invalid";
+        case RSA_ERR_MISMATCH: return "Cipher does not match the key";
+        case RSA_ERR_RANDOM: return "No system randomness available";
+        default: return "Unknown error";
+    }
+}
+
+/*
+    Key pair generation.
+
+    p and q are random primes of half the modulus size each, with the top bits set so
+    n has exactly bits bits. Both are searched at once on every thread.
+    The standard profile fixes e = 65537 and only takes primes with gcd(e, p - 1) = 1,
+    then d = e^-1 mod lambda. The forge profile forges d from lambda and e is its inverse.
+*/
+int rsa_keygen(rsa_key *pub, rsa_key *priv, int bits, int threads, int forge)
+{
+    unsigned long exponent = PUBLIC_EXPONENT;
+    int result;
+
+    // 2 Large primes
+    mpz_t p;
+    mpz_t q;
+    mpz_init(p);
+    mpz_init(q);
+
+    if (forge)
+    {
+        result = parallel_primes(p, q, bits / 2, bits - bits / 2, threads, NULL, NULL);
+    }
+    else
+    {
+        result = parallel_primes(p, q, bits / 2, bits - bits / 2, threads, coprime_to_exponent, &exponent);
+    }
+
+    if (result != 0)
+    {
+        mpz_clear(p);
+        mpz_clear(q);
+
+        return RSA_ERR_RANDOM;
+    }
+
+    // Calculate lambda euler func.
+    mpz_t lambda;
+    mpz_init(lambda);
+    lambda_euler_function(lambda, p, q);
+
+    mpz_t e;
+    mpz_t d;
+    mpz_init(e);
+    mpz_init(d);
+
+    if (forge)
+    {
+        // Choose an e. Prime and larger than lambda.
+        forge_d_key(d, lambda);
+
+        // Calculate d : modular inverse of(e, lambda)
+        mpz_invert(e, d, lambda);
+    }
+    else
+    {
+        // Standard profile: fixed e = 65537, d = e^-1 mod lambda.
+        mpz_set_ui(e, exponent);
+        mpz_invert(d, e, lambda);
+    }
+
+    // public key: (n, e)
+    mpz_mul(pub->n, p, q);
+    mpz_set(pub->exp, e);
+    pub->crt = 0;
+
+    // private key: (n, d, p, q, dp, dq, qinv)
+    mpz_set(priv->n, pub->n);
+    mpz_set(priv->exp, d);
+    mpz_set(priv->p, p);
+    mpz_set(priv->q, q);
+
+    mpz_sub_ui(priv->dp, p, 1);
+    mpz_mod(priv->dp, d, priv->dp);
+    mpz_sub_ui(priv->dq, q, 1);
+    mpz_mod(priv->dq, d, priv->dq);
+    mpz_invert(priv->qinv, q, p);
+    priv->crt = 1;
+
+    mpz_clear(p);
+    mpz_clear(q);
+    mpz_clear(e);
+    mpz_clear(d);
+    mpz_clear(lambda);
+
+    return 0;
+}
+
+
+/*
+    Init every number of a key. Key is not CRT until read_key() says so.
+*/
+void rsa_key_init(rsa_key *key)
+{
+    mpz_init(key->n);
+    mpz_init(key->exp);
+    mpz_init(key->p);
+    mpz_init(key->q);
+    mpz_init(key->dp);
+    mpz_init(key->dq);
+    mpz_init(key->qinv);
+    key->crt = 0;
+}
+
+/*
+    Clear every number of a key.
+*/
+void rsa_key_clear(rsa_key *key)
+{
+    mpz_clear(key->n);
+    mpz_clear(key->exp);
+    mpz_clear(key->p);
+    mpz_clear(key->q);
+    mpz_clear(key->dp);
+    mpz_clear(key->dq);
+    mpz_clear(key->qinv);
+}
+
+/*
+    Read a key file of the form (x1,x2,...) in base 10.
+
+    Two fields are (n,exp). Seven fields are (n,d,p,q,dp,dq,qinv), a private key
+    with its CRT components. Numbers are read straight from the file with
+    mpz_inp_str, so there is no limit on the key length.
+
+    @returns 0 on success, -1 if the file can not be parsed.
+*/
+static int read_text_key(FILE *fk, rsa_key *key)
+{
+    mpz_ptr fields[KEY_FIELDS] = {key->n, key->exp, key->p, key->q, key->dp, key->dq, key->qinv};
+    int count = 0;
+    int ch;
+
+    if (fgetc(fk) != '(')
+    {
+        return -1;
+    }
+
+    do
+    {
+        if (count == KEY_FIELDS || mpz_inp_str(fields[count], fk, 10) == 0)
+        {
+            return -1;
+        }
+        count++;
+    }
+    while ((ch = fgetc(fk)) == ',');
+
+    if (ch != ')' || (count != 2 && count != KEY_FIELDS))
+    {
+        return -1;
+    }
+
+    key->crt = count == KEY_FIELDS;
+
+    return 0;
+}
+
+/*
+    Big endian u16/u32 helpers of the binary key format.
+*/
+static uint32_t get_u32(const unsigned char *b)
+{
+    return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | b[3];
+}
+
+static uint16_t get_u16(const unsigned char *b)
+{
+    return (uint16_t)((b[0] << 8) | b[1]);
+}
+
+static void put_u32(unsigned char *b, uint32_t x)
+{
+    b[0] = x >> 24;
+    b[1] = x >> 16;
+    b[2] = x >> 8;
+    b[3] = x;
+}
+
+static void put_u16(unsigned char *b, uint16_t x)
+{
+    b[0] = x >> 8;
+    b[1] = x;
+}
+
+#define SEEN(tag) (1 << (tag))
+#define SEEN_CRT (SEEN(TAG_P) | SEEN(TAG_Q) | SEEN(TAG_DP) | SEEN(TAG_DQ) | SEEN(TAG_QINV))
+
+/*
+    Parse a binary key file mapped at @arg map.
+
+    Every field is imported once with mpz_import, so loading is linear in the file size.
+    Unknown tags are skipped. The bit length of the header must be that of n, and
+    KEY_FLAG_CRT needs p, q, dp, dq and qinv with n = pq.
+
+    @returns 0 on success, -1 if the file is not a valid key.
+*/
+static int read_binary_key(const unsigned char *map, size_t size, rsa_key *key)
+{
+    size_t pos = KEY_HEADER_SIZE;
+    uint32_t i;
+
+    if (size < KEY_HEADER_SIZE || get_u16(map + 4) != KEY_VERSION)
+    {
+        return -1;
+    }
+
+    uint16_t flags = get_u16(map + 6);
+    uint32_t fields = get_u32(map + 12);
+    int seen = 0;
+
+    for (i = 0; i < fields; i++)
+    {
+        if (size - pos < 8 || size - pos - 8 < get_u32(map + pos + 4))
+        {
+            return -1;
+        }
+
+        uint32_t tag = get_u32(map + pos);
+        uint32_t len = get_u32(map + pos + 4);
+        const unsigned char *bytes = map + pos + 8;
+        mpz_ptr x = NULL;
+
+        switch (tag)
+        {
+            case TAG_N: x = key->n; break;
+            case TAG_EXP: x = key->exp; break;
+            case TAG_P: x = key->p; break;
+            case TAG_Q: x = key->q; break;
+            case TAG_DP: x = key->dp; break;
+            case TAG_DQ: x = key->dq; break;
+            case TAG_QINV: x = key->qinv; break;
+            default:
+                break;
+        }
+
+        if (x != NULL)
+        {
+            mpz_import(x, len, 1, 1, 0, 0, bytes);
+            seen |= SEEN(tag);
+        }
+
+        pos += 8 + len;
+    }
+
+    if ((seen & SEEN(TAG_N)) == 0 || (seen & SEEN(TAG_EXP)) == 0 || mpz_sgn(key->n) <= 0 ||
+        get_u32(map + 8) != mpz_sizeinbase(key->n, 2))
+    {
+        return -1;
+    }
+
+    key->crt = (flags & KEY_FLAG_CRT) != 0;
+
+    if (key->crt)
+    {
+        if ((seen & SEEN_CRT) != SEEN_CRT || mpz_cmp_ui(key->p, 1) <= 0 || mpz_cmp_ui(key->q, 1) <= 0)
+        {
+            return -1;
+        }
+
+        mpz_t pq;
+        mpz_init(pq);
+        mpz_mul(pq, key->p, key->q);
+        int valid = mpz_cmp(pq, key->n) == 0 && mpz_sgn(key->qinv) > 0 && mpz_cmp(key->qinv, key->p) < 0 &&
+                    mpz_cmp(key->dp, key->p) < 0 && mpz_cmp(key->dq, key->q) < 0;
+        mpz_clear(pq);
+
+        if (!valid)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+    Read a key file. Binary key files start with KEY_MAGIC and are mmap'd.
+    Anything else is read as a text key (x1,x2,...).
+
+    @returns 0 on success, RSA_ERR_FILE if the file can not be opened or parsed.
+*/
+int read_key(char *path, rsa_key *key)
+{
+    struct stat st;
+    int result;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return RSA_ERR_FILE;
+    }
+
+    if (fstat(fd, &st) == 0 && st.st_size >= KEY_HEADER_SIZE)
+    {
+        unsigned char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (map != MAP_FAILED && memcmp(map, KEY_MAGIC, 4) == 0)
+        {
+            result = read_binary_key(map, st.st_size, key) == 0 ? 0 : RSA_ERR_FILE;
+
+            munmap(map, st.st_size);
+            close(fd);
+
+            return result;
+        }
+        if (map != MAP_FAILED)
+        {
+            munmap(map, st.st_size);
+        }
+    }
+
+    FILE *fk = fdopen(fd, "r");
+    if (fk == NULL)
+    {
+        close(fd);
+
+        return RSA_ERR_FILE;
+    }
+
+    result = read_text_key(fk, key) == 0 ? 0 : RSA_ERR_FILE;
+    fclose(fk);
+
+    return result;
+}
+
+/*
+    Append one field of the binary key format to @arg buffer.
+    @returns the new write position.
+*/
+static size_t put_field(unsigned char *buffer, size_t pos, uint32_t tag, mpz_t x)
+{
+    size_t len = 0;
+
+    mpz_export(buffer + pos + 8, &len, 1, 1, 0, 0, x);
+    put_u32(buffer + pos, tag);
+    put_u32(buffer + pos + 4, len);
+
+    return pos + 8 + len;
+}
+
+/*
+    Write a key to a binary key file.
+
+    Public keys hold n and the exponent. @arg private keys also hold p, q, dp, dq
+    and qinv.
+
+    @returns 0 on success, RSA_ERR_FILE on failure.
+*/
+int write_binary_key(char *path, rsa_key *key, int private)
+{
+    mpz_ptr fields[KEY_FIELDS];
+    uint32_t tags[KEY_FIELDS];
+    uint32_t count = 0;
+    size_t size = KEY_HEADER_SIZE;
+    int crt = private && key->crt;
+    uint32_t i;
+
+    fields[count] = key->n; tags[count++] = TAG_N;
+    fields[count] = key->exp; tags[count++] = TAG_EXP;
+    if (crt)
+    {
+        fields[count] = key->p; tags[count++] = TAG_P;
+        fields[count] = key->q; tags[count++] = TAG_Q;
+        fields[count] = key->dp; tags[count++] = TAG_DP;
+        fields[count] = key->dq; tags[count++] = TAG_DQ;
+        fields[count] = key->qinv; tags[count++] = TAG_QINV;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        size += 8 + (mpz_sizeinbase(fields[i], 2) + 7) / 8;
+    }
+
+    unsigned char *buffer = (unsigned char*)malloc(size);
+    uint16_t flags = (private ? KEY_FLAG_PRIVATE : 0) | (crt ? KEY_FLAG_CRT : 0);
+
+    memcpy(buffer, KEY_MAGIC, 4);
+    put_u16(buffer + 4, KEY_VERSION);
+    put_u16(buffer + 6, flags);
+    put_u32(buffer + 8, mpz_sizeinbase(key->n, 2));
+    put_u32(buffer + 12, count);
+
+    size_t pos = KEY_HEADER_SIZE;
+    for (i = 0; i < count; i++)
+    {
+        pos = put_field(buffer, pos, tags[i], fields[i]);
+    }
+
+    int result = 0;
+
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL || fwrite(buffer, 1, pos, fp) != pos)
+    {
+        result = RSA_ERR_FILE;
+    }
+    if (fp != NULL)
+    {
+        fclose(fp);
+    }
+
+    free(buffer);
+
+    return result;
+}
+
+/*
+    Write @arg count numbers to a key file as (x1,x2,...) in base 10.
+    @returns 0 on success, RSA_ERR_FILE on failure.
+*/
+int write_key(char *path, mpz_t *fields[], int count)
+{
+    int i;
+
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL)
+    {
+        return RSA_ERR_FILE;
+    }
+
+    fprintf(fp, "(");
+    for (i = 0; i < count; i++)
+    {
+        if (i > 0)
+        {
+            fprintf(fp, ",");
+        }
+        mpz_out_str(fp, 10, *fields[i]);
+    }
+    fprintf(fp, ")");
+
+    return fclose(fp) == 0 ? 0 : RSA_ERR_FILE;
+}
+
+
+/*
+    Block size of the plaintext.
+    k bytes are packed as a big endian integer m. It must hold that m < n for every
+    possible k bytes, so k is the amount of full bytes below the top bit of n.
+*/
+size_t plain_block_size(mpz_t n)
+{
+    return (mpz_sizeinbase(n, 2) - 1) / 8;
+}
+
+/*
+    Block size of the cipher.
+    Every residue mod n fits in the amount of bytes of n itself.
+*/
+size_t cipher_block_size(mpz_t n)
+{
+    return (mpz_sizeinbase(n, 2) + 7) / 8;
+}
+
+/*
+    Export @arg x to exactly @arg width big endian bytes, left padded with zeros.
+
+    @returns 0 on success, -1 if x does not fit in width bytes.
+*/
+static int export_block(unsigned char *buffer, size_t width, mpz_t x)
+{
+    size_t count = (mpz_sizeinbase(x, 2) + 7) / 8;
+
+    if (mpz_sgn(x) == 0)
+    {
+        memset(buffer, 0, width);
+
+        return 0;
+    }
+    if (count > width)
+    {
+        return -1;
+    }
+
+    memset(buffer, 0, width - count);
+    mpz_export(buffer + width - count, NULL, 1, 1, 0, 0, x);
+
+    return 0;
+}
+
+/*
+    Write the plaintext length as the 8 byte big endian header of a frame.
+    @returns 0 on success, RSA_ERR_FILE if the write failed.
+*/
+static int write_header(FILE *fp, uint64_t length)
+{
+    unsigned char header[HEADER_SIZE];
+    int i;
+
+    for (i = 0; i < HEADER_SIZE; i++)
+    {
+        header[i] = (unsigned char)(length >> (8 * (HEADER_SIZE - 1 - i)));
+    }
+    return fwrite(header, HEADER_SIZE, 1, fp) == 1 ? 0 : RSA_ERR_FILE;
+}
+
+/*
+    Read the header of the next frame into @arg length.
+    @returns 1 if one was read, 0 at the end of the input, RSA_ERR_CIPHER if it is cut.
+*/
+static int read_header(FILE *fp, uint64_t *length)
+{
+    unsigned char header[HEADER_SIZE];
+    size_t got = fread(header, 1, HEADER_SIZE, fp);
+    int i;
+
+    if (got == 0 && feof(fp))
+    {
+        return 0;
+    }
+    if (got != HEADER_SIZE)
+    {
+        return RSA_ERR_CIPHER;
+    }
+
+    *length = 0;
+    for (i = 0; i < HEADER_SIZE; i++)
+    {
+        *length = (*length << 8) | header[i];
+    }
+
+    return 1;
+}
+
+/*
+    Build the exponentiation context of a key.
+
+    With @arg crt and a CRT key, blocks go through dp mod p and dq mod q,
+    else through exp mod n.
+
+    @returns 0 on success, RSA_ERR_KEY if a modulus is even (not a RSA key).
+*/
+int rsa_ctx_init(rsa_ctx *ctx, rsa_key *key, int crt)
+{
+    ctx->key = key;
+    ctx->crt = crt && key->crt;
+
+    if (ctx->crt)
+    {
+        if (mpz_even_p(key->p) || mpz_even_p(key->q))
+        {
+            return RSA_ERR_KEY;
+        }
+    }
+    else if (mpz_even_p(key->n))
+    {
+        return RSA_ERR_KEY;
+    }
+
+    return 0;
+}
+
+void rsa_ctx_clear(rsa_ctx *ctx)
+{
+    ctx->key = NULL;
+}
+
+/*
+    Scratch of one worker. Numbers are sized for the modulus up front.
+*/
+void rsa_scratch_init(rsa_scratch *s, rsa_ctx *ctx)
+{
+    size_t bits = mpz_sizeinbase(ctx->key->n, 2);
+
+    mpz_init2(s->m1, 2 * bits);
+    mpz_init2(s->m2, 2 * bits);
+}
+
+void rsa_scratch_clear(rsa_scratch *s, rsa_ctx *ctx)
+{
+    mpz_clear(s->m1);
+    mpz_clear(s->m2);
+}
+
+/*
+    r = c^exp mod n through the context of a key.
+    CRT contexts recombine the two half size results with Garner's formula:
+
+    m1 = c^dp mod p
+    m2 = c^dq mod q
+    h  = qinv * (m1 - m2) mod p
+    r  = m2 + h * q
+*/
+void rsa_powm(mpz_t r, mpz_t c, rsa_ctx *ctx, rsa_scratch *s)
+{
+    rsa_key *key = ctx->key;
+
+    if (!ctx->crt)
+    {
+        mpz_powm(r, c, key->exp, key->n);
+
+        return;
+    }
+
+    mpz_powm(s->m1, c, key->dp, key->p);
+    mpz_powm(s->m2, c, key->dq, key->q);
+
+    // h = qinv * (m1 - m2) mod p
+    mpz_sub(s->m1, s->m1, s->m2);
+    mpz_mul(s->m1, s->m1, key->qinv);
+    mpz_mod(s->m1, s->m1, key->p);
+
+    // r = m2 + h * q
+    mpz_mul(s->m1, s->m1, key->q);
+    mpz_add(r, s->m2, s->m1);
+}
+
+/*
+    Transform blocks [first, last) of the current chunk of @arg pool.
+    Scratch numbers belong to the calling worker.
+*/
+static void transform_blocks(block_pool *pool, size_t first, size_t last, mpz_t ch, mpz_t powm,
+                             rsa_scratch *s)
+{
+    size_t k = pool->k;
+    size_t cb = pool->cb;
+    size_t i;
+
+    for (i = first; i < last; i++)
+    {
+        size_t len = pool->size - i * k < k ? pool->size - i * k : k;
+
+        if (pool->mode == 'e')
+        {
+            mpz_import(ch, len, 1, 1, 0, 0, pool->src + i * k);
+            rsa_powm(powm, ch, pool->ctx, s);
+
+            export_block(pool->dst + i * cb, cb, powm);
+        }
+        else
+        {
+            mpz_import(ch, cb, 1, 1, 0, 0, pool->src + i * cb);
+            rsa_powm(powm, ch, pool->ctx, s);
+
+            if (export_block(pool->dst + i * k, len, powm) != 0)
+            {
+                pool->error = 1;
+            }
+        }
+    }
+}
+
+/*
+    Worker thread of the block pool.
+    Waits for a chunk, transforms its own slice of the blocks and reports back.
+*/
+static void* block_worker(void *arg)
+{
+    block_worker_t *worker = (block_worker_t*)arg;
+    block_pool *pool = worker->pool;
+    rsa_scratch s;
+    arena_temps temps;
+
+    arena_temps_init(&temps, pool->cb * 8);
+    mpz_ptr ch = temps.t[0];
+    mpz_ptr powm = temps.t[1];
+    rsa_scratch_init(&s, pool->ctx);
+
+    while (1)
+    {
+        pthread_barrier_wait(&pool->start);
+        if (pool->stop)
+        {
+            break;
+        }
+
+        size_t first = pool->count * worker->id / pool->jobs;
+        size_t last = pool->count * (worker->id + 1) / pool->jobs;
+
+        transform_blocks(pool, first, last, ch, powm, &s);
+
+        pthread_barrier_wait(&pool->done);
+    }
+
+    rsa_scratch_clear(&s, pool->ctx);
+    arena_temps_clear(&temps);
+
+    return NULL;
+}
+
+/*
+    Read the next chunk of input into @arg buffer.
+    Sets the plaintext size and the block count of the chunk. A cipher chunk never
+    spans two frames. A truncated cipher sets @arg error.
+
+    @returns the block count. 0 at the end of the input.
+*/
+static size_t read_chunk(block_pool *pool, FILE *fin, unsigned char *buffer, size_t *size, int *error)
+{
+    size_t chunk = pool->k * CHUNK_BLOCKS * pool->jobs;
+    size_t count;
+    int result;
+
+    if (pool->mode == 'e')
+    {
+        *size = fread(buffer, 1, chunk, fin);
+
+        return (*size + pool->k - 1) / pool->k;
+    }
+
+    while (pool->left == 0)
+    {
+        if ((result = read_header(fin, &pool->left)) <= 0)
+        {
+            *error = result;
+            *size = 0;
+
+            return 0;
+        }
+    }
+
+    *size = pool->left < chunk ? pool->left : chunk;
+    count = (*size + pool->k - 1) / pool->k;
+
+    if (count > 0 && fread(buffer, pool->cb, count, fin) != count)
+    {
+        *error = RSA_ERR_CIPHER;
+
+        return 0;
+    }
+    pool->left -= *size;
+
+    return count;
+}
+
+/*
+    Stream @arg fin to @arg fout through the block pool.
+
+    Chunks are double buffered. While the workers transform chunk i, this thread
+    writes the output of chunk i-1 and reads chunk i+1, so compute and I/O overlap.
+    Output is always written in input order, every cipher chunk as a frame.
+
+    @arg length gets the plaintext bytes processed.
+    @returns 0 on success or an RSA_ERR_* code.
+*/
+static int run_pool(block_pool *pool, FILE *fin, FILE *fout, uint64_t *length)
+{
+    size_t chunk = CHUNK_BLOCKS * pool->jobs;
+    unsigned char *src[2];
+    unsigned char *dst[2];
+    size_t size[2];
+    size_t count[2];
+    int cur = 0;
+    int error = 0;
+    int i;
+
+    size_t src_block = pool->mode == 'e' ? pool->k : pool->cb;
+    size_t dst_block = pool->mode == 'e' ? pool->cb : pool->k;
+
+    for (i = 0; i < 2; i++)
+    {
+        src[i] = (unsigned char*)malloc(src_block * chunk);
+        dst[i] = (unsigned char*)malloc(dst_block * chunk);
+    }
+
+    block_worker_t *workers = (block_worker_t*)malloc(sizeof(block_worker_t) * pool->jobs);
+
+    pthread_barrier_init(&pool->start, NULL, pool->jobs + 1);
+    pthread_barrier_init(&pool->done, NULL, pool->jobs + 1);
+    pool->stop = 0;
+    pool->error = 0;
+
+    for (i = 0; i < pool->jobs; i++)
+    {
+        workers[i].id = i;
+        workers[i].pool = pool;
+        pthread_create(&workers[i].thread, NULL, block_worker, &workers[i]);
+    }
+
+    *length = 0;
+
+    count[cur] = read_chunk(pool, fin, src[cur], &size[cur], &error);
+
+    while (count[cur] > 0)
+    {
+        pool->src = src[cur];
+        pool->dst = dst[cur];
+        pool->size = size[cur];
+        pool->count = count[cur];
+        pthread_barrier_wait(&pool->start);
+
+        count[cur ^ 1] = read_chunk(pool, fin, src[cur ^ 1], &size[cur ^ 1], &error);
+
+        pthread_barrier_wait(&pool->done);
+        if (pool->error)
+        {
+            error = RSA_ERR_MISMATCH;
+
+            break;
+        }
+
+        if (pool->mode == 'e')
+        {
+            if (write_header(fout, size[cur]) != 0 || fwrite(dst[cur], pool->cb, count[cur], fout) != count[cur])
+            {
+                error = RSA_ERR_FILE;
+
+                break;
+            }
+        }
+        else if (fwrite(dst[cur], 1, size[cur], fout) != size[cur])
+        {
+            error = RSA_ERR_FILE;
+
+            break;
+        }
+
+        *length += size[cur];
+        cur ^= 1;
+    }
+
+    pool->stop = 1;
+    pthread_barrier_wait(&pool->start);
+
+    for (i = 0; i < pool->jobs; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    pthread_barrier_destroy(&pool->start);
+    pthread_barrier_destroy(&pool->done);
+
+    free(workers);
+    for (i = 0; i < 2; i++)
+    {
+        free(src[i]);
+        free(dst[i]);
+    }
+
+    return error;
+}
+
+/*
+    Encryption method. Uses mpz_t numbers and functions.
+    Writes the encrypted cipher to the destination file.
+
+    Plaintext is cut in blocks of plain_block_size(n) bytes. Each block is read as one
+    big endian integer, raised to the public key and written as cipher_block_size(n) bytes.
+    The last block may be shorter. Its length is recovered from the header of its frame,
+    which holds the plaintext length of the frame as a 8 byte big endian number.
+
+    Input is read CHUNK_BLOCKS blocks per worker at a time, so memory does not grow with
+    the input, and written as one frame per chunk. The output is never rewound: pipes and
+    other streams work. An empty input gives a single empty frame.
+
+    @arg length gets the plaintext bytes read.
+    @returns 0 on success or an RSA_ERR_* code.
+*/
+int encrypt(FILE *fin, FILE *fout, rsa_ctx *ctx, int jobs, uint64_t *length)
+{
+    rsa_key *key = ctx->key;
+    block_pool pool;
+
+    pool.ctx = ctx;
+    pool.mode = 'e';
+    pool.jobs = jobs < 1 ? 1 : jobs;
+    pool.k = plain_block_size(key->n);
+    pool.cb = cipher_block_size(key->n);
+    pool.left = 0;
+
+    if (pool.k == 0)
+    {
+        return RSA_ERR_KEY;
+    }
+
+    int error = run_pool(&pool, fin, fout, length);
+
+    if (error == 0 && ferror(fin))
+    {
+        error = RSA_ERR_FILE;
+    }
+    if (error == 0 && *length == 0)
+    {
+        error = write_header(fout, 0);
+    }
+    if (fflush(fout) != 0 && error == 0)
+    {
+        error = RSA_ERR_FILE;
+    }
+
+    return error;
+}
+
+/*
+    Decryption method function.
+
+    Reads from binary input the cipher.
+
+    Uses mpz_t numbers and function to decrypt it. Every cipher block is
+    unpacked back to the plaintext bytes it was packed from.
+
+    Cipher is read CHUNK_BLOCKS blocks per worker at a time and every deciphered
+    chunk is written to the output right away.
+
+    Contexts of CRT keys decipher through two half size exponentiations.
+
+    @arg length gets the plaintext bytes written.
+    @returns 0 on success or an RSA_ERR_* code.
+*/
+int decrypt(FILE *fin, FILE *fout, rsa_ctx *ctx, int jobs, uint64_t *length)
+{
+    rsa_key *key = ctx->key;
+    block_pool pool;
+
+    pool.ctx = ctx;
+    pool.mode = 'd';
+    pool.jobs = jobs < 1 ? 1 : jobs;
+    pool.k = plain_block_size(key->n);
+    pool.cb = cipher_block_size(key->n);
+    pool.left = 0;
+
+    *length = 0;
+    if (pool.k == 0)
+    {
+        return RSA_ERR_KEY;
+    }
+
+    // the first frame is read up front: a cipher has one at least.
+    int error = read_header(fin, &pool.left);
+
+    if (error <= 0)
+    {
+        return RSA_ERR_CIPHER;
+    }
+
+    error = run_pool(&pool, fin, fout, length);
+
+    if (fflush(fout) != 0 && error == 0)
+    {
+        error = RSA_ERR_FILE;
+    }
+
+    return error;
+}
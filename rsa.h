@@ -0,0 +1,148 @@
+#ifndef RSA_H
+#define RSA_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <gmp.h>
+
+/*
+    RSA key, exponentiation context and block stream cipher.
+    Used by the rsa_assign_1 tool and by the bench.
+*/
+
+
+#define KEY_FIELDS 7
+#define PUBLIC_EXPONENT 65537
+
+/*
+    Errors returned by the functions below. 0 is success.
+*/
+#define RSA_ERR_FILE -1         // file can not be opened or written
+#define RSA_ERR_KEY -2          // key is invalid or too small to hold a byte
+#define RSA_ERR_CIPHER -3       // cipher is truncated or has no header
+#define RSA_ERR_MISMATCH -4     // cipher does not match the key
+#define RSA_ERR_RANDOM -5       // no system randomness for a key pair
+
+
+/*
+    RSA key as stored in a key file: (n,exp) or (n,exp,p,q,dp,dq,qinv).
+
+    Public keys and plain private keys hold n and the exponent only.
+    Private keys written by key_generation() also keep the CRT components
+    dp = d mod (p-1), dq = d mod (q-1) and qinv = q^-1 mod p.
+*/
+typedef struct
+{
+    mpz_t n;
+    mpz_t exp;
+    mpz_t p;
+    mpz_t q;
+    mpz_t dp;
+    mpz_t dq;
+    mpz_t qinv;
+    int crt;    // 1 if p, q, dp, dq and qinv are set
+} rsa_key;
+
+/*
+    Exponentiation context of a key. Built once per key and shared read only by
+    every worker. Picks exp mod n, or dp mod p and dq mod q for CRT keys.
+    The exponentiation itself is mpz_powm(), which measured as fast as a sliding
+    window Montgomery exponentiation with the exponent recoded once per key, at
+    2048 to 4096 bits.
+*/
+typedef struct
+{
+    rsa_key *key;
+    int crt;            // 1 if dp mod p and dq mod q are used instead of exp mod n
+} rsa_ctx;
+
+/*
+    Scratch of one worker for an rsa_ctx, sized for the modulus.
+*/
+typedef struct
+{
+    mpz_t m1;
+    mpz_t m2;
+} rsa_scratch;
+
+
+/*
+    Message of an RSA_ERR_* code.
+*/
+const char* rsa_strerror(int error);
+
+/*
+    Init and clear every number of a key.
+*/
+void rsa_key_init(rsa_key *key);
+void rsa_key_clear(rsa_key *key);
+
+/*
+    Generate a key pair with a modulus of @arg bits bits on @arg threads threads.
+    @arg forge derives the exponents with forge_d_key() instead of e = 65537.
+    @arg pub gets (n, e). @arg priv gets (n, d) and the CRT components.
+    @returns 0 on success, RSA_ERR_RANDOM if there is no system randomness (keys untouched).
+*/
+int rsa_keygen(rsa_key *pub, rsa_key *priv, int bits, int threads, int forge);
+
+/*
+    Read a key file into @arg key. Binary and text key files are accepted.
+    @returns 0 on success, RSA_ERR_FILE if the file can not be opened or parsed.
+*/
+int read_key(char *path, rsa_key *key);
+
+/*
+    Write @arg count numbers to a key file as (x1,x2,...).
+    @returns 0 on success, RSA_ERR_FILE on failure.
+*/
+int write_key(char *path, mpz_t *fields[], int count);
+
+/*
+    Write a key to a binary key file. @arg private also writes the CRT components.
+    @returns 0 on success, RSA_ERR_FILE on failure.
+*/
+int write_binary_key(char *path, rsa_key *key, int private);
+
+/*
+    Build the exponentiation context of a key. @arg crt picks the CRT components if the key has them.
+    @returns 0 on success, RSA_ERR_KEY if a modulus is even.
+*/
+int rsa_ctx_init(rsa_ctx *ctx, rsa_key *key, int crt);
+void rsa_ctx_clear(rsa_ctx *ctx);
+
+/*
+    Scratch space of one thread for rsa_powm() with @arg ctx.
+*/
+void rsa_scratch_init(rsa_scratch *s, rsa_ctx *ctx);
+void rsa_scratch_clear(rsa_scratch *s, rsa_ctx *ctx);
+
+/*
+    r = c^exp mod n through the context of a key.
+*/
+void rsa_powm(mpz_t r, mpz_t c, rsa_ctx *ctx, rsa_scratch *s);
+
+/*
+    Number of plaintext bytes packed in one block. Largest byte count that stays below n.
+*/
+size_t plain_block_size(mpz_t n);
+
+/*
+    Number of bytes of one cipher block. Enough to hold any residue mod n.
+*/
+size_t cipher_block_size(mpz_t n);
+
+/*
+    where encryption actually happens. Streams @arg fin to @arg fout chunk by chunk
+    on @arg jobs threads. @arg length gets the plaintext bytes read.
+    @returns 0 on success or an RSA_ERR_* code.
+*/
+int encrypt(FILE *fin, FILE *fout, rsa_ctx *ctx, int jobs, uint64_t *length);
+
+/*
+    where decryption actually happens. Streams @arg fin to @arg fout chunk by chunk
+    on @arg jobs threads. @arg length gets the plaintext bytes written.
+    @returns 0 on success or an RSA_ERR_* code.
+*/
+int decrypt(FILE *fin, FILE *fout, rsa_ctx *ctx, int jobs, uint64_t *length);
+
+#endif
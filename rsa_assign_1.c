@@ -2,29 +2,25 @@
 #include <stdlib.h>
 #include <gmp.h>
 #include "util.h"
+#include "rsa.h"
+#include "arena.h"
 #include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 
-#define MAX_BUFFER 4096
-#define MAX_CIPHER 16384
-
-long long int cipher_byte_size=0;
-
-
-
-mpz_t n;    // mpz_t type number to hold n key
-mpz_t d;    // mpz_t type number to hold d key
-mpz_t e;    // mpz_t type number to hold e key
-
 char *in;   // string to hold given input path
 char *out;  // string to hold given output path
 char *k;    // string to hold given key path
 
 
-/*
-    Prints cipher to stdout.
-*/
-void print_cipher(size_t *cihper, int size);
+int jobs = 0;   // number of worker threads. 0 picks 1 for -e/-d and every core for -g
+int bits = 2048;    // modulus size for key generation
+int forge = 0;      // 1 to forge the exponents with forge_d_key() instead of e = 65537
+int text_keys = 0;  // 1 to write key files as text (x1,x2,...) instead of binary
+
+
 /*
     Exit function. Fixes loose ends
 */
@@ -34,6 +30,7 @@ void destruct();
     keys generation
 */
 void key_generation();
+static double elapsed_ms(struct timespec *from, struct timespec *to);
 /*
     encryption of input
 */
@@ -45,15 +42,9 @@ void encryption();
 void decryption();
 
 /*
-    where encryption actually happens and is written to output.
-*/
-size_t* encrypt(size_t* cipher, char *plaintext, int size, mpz_t puKey, mpz_t n);
-
-/*
-    where decryption actually happens. It's not written to output directly this time.
-    Caller must free @return value afterwards he is done with it.
+    Helper function for argument -h.
 */
-char* decrypt(mpz_t prKey, mpz_t n);
+void HELP();
 
 
 /*
@@ -65,9 +56,7 @@ char* decrypt(mpz_t prKey, mpz_t n);
 */
 void destruct()
 {
-    mpz_clear(n);
-    mpz_clear(d);
-    mpz_clear(e);
+    fflush(stdout);
 
     exit(1);
 }
@@ -80,83 +69,68 @@ void destruct()
 */
 void key_generation()
 {
-    // 2 Large primes
-    mpz_t p;
-    mpz_t q;
-    mpz_init(p);
-    mpz_init(q);
+    struct timespec t0, t1;
+    int result;
 
-    // n = p * q
-    mpz_init(n);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
 
-    
-    // SET KEYS  AS DEFAULT PRIMES
+    rsa_key pub;
+    rsa_key priv;
+    rsa_key_init(&pub);
+    rsa_key_init(&priv);
 
-    mpz_set_ui(p, 17);
-    mpz_set_ui(q, 29);
-
-    // Multiplication: n = p * q
-    mpz_mul(n, p, q);
-
-   
-    // Calculate lambda euler func.
-    mpz_t lambda;
-    mpz_init(lambda);
-    lambda_euler_function(lambda, p, q);
+    result = rsa_keygen(&pub, &priv, bits, jobs, forge);
+    if (result != 0)
+    {
+        printf("%s. Program will exit...\n", rsa_strerror(result));
 
- 
-    // Choose an e. Prime and larger than lambda.
-    mpz_init(d);   
-    forge_d_key(d, lambda);
-    
- 
-    // Calculate d : modular inverse of(e, lambda)
-    mpz_init(e);
-    mpz_invert(e, d, lambda);
+        exit(1);
+    }
 
+    clock_gettime(CLOCK_MONOTONIC, &t1);
 
-    // public key: (n, d)
-    // private key: (n, e)
 
+    // Write to file
+    if (text_keys)
+    {
+        mpz_t *public_fields[] = {&pub.n, &pub.exp};
+        mpz_t *private_fields[] = {&priv.n, &priv.exp, &priv.p, &priv.q, &priv.dp, &priv.dq, &priv.qinv};
 
-    mpz_clear(p);
-    mpz_clear(q);
-    mpz_clear(lambda);
+        result = write_key("public.key", public_fields, 2);
+        if (result == 0)
+        {
+            result = write_key("private.key", private_fields, KEY_FIELDS);
+        }
+    }
+    else
+    {
+        result = write_binary_key("public.key", &pub, 0);
+        if (result == 0)
+        {
+            result = write_binary_key("private.key", &priv, 1);
+        }
+    }
 
+    rsa_key_clear(&pub);
+    rsa_key_clear(&priv);
 
-    FILE *fp1;
-    FILE *fp2;
-    fp1 = fopen("public.key", "w");
-    fp2 = fopen("private.key", "w");
-    if (fp1 == NULL|| fp2 == NULL)
+    if (result != 0)
     {
         printf("Error opening a file. Program will now terminate...\n");
 
         destruct();
     }
- 
 
-    // Write to file
-    fprintf(fp1, "(");
-    mpz_out_str(fp1, 10, n);
-    fprintf(fp1,",");
-    mpz_out_str(fp1, 10, e);
-    fprintf(fp1,")");
-    fflush(fp1);
-    
-    fprintf(fp2, "(");
-    mpz_out_str(fp2, 10, n);
-    fprintf(fp2,",");
-    mpz_out_str(fp2, 10, d);
-    fprintf(fp2,")");
-    
-    
-    
-    fflush(fp2);
-    
-    fclose(fp1);
-    fclose(fp2);
-    
+    // Report key generation latency.
+    printf("Key generation: %d bits in %.3f ms on %d threads\n", bits, elapsed_ms(&t0, &t1), jobs);
+}
+
+/*
+    Milliseconds between two monotonic clock readings.
+*/
+static double elapsed_ms(struct timespec *from, struct timespec *to)
+{
+    return (to->tv_sec - from->tv_sec) * 1e3 + (to->tv_nsec - from->tv_nsec) / 1e6;
 }
 
 
@@ -165,414 +139,270 @@ void key_generation()
     Function to configure encryption mechanism and data setup for encrypt() method to encrypt.
 
     This method does not write directly to a file.
-
-    Has option to print cipher as text in stdout.
 */
 void encryption()
 {
-    FILE* fk;
+    // Fetch the keys.
+    rsa_key key;
+    rsa_key_init(&key);
 
-    fk = fopen(k, "r");
-    if (fk == NULL)
+    if (read_key(k, &key) != 0)
     {
-        printf("Error opening file. Program will exit...\n");
+        printf("Error reading key file. Program will exit...\n");
 
         destruct();
     }
 
 
-    // Fetch the keys.
-    char buffer[MAX_BUFFER];
-    char *n;
-    char *e;
-    char ch;
-    int i = 0;
-    int j = 0;
-    int k = 0;
-
+    // Open input and output. Plaintext is streamed, never held as a whole.
+    FILE* fin;
+    FILE* fout;
 
-    while ((ch = fgetc(fk)) != EOF)
+    fin = fopen(in, "rb");
+    fout = fopen(out, "wb");
+    if (fin == NULL || fout == NULL)
     {
-        if (ch != EOF)
-        {
-            buffer[i++] = ch;
-
-            if (ch == ',')
-            {
-                n = (char*)malloc(sizeof(char)*i);
-
-                int c = 0;
-                for (j = 0; j < i - 1; j++)
-                {
-                    if (buffer[j] != '(' && buffer[j] != ',')
-                    {
-                        n[c++] = buffer[j];
-                    }
-                }
-
-            }
-            else if (ch == ')')
-            {
-                e = (char*)malloc(sizeof(char)*(i-j));
-                
-                int b = 0;
-                for (k = 0; k < i - j; k++)
-                {
-                    if (buffer[j + k] != ',' && buffer[j + k] != ')')
-                    {
-                        e[b++] = buffer[j + k];
-                    }
-                }
-
-                break;
-            }
-        }
-    }
+        printf("Error opening file. Program will exit...\n");
 
-    char *keys = (char*) malloc(sizeof(char)*i);
-    j=0;
-    for (j = 0; j < i; j++)
-    {
-        keys[j] = buffer[j];
+        destruct();
     }
 
-
-    // print keys
-    //printf("keys: %s\tn: %s\te: %s\n", keys, n, e);
-    fclose(fk);
-
-    free(keys); 
-    remove(buffer);
-
-
-    // Fetch the plain_text from input.
-    FILE* fin;
-
-    fin = fopen(in, "r");
-    if (fin == NULL)
+    // Exponentiation context, built once for every block.
+    rsa_ctx ctx;
+    if (rsa_ctx_init(&ctx, &key, 0) != 0)
     {
-        printf("Error opening file. Program will exit...\n");
+        printf("Invalid key. Program will exit...\n");
 
         destruct();
     }
 
+    // encrypt. Encrypt method responsible to write  the cipher.
+    uint64_t length;
+    int result = encrypt(fin, fout, &ctx, jobs, &length);
+    rsa_ctx_clear(&ctx);
 
-    char plaintext[MAX_BUFFER];
-    char c;
-    i = 0;
-
-    while ((c = fgetc(fin)) != EOF)
+    if (result != 0)
     {
-        if (c != EOF)
-        {
-            plaintext[i++] = c;
-        }
-    }
-    i--;
-
+        printf("%s. Program will exit...\n", rsa_strerror(result));
 
-    int size = i;
+        destruct();
+    }
 
-    // print plaintext
-    //printf("PLAINTEXT: %s", plaintext);
-    
     fclose(fin);
+    if (fclose(fout) != 0)
+    {
+        printf("%s. Program will exit...\n", rsa_strerror(RSA_ERR_FILE));
 
-    // create mpz_t numbers;
-    mpz_t ekey;
-    mpz_t nkey;
-
-    mpz_init(ekey);
-    mpz_init(nkey);
-
-    mpz_set_str(ekey, e, 10);
-    mpz_set_str(nkey, n, 10);
-
-    size_t* cipher = (size_t*)malloc(sizeof(size_t)*size);
-    // encrypt. Encrypt method responsible to write  the cipher.
-    cipher = encrypt(cipher, plaintext, size, ekey, nkey);
-
-      
-    // print cipher
-    //printf("CIPHER: ");
-    //print_cipher(cipher, size);
-
-
+        destruct();
+    }
 
-    mpz_clear(nkey);
-    mpz_clear(ekey);
-    free(cipher);
-    free(e);
-    free(n);
+    rsa_key_clear(&key);
     fflush(stdout);
- 
 }
 
 /*
-    Helper function in order to print a size_t cipher in stdout.
-*/
-void print_cipher(size_t *cipher, int size)
-{
-    int i;
-
-    for (i = 0; i < size; i++)
-    {
-        printf("%"PRIu64" ", (uint64_t)cipher[i]);
-    }
+    Decryption Handler method.
 
-    printf("\n");
-}
+    Sets up the data needed to perform decryption and calls decrypt
 
-/*
-    Encryption method. Uses mpz_t numbers and functions.
-    Writes the encrypted cipher to the destination file.
-    Returns  a text version of the cipher.
+    decrypt() writes to file the decrypted message.
 */
-size_t* encrypt(size_t* cipher, char *plaintext, int size, mpz_t puKey, mpz_t n)
+void decryption()
 {
-    
-    int i; 
-    mpz_t ch;
-    mpz_init(ch);
-    mpz_t powm;
-    mpz_init(powm);
+    // Fetch the keys.
+    rsa_key key;
+    rsa_key_init(&key);
 
+    if (read_key(k, &key) != 0)
+    {
+        printf("Error reading key file. Program will exit...\n");
 
- 
+        destruct();
+    }
 
-    size_t buffer[8];
 
-    FILE *fp ;
-    fp = fopen(out, "wb");
-    if (fp == NULL)
+    // Open input and output. Deciphered chunks are written as they come.
+    FILE* fin;
+    FILE* fout;
+
+    fin = fopen(in, "rb");
+    fout = fopen(out, "wb");
+    if (fin == NULL || fout == NULL)
     {
         printf("Error opening file. Program will exit...\n");
 
         destruct();
     }
 
-    for (i = 0; i < size; i ++)
+    // Exponentiation context, built once for every block. CRT if the key has it.
+    rsa_ctx ctx;
+    if (rsa_ctx_init(&ctx, &key, 1) != 0)
     {
-        mpz_set_ui(ch, plaintext[i]);
-        mpz_powm(powm, ch, puKey, n);
-        
-        cipher[i] = (uint64_t)mpz_get_ui(powm);
-        mpz_export(buffer, NULL, 1, 8, 0, 0, powm);
-
-        fwrite(buffer, 8, 1, fp);
-
-   
+        printf("Invalid key. Program will exit...\n");
 
+        destruct();
     }
 
+    // decrypt.
+    uint64_t length;
+    int result = decrypt(fin, fout, &ctx, jobs, &length);
+    rsa_ctx_clear(&ctx);
 
-    fclose(fp);
-    mpz_clear(ch);
-    mpz_clear(powm);
-
-    return cipher;
-}
-
-/*
-    Decryption method function.
-
-    Reads from binary input the cipher.
-
-    Uses mpz_t numbers and function to decrypt it
-
-    Allocated memory for the decipher and returns it.
-
-    @CALLER must free the decipher.
-*/
-char* decrypt(mpz_t prKey, mpz_t n)
-{
-
-    int i;
-
-    mpz_t ch;
-    mpz_init(ch);
-    mpz_t powm;
-    mpz_init(powm);
-
-
-
-    FILE *fp;
-    fp = fopen(in, "rb");
-    if (fp == NULL)
+    if (result != 0)
     {
-        printf("Error opening file. Program will exit...\n");
+        printf("%s. Program will exit...\n", rsa_strerror(result));
 
         destruct();
     }
 
-    fseek(fp, 0, SEEK_END);
-    unsigned long int size = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
 
-
-    size_t buffer[8];
-    // Caller must free.
-    char* plaintext = (char*)malloc(sizeof(char) *size/8);
-
-    for (i = 0; i < size/8; i ++)
+    // Clean up
+    rsa_key_clear(&key);
+    fflush(stdout);
+    fclose(fin);
+    if (fclose(fout) != 0)
     {
-        fread(buffer, 8, 1, fp);
-        mpz_import(ch, 1, 1, 8, 0, 0, buffer);
+        printf("%s. Program will exit...\n", rsa_strerror(RSA_ERR_FILE));
 
-        mpz_powm(powm, ch, prKey, n);
-        plaintext[i] = mpz_get_ui(powm);
+        destruct();
     }
-    plaintext[i] = '\0';
-
-
-    fclose(fp);
-    mpz_clear(ch);
-    mpz_clear(powm);
+}
 
-    
 
-    return plaintext;
-}
 
 /*
-    Decryption Handler method.
+    Helper function for argument -h.
+*/
+void HELP()
+    {
+        fprintf(stdout, "Options:\n\
+         \t-i path Path to the input file\n\
+         \t-o path Path to the outpout file\n\
+         \t-k path Path to the key file\n\
+         \t-j N Number of worker threads (default 1 for -e and -d, every core for -g)\n\
+         \t-g Perform RSA key-pair generation\n\
+         \t--bits N Modulus size for -g: 2048, 3072 or 4096 (default 2048)\n\
+         \t--forge Forge the key exponents from lambda instead of e = 65537\n\
+         \t--text Write text key files (n,e) instead of binary ones for -g\n\
+         \t-d Decrypt input and store results to output\n\
+         \t-e Encrypt input and store results to output\n\
+         \t-h This hellp message.\n");
+    }
 
-    Sets up the data needed to perform decryption and calls decrypt
 
-    This method writes to file the decrypted message.
-    and handles freeing it
-*/
-void decryption()
+
+int main(int argc, char *argv[])
 {
-    FILE* fk;
+    // before the first GMP allocation
+    arena_install();
+
+    int i;
+    int mode = 0;
 
-    fk = fopen(k, "r");
-    if (fk == NULL)
+    if (argc < 2)
     {
-        printf("Error opening file. Program will exit...\n");
+        HELP();
 
-        destruct();
+        exit(0);
     }
 
-
-    // Fetch the keys.
-    char buffer[MAX_BUFFER];
-    char *n;
-    char *d;
-    char ch;
-    int i = 0;
-    int j = 0;
-    int k = 0;
-
-
-    while ((ch = fgetc(fk)) != EOF)
+    for (i = 1; i < argc; i++)
     {
-        if (ch != EOF)
+        if (argv[i][0] != '-')
         {
-            buffer[i++] = ch;
+            continue;
+        }
 
-            if (ch == ',')
-            {
-                n = (char*)malloc(sizeof(char)*i);
+        switch (argv[i][1])
+        {
+            case 'i':
+                in = i + 1 < argc ? argv[++i] : NULL;
+                break;
+            case 'o':
+                out = i + 1 < argc ? argv[++i] : NULL;
+                break;
+            case 'k':
+                k = i + 1 < argc ? argv[++i] : NULL;
+                break;
+            case 'j':
+                jobs = i + 1 < argc ? atoi(argv[++i]) : 0;
+                if (jobs < 1)
+                {
+                    printf("Invalid number of threads.\n");
 
-                int c = 0;
-                for (j = 0; j < i - 1; j++)
+                    exit(1);
+                }
+                break;
+            case '-':
+                if (strcmp(argv[i], "--bits") == 0 && i + 1 < argc)
                 {
-                    if (buffer[j] != '(' && buffer[j] != ',')
+                    bits = atoi(argv[++i]);
+                    if (bits != 2048 && bits != 3072 && bits != 4096)
                     {
-                        n[c++] = buffer[j];
+                        printf("Invalid modulus size: 2048, 3072 or 4096.\n");
+
+                        exit(1);
                     }
+                    break;
                 }
-
-            }
-            else if (ch == ')')
-            {
-                d = (char*)malloc(sizeof(char)*(i-j));
-                
-                int b = 0;
-                for (k = 0; k < i - j; k++)
+                if (strcmp(argv[i], "--forge") == 0)
                 {
-                    if (buffer[j + k] != ',' && buffer[j + k] != ')')
-                    {
-                        d[b++] = buffer[j + k];
-                    }
+                    forge = 1;
+                    break;
+                }
+                if (strcmp(argv[i], "--text") == 0)
+                {
+                    text_keys = 1;
+                    break;
                 }
 
+                HELP();
+
+                exit(0);
+            case 'g':
+            case 'e':
+            case 'd':
+                mode = argv[i][1];
                 break;
-            }
+            default:
+                HELP();
+
+                exit(0);
         }
     }
 
-    char *keys = (char*) malloc(sizeof(char)*i);
-    j=0;
-    for (j = 0; j < i; j++)
+    if (jobs == 0)
     {
-        keys[j] = buffer[j];
+        jobs = mode == 'g' ? (int)sysconf(_SC_NPROCESSORS_ONLN) : 1;
+        jobs = jobs < 1 ? 1 : jobs;
     }
-    // print keys
-    //printf("keys: %s\nn: %s\ne: %s\n", keys, n, d);
-    fclose(fk);
-
-    free(keys); 
-    remove(buffer);
-
 
-
-
-    // create mpz_t numbers from keys;
-    mpz_t dkey;
-    mpz_t nkey;
-    mpz_init(dkey);
-    mpz_init(nkey);
-
-    mpz_set_str(dkey, d, 10);
-    mpz_set_str(nkey, n, 10);
-
-    // encrypt.
-    char* plaintext = decrypt(dkey, nkey);
-
-
-
-    // Write deciphered to output.
-    FILE* fout;
-    fout = fopen(out, "w");
-    if (fout == NULL)
+    if (mode == 'g')
     {
-        printf("Error opening file. Program will exit...\n");
-
-        destruct();
+        key_generation();
     }
-    
-    // print cipher
-    //printf("DECIPHER:%s\n", plaintext);
-
+    else if (mode == 'e' || mode == 'd')
+    {
+        if (in == NULL || out == NULL || k == NULL)
+        {
+            printf("Input, output and key paths must be provided.\n");
 
-    fprintf(fout, "%s", plaintext);
+            destruct();
+        }
 
+        if (mode == 'e')
+        {
+            encryption();
+        }
+        else
+        {
+            decryption();
+        }
+    }
+    else
+    {
+        HELP();
+    }
 
-    // Clean up
-    mpz_clear(nkey);
-    mpz_clear(dkey);
-    free(plaintext);
-    free(d);
-    free(n);
-    fflush(stdout);
-    fclose(fout);
+    return 0;
 }
-
-
-
-/*
-    Helper function for argument -h.
-*/
-void HELP()
-    {
-        fprintf(stdout, "Options:\n\
-         \t-i path Path to the input file\n\
-         \t-o path Path to the outpout file\n\
-         \t-k path Path to the key file\n\
-         \t-g Perform RSA key-pair generation\n\
-         \t-d Decrypt input and store results to output\n\
-         \t-e Encrypt input and store results to output\n\
-         \t-h This hellp message.\n");
-    }    
\ No newline at end of file
@@ -0,0 +1,565 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "sieve.h"
+#include "util.h"
+
+
+#define SIEVE_SEGMENT_BITS (32768 * 8)  // largest segment: 32KB of bits, one L1 cache
+#define SIEVE_FIRST_BITS 256            // first segment
+#define SIEVE_BASE_LIMIT (1u << 20)     // largest crossing off prime. Exact sieve up to 2^40
+
+
+/*
+    Prime map file.
+
+    Header: "PMAP", u32 version, u64 limit, u64 word count, u64 reserved.
+    Words: bit i % 64 of word i / 64 is set if 2i + 1 is a prime.
+    Everything is in host byte order so the words are used in place. A map written
+    on a machine of the other byte order fails the version check.
+*/
+#define MAP_MAGIC "PMAP"
+#define MAP_VERSION 1
+#define MAP_HEADER_SIZE 32
+#define MAP_SPOT_CHECKS 64      // points of a map checked against Miller-Rabin on load
+
+
+static uint32_t *base_primes;   // odd primes below SIEVE_BASE_LIMIT
+static size_t base_count;
+static pthread_once_t base_once = PTHREAD_ONCE_INIT;
+
+static const uint64_t *map_words;   // bitmap of the mapped file, NULL if none
+static uint64_t map_limit;
+static void *map_base;
+static size_t map_size;
+static pthread_once_t map_once = PTHREAD_ONCE_INIT;
+
+/*
+    Odd primes below SIEVE_BASE_LIMIT from a plain odd only sieve. Built once, shared
+    read only by every iterator.
+*/
+static void base_primes_init()
+{
+    size_t n = SIEVE_BASE_LIMIT / 2;    // index i stands for 2i + 1
+    unsigned char *composite = (unsigned char*)calloc(n, 1);
+    size_t i, j;
+
+    for (i = 1; i < n; i++)
+    {
+        if (!composite[i])
+        {
+            base_count++;
+            for (j = 2 * i * (i + 1); j < n; j += 2 * i + 1)
+            {
+                composite[j] = 1;
+            }
+        }
+    }
+
+    base_primes = (uint32_t*)malloc(sizeof(uint32_t) * base_count);
+    base_count = 0;
+    for (i = 1; i < n; i++)
+    {
+        if (!composite[i])
+        {
+            base_primes[base_count++] = 2 * i + 1;
+        }
+    }
+
+    free(composite);
+}
+
+static uint64_t isqrt(uint64_t n)
+{
+    uint64_t r = (uint64_t)sqrt((double)n);
+
+    while (r > 0 && (r > 0xFFFFFFFFull || r * r > n))
+    {
+        r--;
+    }
+    while (r < 0xFFFFFFFFull && (r + 1) * (r + 1) <= n)
+    {
+        r++;
+    }
+
+    return r;
+}
+
+/*
+    Cross off the segment of @arg it->count odd numbers from @arg it->low.
+
+    Crossing off primes go up to sqrt of the top of the segment, capped at a few times
+    the segment size: a larger prime costs a division and hits the segment once at most.
+    Past the cap, what survives is confirmed by checkIfPrime() when yielded.
+    With @arg exact there is no such cap, for callers that cannot confirm, up to 2^40.
+*/
+static void sieve_segment(prime_iter *it, int exact)
+{
+    uint64_t low = it->low;
+    uint64_t high = low + 2 * (it->count - 1);
+    uint64_t root = isqrt(high);
+    uint64_t bound = root;
+    size_t words = (it->count + 63) / 64;
+    size_t i;
+
+    if (!exact && bound > 4 * (uint64_t)it->count)
+    {
+        bound = 4 * (uint64_t)it->count;
+    }
+    if (bound >= SIEVE_BASE_LIMIT)
+    {
+        bound = SIEVE_BASE_LIMIT - 1;
+    }
+    it->confirm = bound < root;
+
+    memset(it->bits, 0, words * sizeof(uint64_t));
+    if (it->count % 64)
+    {
+        it->bits[words - 1] = ~0ull << (it->count % 64);
+    }
+
+    for (i = 0; i < base_count && base_primes[i] <= bound; i++)
+    {
+        uint64_t q = base_primes[i];
+        uint64_t start = q * q;
+
+        if (start < low)
+        {
+            uint64_t r = low % q;
+
+            if (r != 0 && q - r > high - low)
+            {
+                continue;
+            }
+            start = r ? low + (q - r) : low;
+        }
+        if (!(start & 1))
+        {
+            if (q > high - start)
+            {
+                continue;
+            }
+            start += q;
+        }
+        if (start > high)
+        {
+            continue;
+        }
+
+        size_t j;
+        for (j = (start - low) / 2; j < it->count; j += q)
+        {
+            it->bits[j / 64] |= 1ull << (j % 64);
+        }
+    }
+}
+
+/*
+    Place the next segment in the direction of the iterator, of at most it->span numbers.
+    @returns 0 if there are no odd numbers left that way.
+*/
+static int next_segment(prime_iter *it, uint64_t from)
+{
+    size_t count = it->span;
+
+    if (it->direction > 0)
+    {
+        // from is the first odd number of the segment. Keep the top below 2^64.
+        uint64_t room = (UINT64_MAX - from) / 2 + 1;
+
+        count = count > room ? room : count;
+        it->low = from;
+    }
+    else
+    {
+        // from is the last odd number of the segment. 1 is left out, 2 is yielded apart.
+        if (from < 3)
+        {
+            return 0;
+        }
+
+        uint64_t room = (from - 3) / 2 + 1;
+
+        count = count > room ? room : count;
+        it->low = from - 2 * (count - 1);
+    }
+
+    it->count = count;
+    it->cursor = it->direction > 0 ? 0 : count;
+    sieve_segment(it, 0);
+
+    if (it->span < SIEVE_SEGMENT_BITS)
+    {
+        it->span *= 2;
+    }
+
+    return 1;
+}
+
+void prime_iter_init(prime_iter *it, uint64_t start, int direction)
+{
+    pthread_once(&base_once, base_primes_init);
+
+    it->direction = direction > 0 ? 1 : -1;
+    it->bits = (uint64_t*)malloc(SIEVE_SEGMENT_BITS / 8);
+    it->span = SIEVE_FIRST_BITS;
+    it->done = 0;
+
+    if (it->direction > 0)
+    {
+        it->two = start <= 2;
+        it->done = !next_segment(it, start < 3 ? 3 : start | 1);
+    }
+    else
+    {
+        it->two = start >= 2;
+        it->done = start < 3 || !next_segment(it, start & 1 ? start : start - 1);
+    }
+}
+
+void prime_iter_clear(prime_iter *it)
+{
+    free(it->bits);
+}
+
+/*
+    Next unmarked index of the segment, scanning whole words of bits.
+    @returns 1 and sets @arg index, or 0 at the end of the segment.
+*/
+static int next_index(prime_iter *it, size_t *index)
+{
+    if (it->direction > 0)
+    {
+        while (it->cursor < it->count)
+        {
+            size_t w = it->cursor / 64;
+            uint64_t open = ~it->bits[w] & (~0ull << (it->cursor % 64));
+
+            if (open == 0)
+            {
+                it->cursor = (w + 1) * 64;
+
+                continue;
+            }
+
+            *index = w * 64 + __builtin_ctzll(open);
+            it->cursor = *index + 1;
+
+            return 1;
+        }
+
+        return 0;
+    }
+
+    while (it->cursor > 0)
+    {
+        size_t top = it->cursor - 1;
+        size_t w = top / 64;
+        uint64_t mask = top % 64 == 63 ? ~0ull : (1ull << (top % 64 + 1)) - 1;
+        uint64_t open = ~it->bits[w] & mask;
+
+        if (open == 0)
+        {
+            it->cursor = w * 64;
+
+            continue;
+        }
+
+        *index = w * 64 + 63 - __builtin_clzll(open);
+        it->cursor = *index;
+
+        return 1;
+    }
+
+    return 0;
+}
+
+uint64_t prime_iter_next(prime_iter *it)
+{
+    size_t index;
+
+    if (it->direction > 0 && it->two)
+    {
+        it->two = 0;
+
+        return 2;
+    }
+
+    while (!it->done)
+    {
+        while (next_index(it, &index))
+        {
+            uint64_t n = it->low + 2 * index;
+
+            if (!it->confirm || checkIfPrime(n))
+            {
+                return n;
+            }
+        }
+
+        if (it->direction > 0)
+        {
+            uint64_t last = it->low + 2 * (it->count - 1);
+
+            it->done = last >= UINT64_MAX - 1 || !next_segment(it, last + 2);
+        }
+        else
+        {
+            it->done = !next_segment(it, it->low - 2);
+        }
+    }
+
+    if (it->direction < 0 && it->two)
+    {
+        it->two = 0;
+
+        return 2;
+    }
+
+    return 0;
+}
+
+
+int prime_map_build(const char *path, uint64_t limit)
+{
+    prime_iter seg;
+    uint64_t low;
+    uint64_t header[MAP_HEADER_SIZE / 8] = {0};
+    int result = 0;
+
+    limit = (limit + 127) & ~127ull;
+    if (limit == 0 || limit > PRIME_MAP_MAX)
+    {
+        return -1;
+    }
+
+    size_t length = strlen(path) + 16;
+    char *temp = (char*)malloc(length);
+    snprintf(temp, length, "%s.%d", path, (int)getpid());
+
+    FILE *fp = fopen(temp, "wb");
+    if (fp == NULL)
+    {
+        free(temp);
+
+        return -1;
+    }
+
+    memcpy(header, MAP_MAGIC, 4);
+    ((uint32_t*)header)[1] = MAP_VERSION;
+    header[1] = limit;
+    header[2] = limit / 128;
+    if (fwrite(header, MAP_HEADER_SIZE, 1, fp) != 1)
+    {
+        result = -1;
+    }
+
+    pthread_once(&base_once, base_primes_init);
+    seg.bits = (uint64_t*)malloc(SIEVE_SEGMENT_BITS / 8);
+
+    // Full segments aligned on words of the map: every segment starts at 1 mod 128.
+    for (low = 1; result == 0 && low < limit; low += 2 * SIEVE_SEGMENT_BITS)
+    {
+        size_t words;
+        size_t i;
+
+        seg.low = low;
+        seg.count = (limit - low + 1) / 2;
+        if (seg.count > SIEVE_SEGMENT_BITS)
+        {
+            seg.count = SIEVE_SEGMENT_BITS;
+        }
+        // the last segment is short when the limit is not a multiple of the segment
+        sieve_segment(&seg, 1);
+
+        words = seg.count / 64;
+        for (i = 0; i < words; i++)
+        {
+            seg.bits[i] = ~seg.bits[i];
+        }
+        if (low == 1)
+        {
+            seg.bits[0] &= ~1ull;   // 1 is not a prime
+        }
+
+        if (fwrite(seg.bits, sizeof(uint64_t), words, fp) != words)
+        {
+            result = -1;
+        }
+    }
+
+    free(seg.bits);
+    if (fclose(fp) != 0 || result != 0 || rename(temp, path) != 0)
+    {
+        unlink(temp);
+        result = -1;
+    }
+    free(temp);
+
+    return result;
+}
+
+/*
+    Bit of odd @arg n in the bitmap @arg words.
+*/
+static int map_bit(const uint64_t *words, uint64_t n)
+{
+    return (words[n / 128] >> (n / 2 % 64)) & 1;
+}
+
+/*
+    Spot check of a bitmap below @arg limit against Miller-Rabin, which never reads
+    the map. From MAP_SPOT_CHECKS points spread over the range, the odd numbers are
+    walked down to the first prime: every one of them must have the bit Miller-Rabin
+    gives it. A map of the wrong numbers, or zeroed or flipped pages, fails here
+    rather than sending composites to the callers as primes.
+
+    @returns 1 if every checked bit is right.
+*/
+static int map_spot_check(const uint64_t *words, uint64_t limit)
+{
+    mpz_t m;
+    int valid = 1;
+    int i;
+
+    mpz_init(m);
+    for (i = 0; i < MAP_SPOT_CHECKS && valid; i++)
+    {
+        uint64_t n = (limit / MAP_SPOT_CHECKS * i + limit / MAP_SPOT_CHECKS / 2) | 1;
+        int prime = 0;
+
+        for (; n >= 3 && !prime && valid; n -= 2)
+        {
+            mpz_set_ui(m, n);
+            prime = mpz_probab_prime_p(m, 25) != 0;
+            valid = map_bit(words, n) == prime;
+        }
+    }
+    mpz_clear(m);
+
+    return valid;
+}
+
+/*
+    Map the file at @arg path and make it the current map if it is a valid one.
+*/
+static int map_open(const char *path)
+{
+    struct stat st;
+    const uint64_t *header;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    if (fstat(fd, &st) != 0 || st.st_size < MAP_HEADER_SIZE)
+    {
+        close(fd);
+
+        return -1;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    header = (const uint64_t*)map;
+    if (memcmp(map, MAP_MAGIC, 4) != 0 || ((const uint32_t*)map)[1] != MAP_VERSION
+        || header[1] == 0 || header[1] % 128 != 0 || header[1] > PRIME_MAP_MAX
+        || header[2] != header[1] / 128
+        || (uint64_t)st.st_size != MAP_HEADER_SIZE + header[2] * sizeof(uint64_t)
+        || !map_spot_check(header + MAP_HEADER_SIZE / 8, header[1]))
+    {
+        munmap(map, st.st_size);
+
+        return -1;
+    }
+
+    if (map_base != NULL)
+    {
+        munmap(map_base, map_size);
+    }
+    map_base = map;
+    map_size = st.st_size;
+    map_limit = header[1];
+    map_words = header + MAP_HEADER_SIZE / 8;
+
+    return 0;
+}
+
+/*
+    First use of the map: load PRIME_MAP if it is set. A map is only ever used on
+    request, never picked up from the working directory.
+*/
+static void prime_map_default()
+{
+    const char *path = getenv("PRIME_MAP");
+
+    if (path != NULL)
+    {
+        map_open(path);
+    }
+}
+
+int prime_map_load(const char *path)
+{
+    pthread_once(&map_once, prime_map_default);
+
+    return map_open(path);
+}
+
+uint64_t prime_map_limit()
+{
+    pthread_once(&map_once, prime_map_default);
+
+    return map_words != NULL ? map_limit : 0;
+}
+
+int prime_map_test(uint64_t n)
+{
+    pthread_once(&map_once, prime_map_default);
+
+    if (map_words == NULL || n >= map_limit)
+    {
+        return -1;
+    }
+    if (!(n & 1))
+    {
+        return n == 2;
+    }
+
+    return map_bit(map_words, n);
+}
+
+uint64_t prime_map_prev(uint64_t n)
+{
+    pthread_once(&map_once, prime_map_default);
+
+    if (map_words == NULL || n - 1 >= map_limit)
+    {
+        return 0;
+    }
+
+    // largest odd number below n, and every bit at or below it
+    uint64_t index = (n - 2) / 2;
+    size_t w = index / 64;
+    uint64_t open = map_words[w] & (index % 64 == 63 ? ~0ull : (1ull << (index % 64 + 1)) - 1);
+
+    while (open == 0 && w > 0)
+    {
+        open = map_words[--w];
+    }
+
+    return open ? 2 * (w * 64 + 63 - __builtin_clzll(open)) + 1 : 2;
+}
@@ -0,0 +1,93 @@
+#ifndef SIEVE_H
+#define SIEVE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+    Segmented Sieve of Eratosthenes. Yields primes up or down from a start number.
+
+    A segment holds odd numbers only, one bit each, so 32KB of bits (one L1 cache)
+    cover half a million numbers. The first segment is small and every next one is
+    twice as large up to that size, so a query for a single neighbouring prime stays
+    cheap and a long scan runs on full segments.
+
+    Segments are crossed off by the odd primes up to sqrt of their top, capped by the
+    segment size and SIEVE_BASE_LIMIT. Past the cap the survivors are confirmed with
+    checkIfPrime(), so every yielded number is a prime all the way to 2^64.
+*/
+
+
+typedef struct
+{
+    int direction;      // 1 for increasing primes, -1 for decreasing
+    uint64_t low;       // first (odd) number of the segment
+    size_t count;       // odd numbers in the segment
+    size_t span;        // size of the next segment, in odd numbers
+    size_t cursor;      // next index to look at. Moves down from count when decreasing
+    uint64_t *bits;     // bit i set: low + 2i is not a prime
+    int confirm;        // 1 if survivors need checkIfPrime()
+    int two;            // 1 if 2 has still to be yielded
+    int done;           // 1 once the odd numbers of the direction are exhausted
+} prime_iter;
+
+
+/*
+    Iterator over primes >= @arg start (@arg direction 1) or <= @arg start (@arg direction -1).
+*/
+void prime_iter_init(prime_iter *it, uint64_t start, int direction);
+void prime_iter_clear(prime_iter *it);
+
+/*
+    Next prime in the direction of the iterator.
+    @returns 0 when there is none left (below 2 or above 2^64).
+*/
+uint64_t prime_iter_next(prime_iter *it);
+
+
+/*
+    Prime bitmap file. One bit per odd number below a limit, set for the primes, built
+    once by the primemap tool and mmap'd read only by every process after.
+
+    checkIfPrime() and getPrevPrime() map the file named by the PRIME_MAP environment
+    variable on their first call and answer from it with a bit test when the number is
+    in range. Without the variable they do the arithmetic as before. A map is spot
+    checked against Miller-Rabin when it is loaded.
+*/
+
+#define PRIME_MAP_PATH "primes.map"    // default output of the primemap tool
+#define PRIME_MAP_MAX (1ull << 40)      // largest limit. The crossing off is exact up to there
+
+/*
+    Sieve the odd numbers below @arg limit, rounded up to a multiple of 128, and write
+    the bitmap to @arg path. The file is written aside and renamed in place, so running
+    processes see either the old map or the new one.
+    @returns 0 on success, -1 on a bad limit or a write error.
+*/
+int prime_map_build(const char *path, uint64_t limit);
+
+/*
+    Map the bitmap file at @arg path in place of the current one. Not to be called
+    while other threads test numbers.
+    @returns 0 on success, -1 if the file is missing, not a prime map or fails the spot check.
+*/
+int prime_map_load(const char *path);
+
+/*
+    Numbers below the limit answer from the bitmap. 0 if no map is loaded.
+*/
+uint64_t prime_map_limit();
+
+/*
+    Primality of @arg n from the bitmap.
+    @returns 1 prime, 0 composite, -1 if n is not below the limit of the map.
+*/
+int prime_map_test(uint64_t n);
+
+/*
+    Largest prime below @arg n >= 3 from the bitmap.
+    @returns 0 if n - 1 is not below the limit of the map.
+*/
+uint64_t prime_map_prev(uint64_t n);
+
+#endif
@@ -0,0 +1,318 @@
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <gmp.h>
+#include "dh.h"
+#include "tgdh.h"
+
+
+/*
+    One parallel step: @arg fn on every item, taken one at a time from a shared index.
+*/
+typedef struct
+{
+    tgdh_tree *tree;
+    int (*fn)(tgdh_tree *tree, int item);
+    int *items;
+    int count;
+    atomic_int next;
+    atomic_int error;
+} tgdh_step;
+
+
+/*
+    Balanced subtree of the @arg count members from @arg first, the larger half on the left.
+    @returns the index of its root.
+*/
+static int build(tgdh_tree *tree, int first, int count, int parent, int *next)
+{
+    int v = (*next)++;
+    tgdh_node *node = &tree->nodes[v];
+
+    node->parent = parent;
+    node->first = first;
+    node->count = count;
+    mpz_inits(node->key, node->blind, NULL);
+
+    if (count == 1)
+    {
+        node->left = -1;
+        node->right = -1;
+        node->height = 0;
+        tree->leaf[first] = v;
+
+        return v;
+    }
+
+    int half = count - count / 2;
+
+    node->left = build(tree, first, half, v, next);
+    node->right = build(tree, first + half, count - half, v, next);
+    node->height = 1 + tree->nodes[node->left].height;
+
+    return v;
+}
+
+void tgdh_init(tgdh_tree *tree, int members, mpz_t p, mpz_t g)
+{
+    int next = 0;
+    int i;
+
+    tree->members = members;
+    tree->nodes = (tgdh_node*)malloc(sizeof(tgdh_node) * (2 * members - 1));
+    tree->leaf = (int*)malloc(sizeof(int) * members);
+    tree->member_key = (mpz_t*)malloc(sizeof(mpz_t) * members);
+    tree->cost = (tgdh_cost*)calloc(members, sizeof(tgdh_cost));
+    tree->broadcasts = 0;
+    mpz_init_set(tree->p, p);
+    mpz_init_set(tree->g, g);
+    tree->key_bits = 0;
+
+    for (i = 0; i < members; i++)
+    {
+        mpz_init(tree->member_key[i]);
+    }
+
+    build(tree, 0, members, -1, &next);
+    tree->height = tree->nodes[0].height;
+}
+
+void tgdh_clear(tgdh_tree *tree)
+{
+    int i;
+
+    for (i = 0; i < 2 * tree->members - 1; i++)
+    {
+        mpz_set_ui(tree->nodes[i].key, 0);
+        mpz_clears(tree->nodes[i].key, tree->nodes[i].blind, NULL);
+    }
+    for (i = 0; i < tree->members; i++)
+    {
+        mpz_clear(tree->member_key[i]);
+    }
+
+    mpz_clears(tree->p, tree->g, NULL);
+    free(tree->nodes);
+    free(tree->leaf);
+    free(tree->member_key);
+    free(tree->cost);
+}
+
+
+static double cpu_ms()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+/*
+    r = base^exp mod p, charged to member @arg m. A base of g goes through
+    dh_public_key(), which uses the fixed base table of g if one is set.
+*/
+static void member_powm(tgdh_tree *tree, int m, mpz_t r, mpz_t base, mpz_t exp)
+{
+    double t0 = cpu_ms();
+
+    if (base == tree->g)
+    {
+        dh_public_key(r, tree->g, exp, tree->p);
+    }
+    else
+    {
+        dh_shared_secret(r, base, exp, tree->p);
+    }
+
+    tree->cost[m].ms += cpu_ms() - t0;
+    tree->cost[m].exps++;
+}
+
+/*
+    Member @arg m draws its private key, the key of its leaf, and broadcasts g^key.
+*/
+static int leaf_step(tgdh_tree *tree, int m)
+{
+    tgdh_node *leaf = &tree->nodes[tree->leaf[m]];
+
+    if (dh_private_key(leaf->key, tree->p, tree->key_bits) != 0)
+    {
+        return DH_ERR_RANDOM;
+    }
+    member_powm(tree, m, leaf->blind, tree->g, leaf->key);
+
+    return 0;
+}
+
+/*
+    The sponsor of node @arg v computes k(v) = bk(right)^k(left). It is the first member
+    of the left subtree too, so it holds k(left) from the level below. The blinded key
+    of the root is never needed.
+*/
+static int node_step(tgdh_tree *tree, int v)
+{
+    tgdh_node *node = &tree->nodes[v];
+
+    member_powm(tree, node->first, node->key, tree->nodes[node->right].blind, tree->nodes[node->left].key);
+    if (node->parent >= 0)
+    {
+        member_powm(tree, node->first, node->blind, tree->g, node->key);
+    }
+
+    return 0;
+}
+
+/*
+    Member @arg m walks from its leaf to the root with the blinded keys of the siblings
+    on the way. Keys of the nodes it sponsors it has computed already.
+*/
+static int path_step(tgdh_tree *tree, int m)
+{
+    int child = tree->leaf[m];
+    int v = tree->nodes[child].parent;
+    mpz_t key, next;
+
+    mpz_init_set(key, tree->nodes[child].key);
+    mpz_init(next);
+
+    for (; v >= 0; child = v, v = tree->nodes[v].parent)
+    {
+        tgdh_node *node = &tree->nodes[v];
+
+        if (node->first == m)
+        {
+            mpz_set(key, node->key);
+
+            continue;
+        }
+
+        int sibling = node->left == child ? node->right : node->left;
+
+        member_powm(tree, m, next, tree->nodes[sibling].blind, key);
+        mpz_swap(key, next);
+    }
+
+    mpz_set(tree->member_key[m], key);
+    mpz_set_ui(key, 0);
+    mpz_clears(key, next, NULL);
+
+    return 0;
+}
+
+static void* step_worker(void *arg)
+{
+    tgdh_step *step = (tgdh_step*)arg;
+    int i;
+
+    while ((i = atomic_fetch_add(&step->next, 1)) < step->count)
+    {
+        int result = step->fn(step->tree, step->items[i]);
+
+        if (result != 0)
+        {
+            atomic_store(&step->error, result);
+        }
+    }
+
+    return NULL;
+}
+
+/*
+    @arg fn on @arg count items on up to @arg jobs threads, this one included.
+    @returns 0, or the error of a failed item.
+*/
+static int run_step(tgdh_tree *tree, int (*fn)(tgdh_tree*, int), int *items, int count, int jobs)
+{
+    tgdh_step step;
+    int i;
+
+    jobs = jobs < count ? jobs : count;
+
+    step.tree = tree;
+    step.fn = fn;
+    step.items = items;
+    step.count = count;
+    atomic_init(&step.next, 0);
+    atomic_init(&step.error, 0);
+
+    pthread_t *threads = (pthread_t*)malloc(sizeof(pthread_t) * (jobs > 1 ? jobs - 1 : 1));
+
+    for (i = 0; i < jobs - 1; i++)
+    {
+        pthread_create(&threads[i], NULL, step_worker, &step);
+    }
+    step_worker(&step);
+    for (i = 0; i < jobs - 1; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    free(threads);
+
+    return atomic_load(&step.error);
+}
+
+int tgdh_run(tgdh_tree *tree, mpz_t key, int jobs, int bits)
+{
+    int *items = (int*)malloc(sizeof(int) * tree->members);
+    int result, count, h, i;
+
+    tree->key_bits = bits < 0 ? dh_exponent_bits(tree->p) : bits;
+    jobs = jobs < 1 ? 1 : jobs;
+
+    for (i = 0; i < tree->members; i++)
+    {
+        tree->cost[i].exps = 0;
+        tree->cost[i].ms = 0;
+        items[i] = i;
+    }
+
+    result = run_step(tree, leaf_step, items, tree->members, jobs);
+
+    // the nodes of one height are the roots of disjoint subtrees
+    for (h = 1; result == 0 && h <= tree->height; h++)
+    {
+        count = 0;
+        for (i = 0; i < 2 * tree->members - 1; i++)
+        {
+            if (tree->nodes[i].height == h)
+            {
+                items[count++] = i;
+            }
+        }
+
+        result = run_step(tree, node_step, items, count, jobs);
+    }
+
+    if (result == 0)
+    {
+        for (i = 0; i < tree->members; i++)
+        {
+            items[i] = i;
+        }
+
+        result = run_step(tree, path_step, items, tree->members, jobs);
+    }
+
+    free(items);
+
+    if (result != 0)
+    {
+        return result;
+    }
+
+    // every blinded key but the root's
+    tree->broadcasts = 2 * tree->members - 2;
+
+    for (i = 1; i < tree->members; i++)
+    {
+        if (mpz_cmp(tree->member_key[i], tree->member_key[0]) != 0)
+        {
+            return DH_ERR_MISMATCH;
+        }
+    }
+    mpz_set(key, tree->member_key[0]);
+
+    return 0;
+}
@@ -0,0 +1,83 @@
+#ifndef TGDH_H
+#define TGDH_H
+
+#include <gmp.h>
+
+/*
+    Tree based group Diffie-Hellman (TGDH, Kim, Perrig and Tsudik) over a prime p
+    with generator g, and a simulator that runs every member in process.
+
+    The members are the leaves of a balanced binary tree. Every node v has a secret key
+    k(v) and a blinded key bk(v) = g^k(v) mod p, which is public. A leaf key is the
+    private key of its member. An inner node with children l and r has
+    k(v) = bk(r)^k(l) = bk(l)^k(r) = g^(k(l) k(r)) mod p, so either side of it can
+    compute it from the blinded key of the other side. The root key is the group key.
+
+    The sponsor of a node, the first member below it, computes k(v) and bk(v) and
+    broadcasts bk(v). Every other member walks from its leaf to the root with one
+    exponentiation per level. A member thus does O(log N) exponentiations, against N - 1
+    pairwise exchanges, and the N (N - 1) / 2 exchanges of the whole group.
+
+    Nodes of the same height are in disjoint subtrees, so the simulator computes them
+    in parallel, and then the paths of all members.
+*/
+
+
+/*
+    Node of the tree. Children and parent are indexes in the node array, -1 if none.
+*/
+typedef struct
+{
+    int left;
+    int right;
+    int parent;
+    int first;          // first member below the node, its sponsor
+    int count;          // members below the node
+    int height;         // 0 for a leaf
+    mpz_t key;          // k(v), known to the members below v only
+    mpz_t blind;        // bk(v) = g^k(v), broadcast
+} tgdh_node;
+
+/*
+    Work of one member.
+*/
+typedef struct
+{
+    unsigned long exps;         // modular exponentiations
+    double ms;                  // CPU time of them
+} tgdh_cost;
+
+typedef struct
+{
+    int members;
+    int height;
+    tgdh_node *nodes;           // node 0 is the root
+    int *leaf;                  // node of every member
+    mpz_t p;
+    mpz_t g;
+    int key_bits;               // private key size of the run, as for dh_private_key()
+
+    mpz_t *member_key;          // the group key as each member computed it
+    tgdh_cost *cost;            // per member
+    unsigned long broadcasts;   // blinded keys sent
+} tgdh_tree;
+
+
+/*
+    Tree of @arg members >= 2 members over p and g, which the caller has validated.
+*/
+void tgdh_init(tgdh_tree *tree, int members, mpz_t p, mpz_t g);
+void tgdh_clear(tgdh_tree *tree);
+
+/*
+    Run the agreement: draw the private keys of every member (@arg bits as for
+    dh_private_key(), -1 for dh_exponent_bits(p)), compute and broadcast the blinded keys
+    of every node bottom up, then the path of every member, on @arg jobs threads.
+
+    @arg key gets the group key. tree->cost gets the work of every member.
+    @returns 0 if every member computed the same key, DH_ERR_RANDOM if there is no
+    randomness for the private keys, DH_ERR_MISMATCH if the members disagree.
+*/
+int tgdh_run(tgdh_tree *tree, mpz_t key, int jobs, int bits);
+
+#endif
@@ -1,13 +1,49 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include "util.h"
+#include "mont.h"
+#include "dh.h"
+#include "mont64.h"
+#include "sieve.h"
+#include "x25519.h"
+#include "dhnet.h"
+#include "tgdh.h"
+#include "rsa.h"
+#include "arena.h"
+#include <pthread.h>
+#include <unistd.h>
 #include <assert.h>
+#include <string.h>
+#include <sys/stat.h>
 #include <gmp.h>
 
 
 int checkIfPrime(size_t n);
 
+/*
+    Handshake server of the network test.
+*/
+typedef struct
+{
+    int fd;
+    atomic_int stop;
+    dhnet_stats stats;
+} serve_test;
+
+static void* serve_thread(void *arg)
+{
+    serve_test *t = (serve_test*)arg;
+
+    dhnet_serve(t->fd, 2, -1, &t->stop, &t->stats);
+
+    return NULL;
+}
+
 int main(void)
 {
+    // before the first GMP allocation
+    arena_install();
+
     // Test to check if a number is indeed a primitive root.
     
     printf("PRIMITIVE ROOT TEST.\n");
@@ -16,6 +52,29 @@ int main(void)
 
     assert(checkIfPrimitiveRoot(23, 10));
 
+    printf("\tConfirming the primitive roots of 23 are 5 7 10 11 14 15 17 19 20 21...\n");
+    int r;
+    for (r = 1; r < 23; r++)
+    {
+        int root = r == 5 || r == 7 || r == 10 || r == 11 || r == 14 || r == 15
+                   || r == 17 || r == 19 || r == 20 || r == 21;
+        assert(checkIfPrimitiveRoot(23, r) == root);
+    }
+
+    printf("\tConfirming 2 is a primitive root of 2^64 - 59 and 6 is not...\n");
+    assert(checkIfPrimitiveRoot(18446744073709551557ull, 2));
+    assert(!checkIfPrimitiveRoot(18446744073709551557ull, 6));
+    assert(!checkIfPrimitiveRoot(21, 2));
+
+    printf("\tConfirming the factors of (2^32 - 5)(2^32 - 17) and 2^64 - 60...\n");
+    uint64_t factors[PRIME_FACTORS_MAX];
+    assert(prime_factors(4294967291ull * 4294967279ull, factors) == 2);
+    assert(factors[0] * factors[1] == 4294967291ull * 4294967279ull);
+    assert(factors[0] == 4294967291ull || factors[0] == 4294967279ull);
+    assert(prime_factors(18446744073709551556ull, factors) == 5);
+    assert(factors[0] == 2 && factors[1] == 11 && factors[2] == 137 && factors[3] == 547);
+    assert(factors[4] == 5594472617641ull);
+
     printf("\tSuccess...\n\n\n");
 
 
@@ -32,6 +91,160 @@ int main(void)
     {
         assert(checkIfPrime(n[i])== 1);
     }
+
+    printf("\tConfirming squares of primes, Carmichael numbers and strong pseudoprimes are not prime...\n");
+    size_t composites[] = {0, 1, 25, 49, 1369, 561, 2047, 3215031751ull, 4294967297ull,
+                           3825123056546413051ull, 18446744073709551615ull};
+    for (i = 0; i < (int)(sizeof(composites) / sizeof(composites[0])); i++)
+    {
+        assert(checkIfPrime(composites[i]) == 0);
+    }
+    assert(checkIfPrime(4294967291ull) && checkIfPrime(18446744073709551557ull));
+
+    printf("\tConfirming checkIfPrimeBatch() = checkIfPrime() on 1000 ... 1999 and near 2^64...\n");
+    size_t candidates[1100];
+    int results[1100];
+    for (i = 0; i < 1100; i++)
+    {
+        candidates[i] = i < 1000 ? 1000 + i : 18446744073709551615ull - (i - 1000);
+    }
+    checkIfPrimeBatch(candidates, results, 1100);
+    for (i = 0; i < 1100; i++)
+    {
+        assert(results[i] == checkIfPrime(candidates[i]));
+    }
+    assert(getPrevPrime(18446744073709551615ull >> 1) == 9223372036854775783ll);
+    assert(getPrevPrime(3) == 2 && getPrevPrime(2) == 0 && getPrevPrime(24) == 23);
+    printf("\tSuccess...\n\n\n");
+
+
+    printf("SEGMENTED SIEVE TEST\n");
+    printf("-------------------------\n\n\n");
+    printf("\tCounting the primes below 10^6 both ways...\n");
+    prime_iter it;
+    uint64_t p, last;
+    int count = 0;
+    prime_iter_init(&it, 0, 1);
+    for (last = 1; (p = prime_iter_next(&it)) < 1000000; last = p, count++)
+    {
+        assert(p > last);
+    }
+    prime_iter_clear(&it);
+    assert(count == 78498);
+
+    prime_iter_init(&it, 999999, -1);
+    for (last = 1000000; (p = prime_iter_next(&it)) != 0; last = p, count--)
+    {
+        assert(p < last);
+    }
+    prime_iter_clear(&it);
+    assert(count == 0);
+
+    printf("\tConfirming the gaps hold no primes near 2^40 and 2^64...\n");
+    uint64_t starts[] = {1099511627776ull, 18446744073709400000ull};
+    for (i = 0; i < 2; i++)
+    {
+        uint64_t n = starts[i];
+        prime_iter_init(&it, n, 1);
+        while ((p = prime_iter_next(&it)) != 0 && p < starts[i] + 100000)
+        {
+            for (; n < p; n++)
+            {
+                assert(!checkIfPrime(n));
+            }
+            assert(checkIfPrime(p));
+            n = p + 1;
+        }
+        prime_iter_clear(&it);
+    }
+
+    prime_iter_init(&it, 18446744073709551557ull, 1);
+    assert(prime_iter_next(&it) == 18446744073709551557ull && prime_iter_next(&it) == 0);
+    prime_iter_clear(&it);
+    prime_iter_init(&it, 1, -1);
+    assert(prime_iter_next(&it) == 0);
+    prime_iter_clear(&it);
+    printf("\tSuccess...\n\n\n");
+
+
+    printf("PRIME MAP TEST\n");
+    printf("-------------------------\n\n\n");
+    printf("\tBuilding and mapping the primes below 10^6...\n");
+    FILE *fmap = fopen("unit_testing.map", "w");
+    fputs("not a prime map", fmap);
+    fclose(fmap);
+    assert(prime_map_load("unit_testing.map") == -1);
+    assert(prime_map_build("unit_testing.map", 1000000) == 0);
+    assert(prime_map_load("unit_testing.map") == 0);
+    remove("unit_testing.map");
+    assert(prime_map_limit() == 1000064);
+
+    printf("\tConfirming the map agrees with the sieve and getPrevPrime() walks it...\n");
+    prime_iter_init(&it, 0, 1);
+    for (last = 0; (p = prime_iter_next(&it)) < 1000064; last = p)
+    {
+        for (last++; last < p; last++)
+        {
+            assert(prime_map_test(last) == 0);
+        }
+        assert(prime_map_test(p) == 1 && checkIfPrime(p));
+        assert(p == 2 || getPrevPrime(p) == (long long int)prime_map_prev(p));
+    }
+    prime_iter_clear(&it);
+    assert(prime_map_test(1000064) == -1 && prime_map_prev(1000065) == 0);
+
+    printf("\tConfirming a map with a short last segment, below 2^20 + 128...\n");
+    assert(prime_map_build("unit_testing.map", (1 << 20) + 128) == 0);
+    assert(prime_map_load("unit_testing.map") == 0);
+    remove("unit_testing.map");
+    assert(prime_map_test(1048673) == 0 && prime_map_test(1048693) == 0);
+    {
+        mpz_t mn;
+        mpz_init(mn);
+        for (last = (1 << 20) - 4095; last < (1 << 20) + 128; last += 2)
+        {
+            mpz_set_ui(mn, last);
+            assert(prime_map_test(last) == (mpz_probab_prime_p(mn, 25) != 0));
+        }
+        mpz_clear(mn);
+    }
+    assert(getPrevPrime(1000065) == 1000039 && getPrevPrime(3) == 2);
+
+    printf("\tConfirming maps with zeroed or flipped bits fail the spot check...\n");
+    {
+        unsigned char *mbuf;
+        long msize;
+        long j;
+
+        assert(prime_map_build("unit_testing.map", 1000000) == 0);
+        fmap = fopen("unit_testing.map", "rb");
+        fseek(fmap, 0, SEEK_END);
+        msize = ftell(fmap);
+        mbuf = (unsigned char*)malloc(msize);
+        rewind(fmap);
+        assert(fread(mbuf, 1, msize, fmap) == (size_t)msize);
+        fclose(fmap);
+
+        for (j = 32; j < msize; j++)
+        {
+            mbuf[j] = ~mbuf[j];
+        }
+        fmap = fopen("unit_testing.map", "wb");
+        fwrite(mbuf, 1, msize, fmap);
+        fclose(fmap);
+        assert(prime_map_load("unit_testing.map") == -1);
+
+        memset(mbuf + 32, 0, msize - 32);
+        fmap = fopen("unit_testing.map", "wb");
+        fwrite(mbuf, 1, msize, fmap);
+        fclose(fmap);
+        assert(prime_map_load("unit_testing.map") == -1);
+
+        remove("unit_testing.map");
+        free(mbuf);
+        // the map of 2^20 + 128 is still the current one
+        assert(prime_map_limit() == (1 << 20) + 128);
+    }
     printf("\tSuccess...\n\n\n");
 
 
@@ -53,27 +266,188 @@ int main(void)
 
 
 
+    // Test CRT exponentiation against a plain mpz_powm.
+
+    printf("CRT DECRYPTION TEST.\n");
+    printf("-------------------------\n\n\n");
+    printf("\tConfirming c^d mod pq through CRT for p = 61, q = 53, d = 2753...\n");
+
+    rsa_key crt_key;
+    rsa_ctx crt_ctx;
+    rsa_scratch crt_scratch;
+    mpz_t crt_d, crt_c, crt_r, crt_s;
+    mpz_inits(crt_d, crt_c, crt_r, crt_s, NULL);
+    rsa_key_init(&crt_key);
+    mpz_set_ui(crt_key.p, 61);
+    mpz_set_ui(crt_key.q, 53);
+    mpz_mul(crt_key.n, crt_key.p, crt_key.q);
+    mpz_set_ui(crt_d, 2753);
+    mpz_set(crt_key.exp, crt_d);
+    mpz_set_ui(crt_key.dp, 2753 % 60);
+    mpz_set_ui(crt_key.dq, 2753 % 52);
+    mpz_invert(crt_key.qinv, crt_key.q, crt_key.p);
+    crt_key.crt = 1;
+
+    assert(rsa_ctx_init(&crt_ctx, &crt_key, 1) == 0 && crt_ctx.crt);
+    rsa_scratch_init(&crt_scratch, &crt_ctx);
+    for (i = 0; i < 3233; i += 7)
+    {
+        mpz_set_ui(crt_c, i);
+        rsa_powm(crt_r, crt_c, &crt_ctx, &crt_scratch);
+        mpz_powm(crt_s, crt_c, crt_d, crt_key.n);
+        assert(mpz_cmp(crt_r, crt_s) == 0);
+    }
+    rsa_scratch_clear(&crt_scratch, &crt_ctx);
+    rsa_ctx_clear(&crt_ctx);
+    rsa_key_clear(&crt_key);
+    mpz_clears(crt_d, crt_c, crt_r, crt_s, NULL);
+
+    printf("\tSuccess.\n\n");
+
+
+
+    // Test Montgomery constants of a modulus.
+
+    printf("MONTGOMERY CONSTANTS TEST.\n");
+    printf("-------------------------\n\n\n");
+    printf("\tConfirming m * ninv = -1 mod 2^64 and rr = R^2 mod m for m = 61 * 53 * 2^100 + 1...\n");
+
+    mpz_t mont_m, mont_rr, mont_check;
+    mp_limb_t mont_ninv;
+    mpz_inits(mont_m, mont_rr, mont_check, NULL);
+    mpz_set_ui(mont_m, 3233);
+    mpz_mul_2exp(mont_m, mont_m, 100);
+    mpz_add_ui(mont_m, mont_m, 1);
+
+    montgomery_constants(mont_rr, &mont_ninv, mont_m);
+    assert((mp_limb_t)(mpz_getlimbn(mont_m, 0) * mont_ninv) == (mp_limb_t)-1);
+
+    mpz_set_ui(mont_check, 1);
+    mpz_mul_2exp(mont_check, mont_check, 2 * GMP_NUMB_BITS * mpz_size(mont_m));
+    mpz_mod(mont_check, mont_check, mont_m);
+    assert(mpz_cmp(mont_check, mont_rr) == 0);
+    mpz_clears(mont_m, mont_rr, mont_check, NULL);
+
+    printf("\tSuccess.\n\n");
+
+
+
+    // Test the fixed base Montgomery exponentiation against mpz_powm.
+
+    printf("MONTGOMERY EXPONENTIATION TEST.\n");
+    printf("-------------------------\n\n\n");
+
+    gmp_randstate_t mont_st;
+    gmp_randinit_default(mont_st);
+    mpz_t mp_m, mp_e, mp_b, mp_r, mp_s;
+    mpz_inits(mp_m, mp_e, mp_b, mp_r, mp_s, NULL);
+
+    printf("\tConfirming mont_comb_powm = mpz_powm, from built and from mapped tables...\n");
+    for (i = 0; i < 60; i++)
+    {
+        mont_comb comb, mapped, other;
+        mont_scratch scratch;
+        int j;
+
+        mpz_urandomb(mp_m, mont_st, 2 + i * 23);
+        mpz_setbit(mp_m, 0);
+        mpz_setbit(mp_m, 1 + i * 23);
+        mpz_urandomb(mp_b, mont_st, 2 * (2 + i * 23));
+
+        mont_comb_init(&comb, mp_b, mp_m, 2 + i * 23);
+        assert(mont_comb_write(&comb, "unit_testing.comb") == 0);
+        assert(mont_comb_load(&mapped, mp_b, mp_m, 2 + i * 23, "unit_testing.comb") == 0);
+        mpz_add_ui(mp_e, mp_b, 1);
+        assert(mont_comb_load(&other, mp_e, mp_m, 2 + i * 23, "unit_testing.comb") == -1);
+        assert(mont_comb_load(&other, mp_b, mp_m, mont_comb_bits(&comb) + 1, "unit_testing.comb") == -1);
+        mont_scratch_init(&scratch, &comb.ctx);
+
+        // zero, short and full size exponents
+        for (j = 0; j <= 4; j++)
+        {
+            mpz_urandomb(mp_e, mont_st, j * (2 + i * 23) / 4);
+            mont_comb_powm(mp_r, mp_e, j % 2 ? &comb : &mapped, &scratch);
+            mpz_powm(mp_s, mp_b, mp_e, mp_m);
+            assert(mpz_cmp(mp_r, mp_s) == 0);
+        }
+
+        mont_scratch_clear(&scratch);
+        mont_comb_clear(&comb);
+        mont_comb_clear(&mapped);
+    }
+
+    printf("\tConfirming a table file with a flipped bit fails its checksum...\n");
+    {
+        mont_comb comb, mapped;
+        unsigned char last;
+
+        mont_comb_init(&comb, mp_b, mp_m, 256);
+        assert(mont_comb_write(&comb, "unit_testing.comb") == 0);
+        FILE *fcomb = fopen("unit_testing.comb", "r+b");
+        fseek(fcomb, -1, SEEK_END);
+        last = fgetc(fcomb) ^ 0x10;
+        fseek(fcomb, -1, SEEK_END);
+        fputc(last, fcomb);
+        fclose(fcomb);
+        assert(mont_comb_load(&mapped, mp_b, mp_m, 256, "unit_testing.comb") == -1);
+        mont_comb_clear(&comb);
+    }
+    remove("unit_testing.comb");
+
+    mpz_clears(mp_m, mp_e, mp_b, mp_r, mp_s, NULL);
+    gmp_randclear(mont_st);
+
+    printf("\tSuccess.\n\n");
+
+
+
     printf("LARGE PRIME TEST\n");
     printf("-------------------------\n\n\n\t");
 
     mpz_t prime;
     mpz_init(prime);
-    mpz_set_ui(prime, 0);
     
-    printf("\n\tLarge odd 100 digit number:\n\t");
-    large_prime_generator(prime, 100);
+    printf("\n\tRandom 332 bit prime:\n\t");
+    assert(large_prime_generator(prime, 332) == 0);
     
     mpz_out_str(stdout, 10, prime);
+    assert(mpz_sizeinbase(prime, 2) == 332);
+    assert(mpz_probab_prime_p(prime, 25));
 
     printf("\n\t");
     mpz_t prime2;
     mpz_init(prime2);
-    mpz_set_ui(prime2, 0);
 
-    printf("\n\tLarge odd 80 digit number:\n\t");
-    large_prime_generator(prime2, 80);
+    printf("\n\tRandom 266 bit prime:\n\t");
+    assert(large_prime_generator(prime2, 266) == 0);
     
     mpz_out_str(stdout, 10, prime2);
+    assert(mpz_sizeinbase(prime2, 2) == 266);
+    assert(mpz_probab_prime_p(prime2, 25));
+
+    printf("\n\tRandom 8 bit primes...\n\t");
+    for (i = 0; i < 50; i++)
+    {
+        assert(large_prime_generator(prime2, 8) == 0);
+        assert(mpz_sizeinbase(prime2, 2) == 8);
+        assert(checkIfPrime(mpz_get_ui(prime2)));
+    }
+    printf("Success.\n");
+
+    printf("\n\tRandom bits of /dev/urandom stay below 2^bits and differ...\n\t");
+    for (i = 1; i < 300; i += 13)
+    {
+        assert(random_bits(prime, i) == 0 && mpz_sizeinbase(prime, 2) <= (size_t)i);
+    }
+    assert(random_bits(prime, 256) == 0 && random_bits(prime2, 256) == 0 && mpz_cmp(prime, prime2) != 0);
+    printf("Success.\n");
+
+    printf("\n\tParallel search of two distinct 64 bit primes on 3 threads...\n\t");
+    assert(parallel_primes(prime, prime2, 64, 64, 3, NULL, NULL) == 0);
+    assert(mpz_sizeinbase(prime, 2) == 64 && mpz_sizeinbase(prime2, 2) == 64);
+    assert(mpz_probab_prime_p(prime, 25) && mpz_probab_prime_p(prime2, 25));
+    assert(mpz_cmp(prime, prime2) != 0);
+    printf("Success.\n");
 
 
     mpz_clear(prime);
@@ -136,13 +510,671 @@ int main(void)
     printf("\n\nTESTING LAMBDA FUNCTION...\n");
     printf("-------------------------\n\n\n\t");
 
+    mpz_t lp, lq, lambda, le, ld, lcheck;
+    mpz_inits(lp, lq, lambda, le, ld, lcheck, NULL);
+
+    printf("Confirming lambda(61 * 53) = lcm(60, 52) = 780...\n\t");
+    mpz_set_ui(lp, 61);
+    mpz_set_ui(lq, 53);
+    lambda_euler_function(lambda, lp, lq);
+    assert(mpz_cmp_ui(lambda, 780) == 0);
+    printf("Success.\n");
+
 
     printf("\n\nTESTING e generation...\n");
     printf("-------------------------\n\n\n\t");
 
+    unsigned long exponent = 65537;
+
+    printf("Confirming that primes with p = 1 mod 65537 are refused...\n\t");
+    mpz_set_ui(lp, 917519);     // 14 * 65537 + 1
+    assert(checkIfPrime(917519));
+    assert(!coprime_to_exponent(lp, &exponent));
+    assert(coprime_to_exponent(lq, &exponent));
+    printf("Success.\n");
+
     printf("\n\nTESTING d calculation...\n");
     printf("-------------------------\n\n\n\t");
 
+    printf("Confirming e * d = 1 mod lambda for e = 65537 on a 512 bit key...\n\t");
+    assert(parallel_primes(lp, lq, 256, 256, 2, coprime_to_exponent, &exponent) == 0);
+    lambda_euler_function(lambda, lp, lq);
+    mpz_set_ui(le, exponent);
+    assert(mpz_invert(ld, le, lambda));
+    mpz_mul(lcheck, le, ld);
+    mpz_mod(lcheck, lcheck, lambda);
+    assert(mpz_cmp_ui(lcheck, 1) == 0);
+    printf("Success.\n");
+
+    mpz_clears(lp, lq, lambda, le, ld, lcheck, NULL);
+
+
+
+
+    printf("DIFFIE-HELLMAN TEST\n");
+    printf("-------------------------\n\n\n\t");
+
+    printf("Confirming A = 8, B = 19, s = 2 for p = 23, g = 5, a = 6, b = 15...\n\t");
+    mpz_t dp, dg, da, db, dA, dB, ds1, ds2, dq;
+    mpz_inits(dp, dg, da, db, dA, dB, ds1, ds2, dq, NULL);
+    mpz_set_ui(dp, 23);
+    mpz_set_ui(dg, 5);
+    mpz_set_ui(da, 6);
+    mpz_set_ui(db, 15);
+    assert(dh_check_params(dp, dg) == 0);
+    dh_public_key(dA, dg, da, dp);
+    dh_public_key(dB, dg, db, dp);
+    dh_shared_secret(ds1, dB, da, dp);
+    dh_shared_secret(ds2, dA, db, dp);
+    assert(mpz_cmp_ui(dA, 8) == 0 && mpz_cmp_ui(dB, 19) == 0);
+    assert(mpz_cmp_ui(ds1, 2) == 0 && mpz_cmp_ui(ds2, 2) == 0);
+    mpz_set_ui(dg, 2);
+    assert(dh_check_params(dp, dg) == DH_ERR_GENERATOR);
+    printf("Success.\n\t");
+
+    printf("Confirming p beyond 64 bits must be a safe prime and 1 < g < p - 1...\n\t");
+    mpz_setbit(dp, 80);
+    do
+    {
+        // a prime with (p - 1) / 2 composite
+        mpz_nextprime(dp, dp);
+        mpz_sub_ui(dq, dp, 1);
+        mpz_tdiv_q_2exp(dq, dq, 1);
+    }
+    while (mpz_probab_prime_p(dq, 25));
+    assert(dh_check_params(dp, dg) == DH_ERR_PRIME);
+    dh_group_set(dp, dg, "modp1536");
+    assert(dh_check_params(dp, dg) == 0);
+    mpz_sub_ui(dg, dp, 1);
+    assert(dh_check_params(dp, dg) == DH_ERR_GENERATOR);
+    printf("Success.\n\t");
+
+    printf("Confirming the RFC 3526 groups are safe primes of their size...\n\t");
+    for (i = 0; i < dh_group_count; i++)
+    {
+        assert(dh_group_set(dp, dg, dh_groups[i].name) == 0);
+        assert(mpz_sizeinbase(dp, 2) == (size_t)dh_groups[i].bits);
+        if (dh_groups[i].bits <= 3072)
+        {
+            mpz_sub_ui(dq, dp, 1);
+            mpz_divexact_ui(dq, dq, 2);
+            assert(mpz_probab_prime_p(dp, 2) && mpz_probab_prime_p(dq, 2));
+        }
+    }
+    assert(dh_group_set(dp, dg, "modp1024") == DH_ERR_GROUP);
+    printf("Success.\n\t");
+
+    printf("Confirming cached checks of modp2048 and p = 23 give the uncached results and store them once...\n\t");
+    struct stat cache_st;
+    off_t cache_size = 0;
+    remove("unit_testing.cache");
+    for (i = 0; i < 3; i++)
+    {
+        dh_group_set(dp, dg, "modp2048");
+        assert(dh_check_params_cached(dp, dg, "unit_testing.cache") == 0);
+        mpz_set_ui(dp, 23);
+        mpz_set_ui(dg, 5);
+        assert(dh_check_params_cached(dp, dg, "unit_testing.cache") == 0);
+        mpz_set_ui(dg, 2);
+        assert(dh_check_params_cached(dp, dg, "unit_testing.cache") == DH_ERR_GENERATOR);
+        mpz_set_ui(dp, 21);
+        assert(dh_check_params_cached(dp, dg, "unit_testing.cache") == DH_ERR_PRIME);
+
+        assert(stat("unit_testing.cache", &cache_st) == 0);
+        assert(i == 0 || cache_st.st_size == cache_size);
+        cache_size = cache_st.st_size;
+    }
+
+    // a record cut short by a crash is dropped by the next append
+    FILE *fc = fopen("unit_testing.cache", "a");
+    fputs("torn", fc);
+    fclose(fc);
+    mpz_set_ui(dp, 1000003);
+    assert(dh_check_params_cached(dp, dg, "unit_testing.cache") == 0);
+    assert(dh_check_params_cached(dp, dg, "unit_testing.cache") == 0);
+    mpz_set_ui(dp, 23);
+    assert(dh_check_params_cached(dp, dg, "unit_testing.cache") == DH_ERR_GENERATOR);
+    assert(stat("unit_testing.cache", &cache_st) == 0 && cache_st.st_size == cache_size + 32);
+    assert((cache_st.st_mode & 0777) == 0600);
+
+    // a verdict out of range in the first record, modp2048, is a miss
+    int32_t bad_verdict = 5;
+    fc = fopen("unit_testing.cache", "r+b");
+    fseek(fc, 8 + 16, SEEK_SET);
+    fwrite(&bad_verdict, 4, 1, fc);
+    fclose(fc);
+    dh_group_set(dp, dg, "modp2048");
+    assert(dh_check_params_cached(dp, dg, "unit_testing.cache") == 0);
+    remove("unit_testing.cache");
+    printf("Success.\n\t");
+
+    printf("Confirming both sides agree on modp2048 with random 2048 bit secrets...\n\t");
+    gmp_randstate_t dst;
+    gmp_randinit_default(dst);
+    dh_group_set(dp, dg, "modp2048");
+    mpz_urandomm(da, dst, dp);
+    mpz_urandomm(db, dst, dp);
+    dh_public_key(dA, dg, da, dp);
+    dh_public_key(dB, dg, db, dp);
+    dh_shared_secret(ds1, dB, da, dp);
+    dh_shared_secret(ds2, dA, db, dp);
+    assert(mpz_cmp(ds1, ds2) == 0);
+    printf("Success.\n\t");
+
+    printf("Confirming the same exchange through a fixed base table of g, built then mapped...\n\t");
+    remove("unit_testing.table");
+    for (i = 0; i < 2; i++)
+    {
+        assert(dh_fixed_base(dg, dp, "unit_testing.table") == 0);
+        assert(dh_exchange(dq, ds2, ds1, dg, da, db, dp) == 0);
+        assert(mpz_cmp(dq, dA) == 0 && mpz_cmp(ds2, dB) == 0);
+        dh_shared_secret(ds2, dA, db, dp);
+        assert(mpz_cmp(ds1, ds2) == 0);
+    }
+    dh_fixed_base_clear();
+    remove("unit_testing.table");
+    printf("Success.\n\t");
+
+    printf("Confirming generated private keys stay in range, full size and short...\n\t");
+    assert(dh_exponent_bits(dp) == 256);
+    for (i = 0; i < 20; i++)
+    {
+        assert(dh_private_key(da, dp, 256) == 0 && dh_private_key(db, dp, 256) == 0);
+        assert(mpz_sizeinbase(da, 2) <= 256 && mpz_cmp_ui(da, 2) >= 0 && mpz_cmp(da, db) != 0);
+        assert(dh_private_key(da, dp, 0) == 0 && mpz_cmp(da, dp) < 0 && mpz_sizeinbase(da, 2) > 256);
+    }
+    assert(dh_exchange(dA, dB, ds1, dg, da, db, dp) == 0);
+
+    mpz_set_ui(dp, 23);
+    int seen = 0;
+    for (i = 0; i < 500; i++)
+    {
+        assert(dh_private_key(da, dp, 0) == 0);
+        assert(mpz_cmp_ui(da, 2) >= 0 && mpz_cmp_ui(da, 21) <= 0);
+        seen |= 1 << mpz_get_ui(da);
+    }
+    assert(seen == 0x3FFFFC);
+    mpz_set_ui(dp, 3);
+    assert(dh_private_key(da, dp, 0) == DH_ERR_PRIME);
+    printf("Success.\n\t");
+
+
+    printf("Confirming the 64 bit Montgomery paths = mpz_powm on random odd moduli up to 2^64...\n\t");
+    for (i = 0; i < 2000; i++)
+    {
+        mpz_urandomb(dp, dst, 2 + i % 63);
+        mpz_setbit(dp, 0);
+        mpz_setbit(dp, 1 + i % 63);
+        mpz_urandomb(dg, dst, 64);
+        mpz_urandomb(da, dst, i % 65);
+
+        dh_public_key(dA, dg, da, dp);
+        mpz_powm(dB, dg, da, dp);
+        assert(mpz_cmp(dA, dB) == 0);
+        assert(mpz_get_ui(dB) == powm_u64(mpz_get_ui(dg), mpz_get_ui(da), mpz_get_ui(dp)));
+
+        // interleaved exchange against plain exponentiations.
+        mpz_urandomm(db, dst, dp);
+        assert(dh_exchange(dA, dB, ds1, dg, da, db, dp) == 0);
+        mpz_powm(ds2, dg, da, dp);
+        assert(mpz_cmp(dA, ds2) == 0);
+        mpz_powm(ds2, dg, db, dp);
+        assert(mpz_cmp(dB, ds2) == 0);
+        mpz_powm(ds2, dg, da, dp);
+        mpz_powm(ds2, ds2, db, dp);
+        assert(mpz_cmp(ds1, ds2) == 0);
+    }
+    printf("Success.\n");
+
+    gmp_randclear(dst);
+    mpz_clears(dp, dg, da, db, dA, dB, ds1, ds2, dq, NULL);
+
+
+    printf("Confirming dh_batch keeps the input order on 3 threads and reports bad rows...\n\t");
+    {
+        FILE *in = tmpfile();
+        FILE *out = tmpfile();
+        dh_batch_stats stats;
+        char line[4096];
+
+        assert(in != NULL && out != NULL);
+        fprintf(in, "# comment\n\n");
+        for (i = 0; i < 200; i++)
+        {
+            fprintf(in, "23,5,%d,%d\n", 1 + i % 21, 1 + (i * 7) % 21);
+        }
+        fprintf(in, "24,5,6,15\nmodp2048,1,\n23,5,23,1\n");
+        rewind(in);
+
+        assert(dh_batch(in, out, 3, 0, NULL, &stats) == 0);
+        assert(stats.rows == 203 && stats.failed == 2);
+
+        rewind(out);
+        for (i = 0; i < 200; i++)
+        {
+            unsigned long A, B, s;
+            unsigned long ea = 1 + i % 21, eb = 1 + (i * 7) % 21;
+
+            assert(fgets(line, sizeof(line), out) != NULL);
+            assert(sscanf(line, "<%lu>,<%lu>,<%lu>", &A, &B, &s) == 3);
+            assert(A == powm_u64(5, ea, 23) && B == powm_u64(5, eb, 23) && s == powm_u64(5, ea * eb, 23));
+        }
+        assert(fgets(line, sizeof(line), out) != NULL && strcmp(line, "# line 203: p is not a prime, or beyond 64 bits not a safe prime\n") == 0);
+        assert(fgets(line, sizeof(line), out) != NULL && line[0] == '<');
+        assert(fgets(line, sizeof(line), out) != NULL && strncmp(line, "# line 205:", 11) == 0);
+        assert(fgets(line, sizeof(line), out) == NULL);
+
+        fclose(in);
+        fclose(out);
+    }
+    printf("Success.\n");
+
+
+    printf("Confirming both halves of an exchange agree, and a handshake server on a Unix socket...\n\t");
+    {
+        const char *groups[] = {"modp1536", DH_X25519};
+        mpz_t ha, hA, hB, hs1, hs2;
+        char request[DHNET_LINE], answer[DHNET_LINE];
+        serve_test server;
+        pthread_t thread;
+
+        mpz_inits(ha, hA, hB, hs1, hs2, NULL);
+
+        for (i = 0; i < 2; i++)
+        {
+            assert(dh_initiate(ha, hA, groups[i], -1) == 0);
+            assert(dh_respond(hB, hs1, hA, groups[i], -1) == 0);
+            assert(dh_finish(hs2, hB, ha, groups[i]) == 0 && mpz_cmp(hs1, hs2) == 0);
+        }
+        mpz_set_ui(hA, 1);
+        assert(dh_respond(hB, hs1, hA, "modp1536", -1) == DH_ERR_PUBLIC);
+        assert(dh_initiate(ha, hA, "modp1", -1) == DH_ERR_GROUP);
+
+        server.fd = dhnet_listen("./unit_testing.sock");
+        assert(server.fd >= 0);
+        atomic_init(&server.stop, 0);
+        assert(pthread_create(&thread, NULL, serve_thread, &server) == 0);
+
+        int fd = dhnet_connect("./unit_testing.sock");
+        assert(fd >= 0);
+        for (i = 0; i < 4; i++)
+        {
+            assert(dh_initiate(ha, hA, groups[i % 2], -1) == 0);
+            gmp_snprintf(request, DHNET_LINE, "%s,%Zx\n", groups[i % 2], hA);
+            assert(dhnet_request(fd, request, answer, DHNET_LINE) == 0);
+            assert(mpz_set_str(hB, answer, 16) == 0);
+            assert(dh_finish(hs2, hB, ha, groups[i % 2]) == 0);
+        }
+        assert(dhnet_request(fd, "modp1536,1\n", answer, DHNET_LINE) == 0 && strncmp(answer, "error", 5) == 0);
+        assert(dhnet_request(fd, "garbage\n", answer, DHNET_LINE) == 0 && strncmp(answer, "error", 5) == 0);
+        close(fd);
+
+        atomic_store(&server.stop, 1);
+        pthread_join(thread, NULL);
+        close(server.fd);
+        unlink("./unit_testing.sock");
+        assert(server.stats.handshakes == 4 && server.stats.errors == 2 && server.stats.connections == 1);
+
+        mpz_clears(ha, hA, hB, hs1, hs2, NULL);
+    }
+    printf("Success.\n");
+
+
+    printf("Confirming tree based group DH: one key for every member, g^(g^(r0 r1) r2) for 3...\n\t");
+    {
+        mpz_t tp, tg, tk, te;
+        tgdh_tree tree;
+        int members;
+
+        mpz_inits(tp, tg, tk, te, NULL);
+        mpz_set_str(tp, "18446744073709551557", 10);
+        mpz_set_ui(tg, 2);
+
+        tgdh_init(&tree, 3, tp, tg);
+        assert(tree.height == 2 && tree.nodes[0].count == 3 && tree.nodes[tree.nodes[0].left].count == 2);
+        assert(tgdh_run(&tree, tk, 2, 0) == 0);
+        mpz_mul(te, tree.nodes[tree.leaf[0]].key, tree.nodes[tree.leaf[1]].key);
+        mpz_powm(te, tg, te, tp);
+        mpz_mul(te, te, tree.nodes[tree.leaf[2]].key);
+        mpz_powm(te, tg, te, tp);
+        assert(mpz_cmp(tk, te) == 0);
+        tgdh_clear(&tree);
+
+        for (members = 2; members <= 40; members += 7)
+        {
+            tgdh_init(&tree, members, tp, tg);
+            assert(tgdh_run(&tree, tk, 3, 0) == 0);
+            for (i = 0; i < members; i++)
+            {
+                // a path step per level, plus the leaf, plus two per node sponsored
+                assert(tree.cost[i].exps >= 2 && tree.cost[i].exps <= 1 + 2 * (unsigned long)tree.height);
+            }
+            assert(tree.broadcasts == 2 * (unsigned long)members - 2);
+            tgdh_clear(&tree);
+        }
+
+        dh_group_set(tp, tg, "modp1536");
+        tgdh_init(&tree, 6, tp, tg);
+        assert(tgdh_run(&tree, tk, 2, -1) == 0 && mpz_sizeinbase(tk, 2) > 1400);
+        tgdh_clear(&tree);
+
+        mpz_clears(tp, tg, tk, te, NULL);
+    }
+    printf("Success.\n");
+
+
+    // Test X25519 against the vectors of RFC 7748.
+    printf("X25519 TEST\n");
+    {
+        const char *vectors[][3] =
+        {
+            {"a546e36bf0527c9d3b16154b82465edd62144c0ac1fc5a18506a2244ba449ac4",
+             "e6db6867583030db3594c1a424b15f7c726624ec26b3353b10a903a6d0ab1c4c",
+             "c3da55379de9c6908e94ea4df28d084f32eccf03491c71f754b4075577a28552"},
+            {"4b66e9d4d1b4673c5ad22691957d6af5c11b6421e0ea01d42ca4169e7918ba0d",
+             "e5210f12786811d3f4b7959d0538ae2c31dbe7106fc03c3efc4cd549c715a493",
+             "95cbde9476e8907d7aade45cb4b873f88b595a68799fa152e6f8f7647aac7957"},
+        };
+        uint8_t k[X25519_BYTES], u[X25519_BYTES], r[X25519_BYTES], out[X25519_BYTES];
+        int j;
+
+        for (i = 0; i < 2; i++)
+        {
+            for (j = 0; j < X25519_BYTES; j++)
+            {
+                sscanf(vectors[i][0] + 2 * j, "%2hhx", &k[j]);
+                sscanf(vectors[i][1] + 2 * j, "%2hhx", &u[j]);
+                sscanf(vectors[i][2] + 2 * j, "%2hhx", &r[j]);
+            }
+            assert(x25519(out, k, u) == 0 && memcmp(out, r, X25519_BYTES) == 0);
+        }
+
+        // iterated: k, u = X25519(k, u), k from 9, 1000 times.
+        const char *iterated = "684cf59ba83309552800ef566f2f4d3c1c3887c49360e3875f2eb94d99532c51";
+        memset(k, 0, X25519_BYTES);
+        k[0] = 9;
+        memcpy(u, k, X25519_BYTES);
+        for (i = 0; i < 1000; i++)
+        {
+            x25519(out, k, u);
+            memcpy(u, k, X25519_BYTES);
+            memcpy(k, out, X25519_BYTES);
+        }
+        for (j = 0; j < X25519_BYTES; j++)
+        {
+            sscanf(iterated + 2 * j, "%2hhx", &r[j]);
+        }
+        assert(memcmp(k, r, X25519_BYTES) == 0);
+
+        // u = 0 is of small order: the secret is all zero.
+        memset(u, 0, X25519_BYTES);
+        assert(x25519(out, k, u) == -1);
+    }
+
+    printf("Confirming the x25519 exchange of RFC 7748 section 6.1 as integers...\n\t");
+    {
+        mpz_t xa, xb, xA, xB, xs, xe;
+        mpz_inits(xa, xb, xA, xB, xs, xe, NULL);
+
+        // little endian strings 77076d0a... and 5dab087e... of the RFC, as integers.
+        mpz_set_str(xa, "2a2cb91da5fb77b12a99c0eb872f4cdf4566b25172c1163c7da518730a6d0777", 16);
+        mpz_set_str(xb, "ebe088ff278b2f1cfdb6182629b13b6fe60e80838b7fe1794b8a4a627e08ab5d", 16);
+        assert(dh_x25519_exchange(xA, xB, xs, xa, xb) == 0);
+        mpz_set_str(xe, "6a4e9baa8ea9a4ebf41a38260d3abf0d5af73eb4dc7d8b7454a7308909f02085", 16);
+        assert(mpz_cmp(xA, xe) == 0);
+        mpz_set_str(xe, "4217161e3c9bf076339ed147c9217ee0250f3580f43b8e72e12dcea45b9d5d4a", 16);
+        assert(mpz_cmp(xs, xe) == 0);
+
+        for (i = 0; i < 20; i++)
+        {
+            assert(dh_x25519_private_key(xa) == 0 && dh_x25519_private_key(xb) == 0);
+            assert(mpz_sizeinbase(xa, 2) <= 256 && mpz_cmp(xa, xb) != 0);
+            assert(dh_x25519_exchange(xA, xB, xs, xa, xb) == 0);
+        }
+
+        mpz_clears(xa, xb, xA, xB, xs, xe, NULL);
+    }
+    printf("Success.\n");
+
+
+
+    printf("\n\nTESTING THE CIPHER STREAM...\n");
+    printf("-------------------------\n\n\n\t");
+
+    printf("Confirming encryption to a pipe, frames across chunks and failed writes...\n\t");
+    {
+        rsa_key spub, spriv;
+        rsa_ctx senc, sdec;
+        uint64_t length;
+        size_t b, size = 300000;
+        int fds[2];
+
+        rsa_key_init(&spub);
+        rsa_key_init(&spriv);
+        assert(rsa_keygen(&spub, &spriv, 1024, 1, 0) == 0);
+        assert(rsa_ctx_init(&senc, &spub, 0) == 0 && rsa_ctx_init(&sdec, &spriv, 1) == 0);
+
+        FILE *plain = tmpfile();
+        FILE *cipher = tmpfile();
+        FILE *out = tmpfile();
+
+        for (b = 0; b < size; b++)
+        {
+            fputc((int)(b * 61 + 7), plain);
+        }
+
+        // a pipe can not be rewound: the cipher must still decrypt.
+        assert(pipe(fds) == 0);
+        FILE *wp = fdopen(fds[1], "wb");
+        FILE *rp = fdopen(fds[0], "rb");
+        rewind(plain);
+        FILE *small = tmpfile();
+        for (b = 0; b < 1000; b++)
+        {
+            fputc(fgetc(plain), small);
+        }
+        rewind(small);
+        assert(encrypt(small, wp, &senc, 1, &length) == 0 && length == 1000);
+        fclose(wp);
+        assert(decrypt(rp, out, &sdec, 1, &length) == 0 && length == 1000);
+        fclose(rp);
+        fclose(small);
+
+        // several frames, deciphered with another number of workers.
+        rewind(plain);
+        rewind(out);
+        assert(encrypt(plain, cipher, &senc, 1, &length) == 0 && length == size);
+        rewind(cipher);
+        assert(decrypt(cipher, out, &sdec, 3, &length) == 0 && length == size);
+        rewind(plain);
+        rewind(out);
+        for (b = 0; b < size; b++)
+        {
+            assert(fgetc(plain) == fgetc(out));
+        }
+
+        // a cipher cut inside a frame
+        rewind(cipher);
+        FILE *cut = tmpfile();
+        for (b = 0; b < 1000; b++)
+        {
+            fputc(fgetc(cipher), cut);
+        }
+        rewind(cut);
+        assert(decrypt(cut, out, &sdec, 1, &length) == RSA_ERR_CIPHER);
+        fclose(cut);
+
+        FILE *full = fopen("/dev/full", "wb");
+        if (full != NULL)
+        {
+            rewind(plain);
+            assert(encrypt(plain, full, &senc, 1, &length) == RSA_ERR_FILE);
+            fclose(full);
+        }
+
+        fclose(plain);
+        fclose(cipher);
+        fclose(out);
+        rsa_ctx_clear(&senc);
+        rsa_ctx_clear(&sdec);
+        rsa_key_clear(&spub);
+        rsa_key_clear(&spriv);
+    }
+    printf("Success.\n");
+
+
+
+    printf("\n\nTESTING CORRUPTED KEY FILES...\n");
+    printf("-------------------------\n\n\n\t");
+
+    printf("Confirming binary keys with bad or missing fields are rejected...\n\t");
+    {
+        rsa_key kpub, kpriv, kread;
+        unsigned char kbuf[4096];
+        size_t ksize, kpos;
+        uint32_t f;
+
+        rsa_key_init(&kpub);
+        rsa_key_init(&kpriv);
+        assert(rsa_keygen(&kpub, &kpriv, 1024, 1, 0) == 0);
+
+        assert(write_binary_key("unit_testing.key", &kpriv, 1) == 0);
+        rsa_key_init(&kread);
+        assert(read_key("unit_testing.key", &kread) == 0 && kread.crt);
+        rsa_key_clear(&kread);
+
+        // CRT primes that do not multiply to n
+        mpz_add_ui(kpriv.p, kpriv.p, 2);
+        assert(write_binary_key("unit_testing.key", &kpriv, 1) == 0);
+        rsa_key_init(&kread);
+        assert(read_key("unit_testing.key", &kread) == RSA_ERR_FILE);
+        rsa_key_clear(&kread);
+        mpz_sub_ui(kpriv.p, kpriv.p, 2);
+
+        // every tag renamed in turn: a missing field fails under its flag
+        assert(write_binary_key("unit_testing.key", &kpriv, 1) == 0);
+        FILE *fk = fopen("unit_testing.key", "rb");
+        ksize = fread(kbuf, 1, sizeof(kbuf), fk);
+        fclose(fk);
+        for (f = 0, kpos = 16; kpos + 8 <= ksize; f++)
+        {
+            size_t len = ((size_t)kbuf[kpos + 4] << 24) | (kbuf[kpos + 5] << 16) | (kbuf[kpos + 6] << 8) | kbuf[kpos + 7];
+            unsigned char tag = kbuf[kpos + 3];
+
+            kbuf[kpos + 3] = 99;
+            fk = fopen("unit_testing.key", "wb");
+            fwrite(kbuf, 1, ksize, fk);
+            fclose(fk);
+            rsa_key_init(&kread);
+            assert(read_key("unit_testing.key", &kread) == RSA_ERR_FILE);
+            rsa_key_clear(&kread);
+            kbuf[kpos + 3] = tag;
+
+            kpos += 8 + len;
+        }
+        assert(f == 7);
+
+        // bit length of the header that is not the one of n
+        kbuf[11] ^= 1;
+        fk = fopen("unit_testing.key", "wb");
+        fwrite(kbuf, 1, ksize, fk);
+        fclose(fk);
+        rsa_key_init(&kread);
+        assert(read_key("unit_testing.key", &kread) == RSA_ERR_FILE);
+        rsa_key_clear(&kread);
+        kbuf[11] ^= 1;
+
+        // cut inside the last field
+        fk = fopen("unit_testing.key", "wb");
+        fwrite(kbuf, 1, ksize - 3, fk);
+        fclose(fk);
+        rsa_key_init(&kread);
+        assert(read_key("unit_testing.key", &kread) == RSA_ERR_FILE);
+        rsa_key_clear(&kread);
+
+        remove("unit_testing.key");
+        rsa_key_clear(&kpub);
+        rsa_key_clear(&kpriv);
+    }
+    printf("Success.\n");
+
+
+
+    printf("\n\nTESTING THE SCRATCH ARENA...\n");
+    printf("-------------------------\n\n\n\t");
+
+    printf("Confirming freed GMP blocks are reused without the heap...\n\t");
+    {
+        arena_counts before, after;
+        mpz_t at;
+
+        mpz_init2(at, 4096);
+        mpz_clear(at);
+        arena_get_counts(&before);
+        for (i = 0; i < 100; i++)
+        {
+            mpz_init2(at, 4096);
+            mpz_setbit(at, 4000);
+            mpz_clear(at);
+        }
+        arena_get_counts(&after);
+        assert(after.requests - before.requests >= 100);
+        assert(after.heap == before.heap);
+    }
+    printf("Success.\n");
+
+    printf("Confirming encrypt and decrypt make no heap allocation per block...\n\t");
+    {
+        rsa_key apub, apriv;
+        rsa_ctx aenc, adec;
+        arena_counts c0, c1, c2;
+        unsigned long long heap[2][2];
+        size_t sizes[] = {1, 64 << 10};
+        int n;
+
+        rsa_key_init(&apub);
+        rsa_key_init(&apriv);
+        assert(rsa_keygen(&apub, &apriv, 1024, 1, 0) == 0);
+        assert(rsa_ctx_init(&aenc, &apub, 0) == 0 && rsa_ctx_init(&adec, &apriv, 1) == 0);
+
+        // one block against a thousand: the counts of the two runs must be the same.
+        for (n = 0; n < 2; n++)
+        {
+            FILE *plain = tmpfile();
+            FILE *cipher = tmpfile();
+            FILE *out = tmpfile();
+            uint64_t length;
+            size_t b;
+
+            for (b = 0; b < sizes[n]; b++)
+            {
+                fputc((int)(b * 131), plain);
+            }
+            rewind(plain);
+
+            arena_get_counts(&c0);
+            assert(encrypt(plain, cipher, &aenc, 1, &length) == 0 && length == sizes[n]);
+            arena_get_counts(&c1);
+            rewind(cipher);
+            assert(decrypt(cipher, out, &adec, 1, &length) == 0 && length == sizes[n]);
+            arena_get_counts(&c2);
+
+            heap[n][0] = c1.heap - c0.heap;
+            heap[n][1] = c2.heap - c1.heap;
+
+            fclose(plain);
+            fclose(cipher);
+            fclose(out);
+        }
+        assert(heap[0][0] == heap[1][0] && heap[0][1] == heap[1][1]);
+
+        rsa_ctx_clear(&aenc);
+        rsa_ctx_clear(&adec);
+        rsa_key_clear(&apub);
+        rsa_key_clear(&apriv);
+    }
+    printf("Success.\n");
+
 
 
 
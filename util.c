@@ -3,168 +3,474 @@
 #include <gmp.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/random.h>
+#include "mont64.h"
+#include "util.h"
+#include "sieve.h"
 
 
-//QUICK SORT
+#define PRIME_LANES 4            // candidates of checkIfPrimeBatch() tested together
 
-// function to print array elements
-void printArray(long long int array[], int size) {
-  for (int i = 0; i < size; ++i) {
-    printf("%lld ", array[i]);
-  }
-  printf("\n");
+/*
+    Miller-Rabin bases of Jim Sinclair. No strong pseudoprime below 2^64 passes all seven,
+    so the test is deterministic for every 64 bit n.
+*/
+static const uint64_t mr_bases[] = {2, 325, 9375, 28178, 450775, 9780504, 1795265022};
+static const unsigned char screen_primes[] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37};
+
+#define MR_BASES (int)(sizeof(mr_bases) / sizeof(mr_bases[0]))
+
+/*
+    Trial division by the primes up to 37.
+    @returns 1 prime, 0 composite, -1 if n needs Miller-Rabin.
+*/
+static int prime_screen(uint64_t n)
+{
+    int i;
+
+    for (i = 0; i < (int)sizeof(screen_primes); i++)
+    {
+        if (n % screen_primes[i] == 0)
+        {
+            return n == screen_primes[i];
+        }
+    }
+
+    if (n < 37 * 37)
+    {
+        return n > 1;
+    }
+
+    return -1;
 }
 
+/*
+    Second half of a Miller-Rabin round. @arg x is a^d in Montgomery form, n - 1 = d * 2^s.
+    @returns 1 if n passes the round.
+*/
+static int mr_round(const mont64 *ctx, uint64_t x, int s)
+{
+    uint64_t minus_one = ctx->m - ctx->one;
+    int j;
 
+    if (x == ctx->one || x == minus_one)
+    {
+        return 1;
+    }
+
+    for (j = 1; j < s; j++)
+    {
+        x = mont64_mul(ctx, x, x);
+        if (x == minus_one)
+        {
+            return 1;
+        }
+    }
 
-// function to swap elements
-void swap(long long int *a, long long int *b) {
-  int t = *a;
-  *a = *b;
-  *b = t;
+    return 0;
 }
 
-// function to find the partition position
-int partition(long long int array[], int low, int high) {
-  
-  // select the rightmost element as pivot
-  long long int pivot = array[high];
-  
-  // pointer for greater element
-  int i = (low - 1);
+/*
+    Deterministic Miller-Rabin for odd 64 bit n past prime_screen(). Never reads the prime map.
+*/
+static int miller_rabin_u64(uint64_t n)
+{
+    int i;
 
-    int j;
-  // traverse each element of the array
-  // compare them with the pivot
-  for (j = low; j < high; j++) {
-    if (array[j] <= pivot) {
-        
-      // if element smaller than pivot is found
-      // swap it with the greater element pointed by i
-      i++;
-      
-      // swap element at i with element at j
-      swap(&array[i], &array[j]);
-    }
-  }
-
-  // swap the pivot element with the greater element at i
-  swap(&array[i + 1], &array[high]);
-  
-  // return the partition point
-  return (i + 1);
+    uint64_t d = n - 1;
+    int s = __builtin_ctzll(d);
+    d >>= s;
+
+    mont64 ctx;
+    mont64_init(&ctx, n);
+
+    for (i = 0; i < MR_BASES; i++)
+    {
+        uint64_t a = mr_bases[i] % n;
+        if (a == 0)
+        {
+            continue;
+        }
+
+        if (!mr_round(&ctx, mont64_to(&ctx, mont64_powm(&ctx, a, d)), s))
+        {
+            return 0;
+        }
+    }
+
+    return 1;
 }
 
-void quickSort(long long int array[], int low, int high) {
-  if (low < high) {
-    
-    // find the pivot element such that
-    // elements smaller than pivot are on left of pivot
-    // elements greater than pivot are on right of pivot
-    int pi = partition(array, low, high);
-    
-    // recursive call on the left of pivot
-    quickSort(array, low, pi - 1);
-    
-    // recursive call on the right of pivot
-    quickSort(array, pi + 1, high);
-  }
+/*
+    Bit test when n is in the prime map, else deterministic Miller-Rabin.
+*/
+static int prime_u64(uint64_t n)
+{
+    int screen = prime_screen(n);
+
+    if (screen < 0)
+    {
+        screen = prime_map_test(n);
+    }
+
+    return screen >= 0 ? screen : miller_rabin_u64(n);
 }
 
+/*
+    Miller-Rabin on PRIME_LANES screened candidates at once.
 
+    Every exponentiation is a chain of dependent multiplications. The lanes run in
+    one loop, so each step issues PRIME_LANES independent ones and the multiplier
+    stays busy while a single chain would wait on its latency. Short exponents
+    start on R mod n, which squaring keeps at R until their top bit comes.
+*/
+static void prime_lanes(const uint64_t n[PRIME_LANES], int result[PRIME_LANES])
+{
+    mont64 ctx[PRIME_LANES];
+    uint64_t d[PRIME_LANES];
+    int s[PRIME_LANES];
+    int i, j, b;
+
+    for (j = 0; j < PRIME_LANES; j++)
+    {
+        mont64_init(&ctx[j], n[j]);
+        s[j] = __builtin_ctzll(n[j] - 1);
+        d[j] = (n[j] - 1) >> s[j];
+        result[j] = 1;
+    }
+
+    for (b = 0; b < MR_BASES; b++)
+    {
+        uint64_t x[PRIME_LANES];
+        uint64_t acc[PRIME_LANES];
+        uint64_t all = 0;
+
+        for (j = 0; j < PRIME_LANES; j++)
+        {
+            x[j] = mont64_to(&ctx[j], mr_bases[b]);
+            acc[j] = ctx[j].one;
+            all |= result[j] ? d[j] : 0;
+        }
+        if (all == 0)
+        {
+            break;
+        }
+
+        for (i = 63 - __builtin_clzll(all); i >= 0; i--)
+        {
+            for (j = 0; j < PRIME_LANES; j++)
+            {
+                acc[j] = mont64_mul(&ctx[j], acc[j], acc[j]);
+                if ((d[j] >> i) & 1)
+                {
+                    acc[j] = mont64_mul(&ctx[j], acc[j], x[j]);
+                }
+            }
+        }
+
+        for (j = 0; j < PRIME_LANES; j++)
+        {
+            if (result[j] && mr_bases[b] % n[j] != 0)
+            {
+                result[j] = mr_round(&ctx[j], acc[j], s[j]);
+            }
+        }
+    }
+}
+
+static uint64_t gcd_u64(uint64_t a, uint64_t b)
+{
+    while (b != 0)
+    {
+        uint64_t t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
 
 /*
-    Check if @arg b is a primitive root of @arg a.
-    @see Primitive modulo root.
+    Pollard's rho with Brent's cycle finding on an odd composite n.
 
-    A number x is a primitive root of a number y if : x^1 mody , x^2 mod y,... , x^(y-1)mod y are distinct.
+    The walk x -> x^2 + c stays in Montgomery form, which is just another polynomial.
+    Differences are multiplied together and one gcd is taken per 128 steps.
+    If the batch overshoots to n, the last batch is replayed one step at a time.
 
-    @returns boolean. (int: 1 True, int: 0 False)
+    @returns a non trivial factor of n.
 */
-int checkIfPrimitiveRoot(long long int a, long long int b)
+static uint64_t pollard_rho(uint64_t n)
+{
+    mont64 ctx;
+    mont64_init(&ctx, n);
+    uint64_t c;
+
+    for (c = 1; ; c++)
+    {
+        uint64_t y = 2, x = 2, ys = 2, q = ctx.one, g = 1;
+        uint64_t r, k, i;
+
+        for (r = 1; g == 1; r *= 2)
+        {
+            x = y;
+            for (i = 0; i < r; i++)
+            {
+                y = mont64_mul(&ctx, y, y) + c;
+                y = y >= n ? y - n : y;
+            }
+
+            for (k = 0; k < r && g == 1; k += 128)
+            {
+                ys = y;
+                for (i = 0; i < 128 && i < r - k; i++)
+                {
+                    y = mont64_mul(&ctx, y, y) + c;
+                    y = y >= n ? y - n : y;
+                    q = mont64_mul(&ctx, q, x > y ? x - y : y - x);
+                }
+                g = gcd_u64(q, n);
+            }
+        }
+
+        if (g == n)
+        {
+            do
+            {
+                ys = mont64_mul(&ctx, ys, ys) + c;
+                ys = ys >= n ? ys - n : ys;
+                g = gcd_u64(x > ys ? x - ys : ys - x, n);
+            } while (g == 1);
+        }
+
+        if (g != n)
+        {
+            return g;
+        }
+    }
+}
+
+/*
+    Add the prime factors of n > 1 to @arg factors, without repeats.
+*/
+static void factor_rho(uint64_t n, uint64_t factors[], int *count)
 {
     int i;
 
-    long long int *prev = (long long int*)malloc(sizeof(long long int) * a-1);
+    // pollard_rho() never returns on a prime, so a composite verdict of the map is not
+    // enough: Miller-Rabin has the last word before rho runs
+    if (prime_u64(n) || (prime_map_test(n) == 0 && miller_rabin_u64(n)))
+    {
+        for (i = 0; i < *count; i++)
+        {
+            if (factors[i] == n)
+            {
+                return;
+            }
+        }
+        factors[(*count)++] = n;
+
+        return;
+    }
+
+    uint64_t d = pollard_rho(n);
+    factor_rho(d, factors, count);
+    factor_rho(n / d, factors, count);
+}
+
+/*
+    Distinct prime factors of @arg n.
+
+    Trial division takes out the factors below 2^10, Pollard's rho splits what is left.
+    A 64 bit number has at most 15 distinct prime factors.
 
-    // populate with prevs of prime
-    for (i = 0; i < a-1; i++)
-    {   
-        prev[i] = fmod(pow(b, i), a);
+    @returns the number of factors written to @arg factors.
+*/
+int prime_factors(uint64_t n, uint64_t factors[PRIME_FACTORS_MAX])
+{
+    int count = 0;
+    uint64_t d;
 
+    if (n < 2)
+    {
+        return 0;
     }
-    //printf("%d\n",i);
 
-    // check for equality. establish distinction
-    // can sort and iterate once O(nlogn) + O(n)
-    //printArray(prev, a-1);
-    quickSort(prev, 0, a-1);
-    //printArray(prev, a-1);
+    if ((n & 1) == 0)
+    {
+        factors[count++] = 2;
+        n >>= __builtin_ctzll(n);
+    }
 
-    for (i = 0; i < a-1; i++)
+    for (d = 3; d < (1 << 10) && d * d <= n; d += 2)
     {
-        if (prev[i] == prev[i+1])
+        if (n % d == 0)
         {
-            return 0;
+            factors[count++] = d;
+            do
+            {
+                n /= d;
+            } while (n % d == 0);
         }
     }
 
-    free(prev);
- 
-    return 1;
+    if (n > 1)
+    {
+        if (d * d > n)
+        {
+            factors[count++] = n;
+        }
+        else
+        {
+            factor_rho(n, factors, &count);
+        }
+    }
 
+    return count;
 }
 
 /*
-    Check if @argn n is a prime number. 
-    @see Prime numbers
+    Check if @arg b is a primitive root of @arg a.
+    @see Primitive modulo root.
 
-    This method uses 6k+1 optimization method.
-    @see https://en.wikipedia.org/wiki/Primality_test
+    b is a primitive root of the prime a if its order is a - 1, that is b^((a-1)/q) != 1
+    for every prime factor q of a - 1. a - 1 is factored with prime_factors(), so the
+    check takes a handful of exponentiations and no memory whatever the size of a.
 
-    @return boolean. (int: 1 True, int: 0 False)
+    @returns boolean. (int: 1 True, int: 0 False). 0 if a is not a prime.
 */
-int checkIfPrime(size_t n)
+int checkIfPrimitiveRoot(size_t a, size_t b)
 {
+    uint64_t factors[PRIME_FACTORS_MAX];
+    int count;
+    int i;
 
-    if (n <= 3)
-    {   
-        return n > 1? 1:0;
-    }
-        
-    if (n % 2 == 0 || n % 3 == 0)
+    if (a < 2 || !prime_u64(a) || b % a == 0)
     {
         return 0;
     }
+    if (a == 2)
+    {
+        return 1;
+    }
 
-    int i;
+    count = prime_factors(a - 1, factors);
 
-    for (i = 5; i * i < n; i+=6)
+    mont64 ctx;
+    mont64_init(&ctx, a);
+
+    for (i = 0; i < count; i++)
     {
-        if (n % i == 0 || n % (i + 2) == 0)
+        if (mont64_powm(&ctx, b, (a - 1) / factors[i]) == 1)
+        {
             return 0;
+        }
     }
 
     return 1;
 }
 
 /*
-    get previous prime number by linearly decreasing by 1 and checking...
+    Check if @argn n is a prime number. 
+    @see Prime numbers
+
+    Trial division by the primes up to 37, then one bit of the prime map (sieve.h)
+    if n is below its limit, else a deterministic Miller-Rabin on 64 bit Montgomery
+    arithmetic. Exact for every n below 2^64.
+    @see https://en.wikipedia.org/wiki/Miller%E2%80%93Rabin_primality_test
+
+    @return boolean. (int: 1 True, int: 0 False)
 */
+int checkIfPrime(size_t n)
+{
+    return prime_u64(n);
+}
 
-long long int getPrevPrime(long long int p)
+/*
+    checkIfPrime() on @arg count numbers. @arg result gets 1 or 0 for each one.
+
+    Candidates that survive the trial division and are beyond the prime map are queued
+    and tested PRIME_LANES at a time with interleaved exponentiations. A short last
+    group is padded with copies of its first candidate.
+*/
+void checkIfPrimeBatch(const size_t *n, int *result, size_t count)
 {
-    long long int i;
+    uint64_t lane[PRIME_LANES];
+    size_t index[PRIME_LANES];
+    int lane_result[PRIME_LANES];
+    int queued = 0;
+    size_t i;
+    int j;
 
-    for (i = p-1; i > 0; i--)
+    for (i = 0; i <= count; i++)
     {
-        if (checkIfPrime(i))
+        if (i < count)
         {
-            return i;
+            int screen = prime_screen(n[i]);
+
+            if (screen < 0)
+            {
+                screen = prime_map_test(n[i]);
+            }
+            if (screen >= 0)
+            {
+                result[i] = screen;
+
+                continue;
+            }
+
+            lane[queued] = n[i];
+            index[queued] = i;
+            queued++;
         }
+
+        if (queued == PRIME_LANES || (i == count && queued > 0))
+        {
+            for (j = queued; j < PRIME_LANES; j++)
+            {
+                lane[j] = lane[0];
+            }
+
+            prime_lanes(lane, lane_result);
+            for (j = 0; j < queued; j++)
+            {
+                result[index[j]] = lane_result[j];
+            }
+            queued = 0;
+        }
+    }
+}
+
+/*
+    get previous prime number below p, from the prime map if p is in range, else from a
+    prime_iter going down. The first segment of the sieve is a few hundred numbers, enough
+    for any prime gap below 2^64.
+    @returns 0 if there is no prime below p.
+*/
+long long int getPrevPrime(long long int p)
+{
+    prime_iter it;
+
+    if (p <= 2)
+    {
+        return 0;
     }
 
-    return 0;
+    uint64_t mapped = prime_map_prev(p);
+    if (mapped != 0)
+    {
+        return mapped;
+    }
+
+    prime_iter_init(&it, p - 1, -1);
+    long long int prev = prime_iter_next(&it);
+    prime_iter_clear(&it);
+
+    return prev;
 }
 
 /*
@@ -186,26 +492,25 @@ size_t gcd(size_t a, size_t b)
 
 /*
     Lambda EULER FUNCTION used in this implementation.
+    Carmichael function of n = pq.
 */
 void lambda_euler_function(mpz_t l, mpz_t p, mpz_t q)
 {
     // λ(n) = lcm(p - 1,q - 1)
     // lcm(a,b)=|ab|/gcd(a,b)
-   
-    // λ(n) = |(p-1)(q-1)| / gcd(a,b)
 
     // setup p - 1
     mpz_t p_1;
-    mpz_init(p_1);
+    mpz_init2(p_1, mpz_sizeinbase(p, 2));
     mpz_sub_ui(p_1, p, 1);
 
     // setup q - 1
     mpz_t q_1;
-    mpz_init(q_1);
+    mpz_init2(q_1, mpz_sizeinbase(q, 2));
     mpz_sub_ui(q_1, q, 1);
     
-    // setup |(p-1)(q-1)|
-    mpz_mul(l, p_1, q_1);
+    // λ(n) = |(p-1)(q-1)| / gcd(p-1, q-1)
+    mpz_lcm(l, p_1, q_1);
 
 
     mpz_clear(p_1);
@@ -213,29 +518,71 @@ void lambda_euler_function(mpz_t l, mpz_t p, mpz_t q)
 
 }
 
+/*
+    Montgomery constants of an odd modulus m of s limbs, R = 2^(GMP_NUMB_BITS * s).
+
+    @arg rr   R^2 mod m, used to bring numbers into Montgomery form.
+    @arg ninv -m^-1 mod 2^GMP_NUMB_BITS, used by every reduction.
+
+    m^-1 mod 2^GMP_NUMB_BITS comes from Newton's iteration x = x(2 - mx), which
+    doubles the correct low bits every step. m is its own inverse mod 8.
+*/
+void montgomery_constants(mpz_t rr, mp_limb_t *ninv, mpz_t m)
+{
+    mp_limb_t m0 = mpz_getlimbn(m, 0);
+    mp_limb_t x = m0;
+    int i;
+
+    for (i = 3; i < GMP_NUMB_BITS; i *= 2)
+    {
+        x *= 2 - m0 * x;
+    }
+    *ninv = -x;
+
+    mpz_set_ui(rr, 0);
+    mpz_setbit(rr, 2 * GMP_NUMB_BITS * mpz_size(m));
+    mpz_mod(rr, rr, m);
+}
+
+
+/*
+    Prime filter for the standard key profile.
+    e must be invertible mod λ(n), so gcd(e, p - 1) must be 1.
+    @arg arg points to the unsigned long e.
+*/
+int coprime_to_exponent(mpz_t prime, void *arg)
+{
+    unsigned long e = *(unsigned long*)arg;
+
+    return mpz_fdiv_ui(prime, e) != 1;
+}
+
 
 /*
     Function to get a d key out of lambda. MUST BE prime
     In this simple case its cutting in half the lambda number and its finding the closest prime
     to that half.
 
-    WORKS with mpz_t numbers.
+    WORKS with mpz_t numbers. Temporaries are sized for lambda up front, so the
+    search does not grow them.
 */
 void forge_d_key(mpz_t d, mpz_t lambda)
 {
+    size_t bits = mpz_sizeinbase(lambda, 2) + GMP_NUMB_BITS;
+
     // Searching for a large number d < lambda which is relatively prime to lambda
     // tmp value to hold d
     mpz_t tmp;
-    mpz_init(tmp);
+    mpz_init2(tmp, bits);
     
     // Prerquisites are d % lambda != 0 && gcd(d, lambda)==1 
     // d mod lambda
     mpz_t mod;
-    mpz_init(mod);
+    mpz_init2(mod, bits);
 
     // gcd (d, lambda)
     mpz_t gcd;
-    mpz_init(gcd);
+    mpz_init2(gcd, bits);
 
 
 
@@ -244,7 +591,7 @@ void forge_d_key(mpz_t d, mpz_t lambda)
 
     // Recieve a prime double of lambda.
     mpz_t op;
-    mpz_init(op);
+    mpz_init2(op, bits);
 
 
     mpz_cdiv_q_ui(op, lambda, 7);
@@ -288,67 +635,358 @@ void forge_d_key(mpz_t d, mpz_t lambda)
 }
 
 /*
-    @UNUSED... TO BE COMPLETE
+    Seed a random state from /dev/urandom.
+    The state is a Mersenne Twister, which its outputs give away: fit for test data
+    and benchmarks, never for keys. Secrets come from random_bits().
 
-    Create a large prime by concatenating random odd numbers.
-    Validate primality with primality propabilistic methods.
+    @returns 0 on success, -1 if no system randomness is available.
 */
-void large_prime_generator(mpz_t prime, int digits)
+int random_state_init(gmp_randstate_t st)
 {
+    unsigned char seed[32];
 
-    unsigned long int x = 10;
-    unsigned long int two = 2;
-    unsigned long int zero = 0;
+    if (random_bytes(seed, sizeof(seed)) != 0)
+    {
+        return -1;
+    }
 
+    mpz_t s;
+    mpz_init(s);
+    mpz_import(s, sizeof(seed), 1, 1, 0, 0, seed);
 
-    gmp_randstate_t st;
     gmp_randinit_default(st);
+    gmp_randseed(st, s);
 
-    mpz_t rnd;
-    mpz_init(rnd);
+    mpz_clear(s);
 
-    
-    mpz_t ten;
-    mpz_init(ten);
-    mpz_set_ui(ten, x);
+    return 0;
+}
 
-    mpz_t mod;
-    mpz_init(mod);
+/*
+    getrandom(2) reads the urandom pool with no file descriptor and no stdio buffer, and
+    blocks only until the pool is first seeded. Reads of more than 256 bytes may come
+    back short, and a signal may cut one, so it loops.
+*/
+int random_bytes(unsigned char *buffer, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t got = getrandom(buffer, length, 0);
 
+        if (got < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return -1;
+        }
+
+        buffer += got;
+        length -= got;
+    }
 
-    fflush(stdout);
-    long int i;
-    for (i = 0; i < digits; i++)
+    return 0;
+}
+
+/*
+    The bytes go straight into the limbs of x, so no copy of the secret is left behind.
+*/
+int random_bits(mpz_t x, size_t bits)
+{
+    size_t n = (bits + GMP_NUMB_BITS - 1) / GMP_NUMB_BITS;
+
+    if (n == 0)
     {
-        // generate a random number and 
-        // keep generating until number is odd.
-        int r = 0;
-        while(r == 0)
+        mpz_set_ui(x, 0);
+
+        return 0;
+    }
+
+    mp_limb_t *limbs = mpz_limbs_write(x, n);
+
+    if (random_bytes((unsigned char*)limbs, n * sizeof(mp_limb_t)) != 0)
+    {
+        mpz_limbs_finish(x, 0);
+
+        return -1;
+    }
+
+    if (bits % GMP_NUMB_BITS != 0)
+    {
+        limbs[n - 1] &= ((mp_limb_t)1 << (bits % GMP_NUMB_BITS)) - 1;
+    }
+    mpz_limbs_finish(x, n);
+
+    return 0;
+}
+
+/*
+    Table of the odd primes below SMALL_PRIME_LIMIT. Built once with a simple sieve.
+*/
+#define SMALL_PRIME_LIMIT 16384
+static unsigned int small_primes[SMALL_PRIME_LIMIT / 2];
+static int small_prime_count = 0;
+
+static void small_primes_init()
+{
+    static unsigned char composite[SMALL_PRIME_LIMIT];
+    unsigned int i, j;
+    int count = 0;
+
+    if (small_prime_count > 0)
+    {
+        return;
+    }
+
+    for (i = 3; i < SMALL_PRIME_LIMIT; i += 2)
+    {
+        if (composite[i])
+        {
+            continue;
+        }
+        small_primes[count++] = i;
+        for (j = i * i; j < SMALL_PRIME_LIMIT; j += 2 * i)
         {
-           mpz_urandomm(rnd, st, ten);
-           //printf("\n\tRand number is: ");
-           //printf("\t%ld\n",mpz_out_str(stdout, 10, rnd));
-           mpz_mod_ui(mod, rnd, two);
-           r = mpz_cmp_ui(mod, zero);
-           //printf("\n\tOdd? : %d\n",r);
-            
+            composite[j] = 1;
         }
+    }
 
-        mpz_mul_ui(prime, prime, 10);
-        mpz_add(prime, prime, rnd);
+    small_prime_count = count;
+}
 
-        //printf("\n\tPrime so far: ");
-        //mpz_out_str(stdout, 10, prime);
+/*
+    Random prime of exactly @arg bits bits. The two top bits are set, so the
+    product of two such primes has exactly 2 * bits bits.
 
-        //printf("\n\n");
+    A random odd start x is drawn from /dev/urandom and x, x+2, x+4, ... are scanned. The residues
+    of x modulo every small prime are computed once, so the sieve of each next
+    candidate costs one addition per small prime instead of a division of a big
+    number. Only candidates without small factors reach mpz_probab_prime_p.
+    If the scan runs too long a new start is drawn.
+
+    @arg accept, if not NULL, is asked about every probable prime. Primes it refuses
+    are skipped. @arg stop, if not NULL, aborts the search when it turns non zero.
+
+    @returns 0 on success, -1 if stopped, -2 if no system randomness is available.
+*/
+int random_prime(mpz_t prime, int bits, int (*accept)(mpz_t, void*), void *arg, atomic_int *stop)
+{
+    unsigned int *residues;
+    unsigned long delta;
+    int i;
+
+    small_primes_init();
+    residues = (unsigned int*)malloc(sizeof(unsigned int) * small_prime_count);
+
+    mpz_t start;
+    mpz_init(start);
+
+    while (stop == NULL || !atomic_load(stop))
+    {
+        if (random_bits(start, bits) != 0)
+        {
+            free(residues);
+            mpz_clear(start);
+
+            return -2;
+        }
+        mpz_setbit(start, bits - 1);
+        mpz_setbit(start, bits - 2);
+        mpz_setbit(start, 0);
+
+        for (i = 0; i < small_prime_count; i++)
+        {
+            residues[i] = mpz_fdiv_ui(start, small_primes[i]);
+        }
+
+        for (delta = 0; delta < (1UL << 20); delta += 2)
+        {
+            if (stop != NULL && atomic_load(stop))
+            {
+                break;
+            }
+
+            for (i = 0; i < small_prime_count; i++)
+            {
+                if ((residues[i] + delta) % small_primes[i] == 0)
+                {
+                    break;
+                }
+            }
+
+            mpz_add_ui(prime, start, delta);
+
+            // a small factor. Only a prime if it is that small prime itself.
+            if (i < small_prime_count && mpz_cmp_ui(prime, small_primes[i]) != 0)
+            {
+                continue;
+            }
+
+            if (mpz_sizeinbase(prime, 2) != (size_t)bits)
+            {
+                break;
+            }
+
+            if (mpz_probab_prime_p(prime, 25) && (accept == NULL || accept(prime, arg)))
+            {
+                free(residues);
+                mpz_clear(start);
+
+                return 0;
+            }
+        }
     }
 
-    mpz_clear(rnd);
-    gmp_randclear(st);
-    mpz_clear(ten);
-    mpz_clear(mod);
+    free(residues);
+    mpz_clear(start);
 
-   
+    return -1;
+}
+
+/*
+    Random prime of exactly @arg bits bits.
+    @see random_prime
+*/
+int large_prime_generator(mpz_t prime, int bits)
+{
+    return random_prime(prime, bits, NULL, NULL, NULL) == 0 ? 0 : -1;
+}
+
+
+/*
+    Shared state of a parallel search for the two primes of a RSA modulus.
+*/
+typedef struct
+{
+    mpz_ptr prime[2];           // p and q
+    int bits[2];
+    int found[2];
+    atomic_int stop[2];         // set by the first thread that finds the prime
+    atomic_int failed;          // set when there is no system randomness, stops everyone
+    int (*accept)(mpz_t, void*);
+    void *arg;
+    int threads;
+    pthread_mutex_t lock;
+} prime_search;
+
+typedef struct
+{
+    prime_search *search;
+    int id;
+} prime_worker;
+
+/*
+    Worker of parallel_primes(). Starts on p or q depending on its id.
+    Once its own prime is taken by another thread it helps with the other one.
+*/
+static void* prime_search_worker(void *arg)
+{
+    prime_worker *worker = (prime_worker*)arg;
+    prime_search *search = worker->search;
+    int target = worker->id % 2;
+    int result;
+
+    mpz_t candidate;
+    mpz_init(candidate);
+
+    while (1)
+    {
+        if (atomic_load(&search->stop[target]))
+        {
+            target ^= 1;
+            if (atomic_load(&search->stop[target]))
+            {
+                break;
+            }
+        }
+
+        result = random_prime(candidate, search->bits[target], search->accept, search->arg,
+                              &search->stop[target]);
+        if (result == -2)
+        {
+            atomic_store(&search->failed, 1);
+            atomic_store(&search->stop[0], 1);
+            atomic_store(&search->stop[1], 1);
+
+            break;
+        }
+        if (result != 0)
+        {
+            continue;
+        }
+
+        pthread_mutex_lock(&search->lock);
+        // first winner takes the slot. q must differ from p.
+        if (!search->found[target] &&
+            !(search->found[target ^ 1] && mpz_cmp(candidate, search->prime[target ^ 1]) == 0))
+        {
+            mpz_set(search->prime[target], candidate);
+            search->found[target] = 1;
+            atomic_store(&search->stop[target], 1);
+        }
+        pthread_mutex_unlock(&search->lock);
+    }
+
+    mpz_clear(candidate);
+
+    return NULL;
+}
+
+/*
+    Search the primes p and q of a RSA modulus on @arg threads threads at once.
+
+    Threads are split between p and q, each drawing its own starts. The first
+    thread that finds a prime takes it and cancels the others searching the same one,
+    which then move on to the other prime. p and q are thus searched concurrently
+    and the search ends as soon as both are taken, or as soon as a thread finds no
+    system randomness.
+*/
+int parallel_primes(mpz_t p, mpz_t q, int pbits, int qbits, int threads,
+                     int (*accept)(mpz_t, void*), void *arg)
+{
+    prime_search search;
+    int i;
+
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+
+    search.prime[0] = p;
+    search.prime[1] = q;
+    search.bits[0] = pbits;
+    search.bits[1] = qbits;
+    search.found[0] = 0;
+    search.found[1] = 0;
+    atomic_init(&search.stop[0], 0);
+    atomic_init(&search.stop[1], 0);
+    atomic_init(&search.failed, 0);
+    search.accept = accept;
+    search.arg = arg;
+    search.threads = threads;
+    pthread_mutex_init(&search.lock, NULL);
+
+    pthread_t *tids = (pthread_t*)malloc(sizeof(pthread_t) * threads);
+    prime_worker *workers = (prime_worker*)malloc(sizeof(prime_worker) * threads);
+
+    for (i = 0; i < threads; i++)
+    {
+        workers[i].search = &search;
+        workers[i].id = i;
+        pthread_create(&tids[i], NULL, prime_search_worker, &workers[i]);
+    }
+    for (i = 0; i < threads; i++)
+    {
+        pthread_join(tids[i], NULL);
+    }
+
+    pthread_mutex_destroy(&search.lock);
+    free(tids);
+    free(workers);
+
+    return atomic_load(&search.failed) ? -1 : 0;
 }
 
 
@@ -356,6 +994,7 @@ void large_prime_generator(mpz_t prime, int digits)
     @UNUSED --> TO BE COMPLETE
 
     an effort to create a primality propabilistic validation method.
+    The witness a comes from /dev/urandom. Returns -1 if there is none.
 */
 int validate_primality(mpz_t num_b)
 {
@@ -363,19 +1002,22 @@ int validate_primality(mpz_t num_b)
     // test gcd(a,b) = 1
     // test J(a,b) = a^[(b-1)/2]mod(b)
 
-    // Setup random state /initialize
-    gmp_randstate_t st;
-    gmp_randinit_default(st);
+    // random number a : [1, b-1], from /dev/urandom
+    size_t bits = mpz_sizeinbase(num_b, 2);
 
-    // random number a : [1, b-1]
     mpz_t rnd_a;
-    mpz_init(rnd_a);
-    mpz_set_ui(rnd_a, 1);
+    mpz_init2(rnd_a, bits);
 
-    while(mpz_cmp_ui(rnd_a, 0) == 0)
+    do
     {
-        mpz_urandomm(rnd_a, st, num_b);
+        if (random_bits(rnd_a, bits) != 0)
+        {
+            mpz_clear(rnd_a);
+
+            return -1;
+        }
     }
+    while (mpz_cmp_ui(rnd_a, 0) == 0 || mpz_cmp(rnd_a, num_b) >= 0);
 
     assert(mpz_cmp(num_b, rnd_a) > 0);
 
@@ -383,15 +1025,15 @@ int validate_primality(mpz_t num_b)
     int conditionJ = 0;
 
     mpz_t gcd;
-    mpz_init(gcd);
+    mpz_init2(gcd, bits);
 
     mpz_gcd(gcd, rnd_a, num_b);
     conditionD = mpz_cmp_ui(gcd, 1) == 0;
 
     int jacobi = mpz_jacobi(rnd_a, num_b);
     mpz_t x, exp;
-    mpz_init(x);
-    mpz_init(exp);
+    mpz_init2(x, bits);
+    mpz_init2(exp, bits);
     mpz_sub_ui(exp, num_b, 1);
     mpz_cdiv_q_ui(exp, exp, 2);
     mpz_powm(x, rnd_a, exp, num_b);
@@ -422,22 +1064,22 @@ void lambda_function(mpz_t l, mpz_t p, mpz_t q)
 
     // setup p - 1
     mpz_t p_1;
-    mpz_init(p_1);
+    mpz_init2(p_1, mpz_sizeinbase(p, 2));
     mpz_sub_ui(p_1, p, 1);
 
     // setup q - 1
     mpz_t q_1;
-    mpz_init(q_1);
+    mpz_init2(q_1, mpz_sizeinbase(q, 2));
     mpz_sub_ui(q_1, q, 1);
     
     // setup |(p-1)(q-1)|
     mpz_t abs_pq;
-    mpz_init(abs_pq);
+    mpz_init2(abs_pq, mpz_sizeinbase(p, 2) + mpz_sizeinbase(q, 2));
     mpz_mul(abs_pq, p_1, q_1);
 
     // setupd gcd(p-1, q-1)
     mpz_t gcd;
-    mpz_init(gcd);
+    mpz_init2(gcd, mpz_sizeinbase(p, 2));
     mpz_gcd(gcd, p_1, q_1);
 
 
@@ -1,15 +1,25 @@
 #include <stdio.h>
 #include <math.h>
 #include <gmp.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define PRIME_FACTORS_MAX 15    // distinct prime factors of a 64 bit number at most
 
 /*
-    Check if @arg b is a primitive root of @arg a.
+    Check if @arg b is a primitive root of the prime @arg a.
     @see Primitive modulo root.
 
     @returns boolean. (int: 1 True, int: 0 False)
 */
 int checkIfPrimitiveRoot(size_t a, size_t b);
 
+/*
+    Distinct prime factors of @arg n, by trial division and Pollard's rho.
+    @returns the number of factors.
+*/
+int prime_factors(uint64_t n, uint64_t factors[PRIME_FACTORS_MAX]);
+
 /*
     Check if @argn n is a prime number. 
     @see Prime numbers
@@ -18,9 +28,15 @@ int checkIfPrimitiveRoot(size_t a, size_t b);
 */
 int checkIfPrime(size_t n);
 
+/*
+    checkIfPrime() on @arg count numbers at once. @arg result gets 1 or 0 for each.
+    Miller-Rabin exponentiations of several candidates are interleaved.
+*/
+void checkIfPrimeBatch(const size_t *n, int *result, size_t count);
+
 /*
     Function to get the previous prime of a number.
-    Decrement by 1 and check primality.
+    One lookup in the prime map when p is in range, else a walk down a segmented sieve (sieve.h).
 */
 long long int getPrevPrime(long long int p);
 
@@ -31,10 +47,22 @@ size_t gcd(size_t a, size_t b);
 
 
 /*
-    Function to calculate the lambda number
+    Function to calculate the lambda number. λ(n) = lcm(p - 1, q - 1).
 */
 void lambda_euler_function(mpz_t lambda, mpz_t p, mpz_t q);
 
+/*
+    Montgomery constants of an odd modulus m: R^2 mod m and -m^-1 mod 2^GMP_NUMB_BITS,
+    R = 2^(GMP_NUMB_BITS * limbs of m).
+*/
+void montgomery_constants(mpz_t rr, mp_limb_t *ninv, mpz_t m);
+
+/*
+    Prime filter for random_prime() and parallel_primes(). Accepts p if gcd(e, p - 1) = 1.
+    @arg arg points to an unsigned long prime e.
+*/
+int coprime_to_exponent(mpz_t prime, void *arg);
+
 /*
     Function to choose a d prime number key from lambda. 
     This implementation cuts lambda in half and finds the closest prime to that half.
@@ -42,28 +70,51 @@ void lambda_euler_function(mpz_t lambda, mpz_t p, mpz_t q);
 void forge_d_key(mpz_t d, mpz_t lambda);
 
 /*
-    Simple array printing to stdout.
+    Seed a gmp random state from /dev/urandom. A Mersenne Twister: for test data only,
+    never for keys.
+    @returns 0 on success, -1 if no system randomness is available.
 */
-void printArray(long long int array[], int size);
+int random_state_init(gmp_randstate_t st);
+
 /*
-    Quick sort implementation. @used for checking duplicates in a primitive roots array 
-    @at method checkIfPrimitiveRoot.
+    Fill @arg buffer with @arg length bytes of the system random source (getrandom(2)),
+    for secrets that need more than a seeded gmp random state.
+    @returns 0 on success, -1 if no system randomness is available.
 */
-void quickSort(long long int array[], int low, int high);
+int random_bytes(unsigned char *buffer, size_t length);
+
 /*
-    helper function of quicksort.
+    @arg x gets @arg bits random bits of random_bytes().
+    @returns 0 on success, -1 if no system randomness is available (x is then 0).
 */
-int partition(long long int array[], int low, int hight);
+int random_bits(mpz_t x, size_t bits);
+
 /*
-    helpert function of quicksort
+    Random prime of exactly @arg bits bits with the two top bits set.
+    Candidates go through a small prime sieve before the probabilistic test.
+    Starts are drawn from /dev/urandom.
+    @arg accept (optional) may refuse a prime. @arg stop (optional) aborts the search.
+
+    @returns 0 on success, -1 if stopped, -2 if no system randomness is available.
 */
-void swap(long long int *a, long long int *b);
+int random_prime(mpz_t prime, int bits, int (*accept)(mpz_t, void*), void *arg, atomic_int *stop);
 
+/*
+    Search the two primes of a RSA modulus on @arg threads threads.
+    The first thread to find a prime wins and cancels the others. p and q are searched concurrently.
+    @returns 0 on success, -1 if no system randomness is available (p and q are then unset).
+*/
+int parallel_primes(mpz_t p, mpz_t q, int pbits, int qbits, int threads,
+                     int (*accept)(mpz_t, void*), void *arg);
 
+/*
+    Random prime of exactly @arg bits bits, from random_prime().
+    @returns 0 on success, -1 if no system randomness is available.
+*/
+int large_prime_generator(mpz_t prime, int bits);
 
 
 /*
     UNUSED functions. To be in the future!
 */
-void large_prime_generator(mpz_t prime, int digits);
 void lambda_function(mpz_t lambda, mpz_t p, mpz_t q);
\ No newline at end of file
@@ -0,0 +1,349 @@
+#include <string.h>
+#include "x25519.h"
+
+
+typedef unsigned __int128 u128;
+
+/*
+    Element of GF(2^255 - 19): limb i weighs 2^(51 i). Limbs are kept a little above 51
+    bits between carries, which leaves room for the factor 19 of the wrap around in a
+    product without overflowing 128 bits.
+*/
+typedef uint64_t fe[5];
+
+#define MASK51 ((1ull << 51) - 1)
+
+
+static void fe_copy(fe h, const fe f)
+{
+    memcpy(h, f, sizeof(fe));
+}
+
+static void fe_set(fe h, uint64_t x)
+{
+    h[0] = x;
+    h[1] = h[2] = h[3] = h[4] = 0;
+}
+
+static void fe_add(fe h, const fe f, const fe g)
+{
+    int i;
+
+    for (i = 0; i < 5; i++)
+    {
+        h[i] = f[i] + g[i];
+    }
+}
+
+/*
+    h = f - g, as f + 2p - g so no limb goes negative. g must come out of a product.
+*/
+static void fe_sub(fe h, const fe f, const fe g)
+{
+    h[0] = f[0] + 0xFFFFFFFFFFFDAull - g[0];
+    h[1] = f[1] + 0xFFFFFFFFFFFFEull - g[1];
+    h[2] = f[2] + 0xFFFFFFFFFFFFEull - g[2];
+    h[3] = f[3] + 0xFFFFFFFFFFFFEull - g[3];
+    h[4] = f[4] + 0xFFFFFFFFFFFFEull - g[4];
+}
+
+/*
+    Carry 128 bit column sums down to limbs of 51 bits, plus a small excess in limb 1.
+    The carry out of the top limb wraps to limb 0 times 19, as 2^255 = 19 mod p. Column
+    4 has no factor 19 in it, so that carry stays below 2^58 for inputs below 2^54.
+*/
+static void fe_carry(fe h, u128 r0, u128 r1, u128 r2, u128 r3, u128 r4)
+{
+    uint64_t c;
+
+    r1 += r0 >> 51;
+    h[0] = (uint64_t)r0 & MASK51;
+    r2 += r1 >> 51;
+    h[1] = (uint64_t)r1 & MASK51;
+    r3 += r2 >> 51;
+    h[2] = (uint64_t)r2 & MASK51;
+    r4 += r3 >> 51;
+    h[3] = (uint64_t)r3 & MASK51;
+    c = (uint64_t)(r4 >> 51);
+    h[4] = (uint64_t)r4 & MASK51;
+
+    h[0] += c * 19;
+    h[1] += h[0] >> 51;
+    h[0] &= MASK51;
+}
+
+static void fe_mul(fe h, const fe f, const fe g)
+{
+    uint64_t g1 = g[1] * 19, g2 = g[2] * 19, g3 = g[3] * 19, g4 = g[4] * 19;
+
+    u128 r0 = (u128)f[0] * g[0] + (u128)f[1] * g4 + (u128)f[2] * g3 + (u128)f[3] * g2 + (u128)f[4] * g1;
+    u128 r1 = (u128)f[0] * g[1] + (u128)f[1] * g[0] + (u128)f[2] * g4 + (u128)f[3] * g3 + (u128)f[4] * g2;
+    u128 r2 = (u128)f[0] * g[2] + (u128)f[1] * g[1] + (u128)f[2] * g[0] + (u128)f[3] * g4 + (u128)f[4] * g3;
+    u128 r3 = (u128)f[0] * g[3] + (u128)f[1] * g[2] + (u128)f[2] * g[1] + (u128)f[3] * g[0] + (u128)f[4] * g4;
+    u128 r4 = (u128)f[0] * g[4] + (u128)f[1] * g[3] + (u128)f[2] * g[2] + (u128)f[3] * g[1] + (u128)f[4] * g[0];
+
+    fe_carry(h, r0, r1, r2, r3, r4);
+}
+
+/*
+    h = f^2. The cross products appear twice, so they are computed once and doubled.
+*/
+static void fe_sq(fe h, const fe f)
+{
+    uint64_t d0 = f[0] * 2, d1 = f[1] * 2, d2 = f[2] * 2 * 19, d3 = f[3] * 19, d4 = f[4] * 19;
+
+    u128 r0 = (u128)f[0] * f[0] + (u128)d1 * d4 + (u128)d2 * f[3];
+    u128 r1 = (u128)d0 * f[1] + (u128)d2 * f[4] + (u128)d3 * f[3];
+    u128 r2 = (u128)d0 * f[2] + (u128)f[1] * f[1] + (u128)(f[3] * 2) * d4;
+    u128 r3 = (u128)d0 * f[3] + (u128)d1 * f[2] + (u128)f[4] * d4;
+    u128 r4 = (u128)d0 * f[4] + (u128)d1 * f[3] + (u128)f[2] * f[2];
+
+    fe_carry(h, r0, r1, r2, r3, r4);
+}
+
+/*
+    h = f^(2^n).
+*/
+static void fe_sq_n(fe h, const fe f, int n)
+{
+    fe_sq(h, f);
+    while (--n > 0)
+    {
+        fe_sq(h, h);
+    }
+}
+
+static void fe_mul_small(fe h, const fe f, uint32_t n)
+{
+    fe_carry(h, (u128)f[0] * n, (u128)f[1] * n, (u128)f[2] * n, (u128)f[3] * n, (u128)f[4] * n);
+}
+
+/*
+    h = f^(p - 2) = f^-1, by the fixed addition chain of ref10: 254 squarings and
+    11 multiplications whatever f is.
+*/
+static void fe_invert(fe h, const fe f)
+{
+    fe z2, z9, z11, z2_5, z2_10, z2_20, z2_50, z2_100, t;
+
+    fe_sq(z2, f);
+    fe_sq_n(t, z2, 2);
+    fe_mul(z9, t, f);
+    fe_mul(z11, z9, z2);
+    fe_sq(t, z11);
+    fe_mul(z2_5, t, z9);            // f^(2^5 - 1)
+    fe_sq_n(t, z2_5, 5);
+    fe_mul(z2_10, t, z2_5);         // f^(2^10 - 1)
+    fe_sq_n(t, z2_10, 10);
+    fe_mul(z2_20, t, z2_10);
+    fe_sq_n(t, z2_20, 20);
+    fe_mul(t, t, z2_20);            // f^(2^40 - 1)
+    fe_sq_n(t, t, 10);
+    fe_mul(z2_50, t, z2_10);
+    fe_sq_n(t, z2_50, 50);
+    fe_mul(z2_100, t, z2_50);
+    fe_sq_n(t, z2_100, 100);
+    fe_mul(t, t, z2_100);           // f^(2^200 - 1)
+    fe_sq_n(t, t, 50);
+    fe_mul(t, t, z2_50);            // f^(2^250 - 1)
+    fe_sq_n(t, t, 5);
+    fe_mul(h, t, z11);              // f^(2^255 - 21)
+}
+
+/*
+    Swap f and g if @arg swap is 1, leave them if 0. No branch on swap.
+*/
+static void fe_cswap(fe f, fe g, uint64_t swap)
+{
+    uint64_t mask = 0 - swap;
+    int i;
+
+    for (i = 0; i < 5; i++)
+    {
+        uint64_t x = (f[i] ^ g[i]) & mask;
+
+        f[i] ^= x;
+        g[i] ^= x;
+    }
+}
+
+/*
+    The top bit of the last byte is ignored, as the RFC asks for u coordinates.
+*/
+static void fe_frombytes(fe h, const uint8_t s[X25519_BYTES])
+{
+    uint64_t w[4];
+    int i, j;
+
+    for (i = 0; i < 4; i++)
+    {
+        w[i] = 0;
+        for (j = 7; j >= 0; j--)
+        {
+            w[i] = (w[i] << 8) | s[8 * i + j];
+        }
+    }
+
+    h[0] = w[0] & MASK51;
+    h[1] = ((w[0] >> 51) | (w[1] << 13)) & MASK51;
+    h[2] = ((w[1] >> 38) | (w[2] << 26)) & MASK51;
+    h[3] = ((w[2] >> 25) | (w[3] << 39)) & MASK51;
+    h[4] = (w[3] >> 12) & MASK51;
+}
+
+/*
+    Canonical encoding: carry fully twice, which leaves every limb below 2^51, then
+    subtract p when the value is at least p.
+    q is 1 exactly when h + 19 reaches 2^255, found without a branch.
+*/
+static void fe_tobytes(uint8_t s[X25519_BYTES], const fe f)
+{
+    fe h;
+    uint64_t q, w[4];
+    int i, j;
+
+    fe_copy(h, f);
+    for (j = 0; j < 2; j++)
+    {
+        for (i = 0; i < 4; i++)
+        {
+            h[i + 1] += h[i] >> 51;
+            h[i] &= MASK51;
+        }
+        h[0] += 19 * (h[4] >> 51);
+        h[4] &= MASK51;
+    }
+
+    q = (h[0] + 19) >> 51;
+    q = (h[1] + q) >> 51;
+    q = (h[2] + q) >> 51;
+    q = (h[3] + q) >> 51;
+    q = (h[4] + q) >> 51;
+
+    h[0] += 19 * q;
+    h[1] += h[0] >> 51;
+    h[0] &= MASK51;
+    h[2] += h[1] >> 51;
+    h[1] &= MASK51;
+    h[3] += h[2] >> 51;
+    h[2] &= MASK51;
+    h[4] += h[3] >> 51;
+    h[3] &= MASK51;
+    h[4] &= MASK51;
+
+    w[0] = h[0] | (h[1] << 51);
+    w[1] = (h[1] >> 13) | (h[2] << 38);
+    w[2] = (h[2] >> 26) | (h[3] << 25);
+    w[3] = (h[3] >> 39) | (h[4] << 12);
+
+    for (i = 0; i < 4; i++)
+    {
+        for (j = 0; j < 8; j++)
+        {
+            s[8 * i + j] = (uint8_t)(w[i] >> (8 * j));
+        }
+    }
+}
+
+/*
+    Montgomery ladder of RFC 7748 section 5, a24 = (486662 - 2) / 4.
+    (x2 : z2) holds k * u and (x3 : z3) holds (k + 1) * u for the bits of k seen so far.
+*/
+int x25519(uint8_t out[X25519_BYTES], const uint8_t scalar[X25519_BYTES], const uint8_t u[X25519_BYTES])
+{
+    uint8_t k[X25519_BYTES];
+    fe x1, x2, z2, x3, z3;
+    fe a, aa, b, bb, e, c, d, da, cb;
+    uint64_t swap = 0;
+    uint8_t zero = 0;
+    int t;
+
+    memcpy(k, scalar, X25519_BYTES);
+    k[0] &= 248;
+    k[31] &= 127;
+    k[31] |= 64;
+
+    fe_frombytes(x1, u);
+    fe_set(x2, 1);
+    fe_set(z2, 0);
+    fe_copy(x3, x1);
+    fe_set(z3, 1);
+
+    for (t = 254; t >= 0; t--)
+    {
+        uint64_t bit = (k[t / 8] >> (t % 8)) & 1;
+
+        swap ^= bit;
+        fe_cswap(x2, x3, swap);
+        fe_cswap(z2, z3, swap);
+        swap = bit;
+
+        fe_add(a, x2, z2);
+        fe_sq(aa, a);
+        fe_sub(b, x2, z2);
+        fe_sq(bb, b);
+        fe_sub(e, aa, bb);
+        fe_add(c, x3, z3);
+        fe_sub(d, x3, z3);
+        fe_mul(da, d, a);
+        fe_mul(cb, c, b);
+
+        fe_add(x3, da, cb);
+        fe_sq(x3, x3);
+        fe_sub(z3, da, cb);
+        fe_sq(z3, z3);
+        fe_mul(z3, z3, x1);
+
+        fe_mul(x2, aa, bb);
+        fe_mul_small(z2, e, 121665);
+        fe_add(z2, z2, aa);
+        fe_mul(z2, z2, e);
+    }
+
+    fe_cswap(x2, x3, swap);
+    fe_cswap(z2, z3, swap);
+
+    fe_invert(z2, z2);
+    fe_mul(x2, x2, z2);
+    fe_tobytes(out, x2);
+
+    memset(k, 0, sizeof(k));
+
+    for (t = 0; t < X25519_BYTES; t++)
+    {
+        zero |= out[t];
+    }
+
+    return zero ? 0 : -1;
+}
+
+void x25519_public_key(uint8_t out[X25519_BYTES], const uint8_t scalar[X25519_BYTES])
+{
+    static const uint8_t base[X25519_BYTES] = {9};
+
+    x25519(out, scalar, base);
+}
+
+int x25519_exchange(uint8_t A[X25519_BYTES], uint8_t B[X25519_BYTES], uint8_t s[X25519_BYTES],
+                    const uint8_t a[X25519_BYTES], const uint8_t b[X25519_BYTES])
+{
+    uint8_t check[X25519_BYTES];
+    uint8_t diff = 0;
+    int i;
+
+    x25519_public_key(A, a);
+    x25519_public_key(B, b);
+
+    int result = x25519(s, a, B);
+    if (x25519(check, b, A) != 0)
+    {
+        result = -1;
+    }
+
+    for (i = 0; i < X25519_BYTES; i++)
+    {
+        diff |= s[i] ^ check[i];
+    }
+
+    return result == 0 && diff == 0 ? 0 : -1;
+}
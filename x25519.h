@@ -0,0 +1,38 @@
+#ifndef X25519_H
+#define X25519_H
+
+#include <stdint.h>
+
+/*
+    X25519 key agreement of RFC 7748 over Curve25519.
+
+    Scalars and u coordinates are 32 byte little endian strings, as in the RFC.
+    The field is GF(2^255 - 19) in five limbs of 51 bits with 128 bit products. The
+    scalar multiplication is the Montgomery ladder of the RFC with conditional swaps
+    by masks, so the sequence of instructions and memory accesses does not depend on
+    the scalar.
+*/
+
+#define X25519_BYTES 32
+
+
+/*
+    @arg out = X25519(@arg scalar, @arg u). The scalar is clamped as the RFC requires.
+    @returns 0, or -1 if the result is all zero (u of small order).
+*/
+int x25519(uint8_t out[X25519_BYTES], const uint8_t scalar[X25519_BYTES], const uint8_t u[X25519_BYTES]);
+
+/*
+    Public key @arg out = X25519(@arg scalar, 9).
+*/
+void x25519_public_key(uint8_t out[X25519_BYTES], const uint8_t scalar[X25519_BYTES]);
+
+/*
+    Full exchange between private keys @arg a and @arg b: A, B and the shared secret s
+    seen from side a, checked against side b.
+    @returns 0 on success, -1 if the two views differ or the secret is all zero.
+*/
+int x25519_exchange(uint8_t A[X25519_BYTES], uint8_t B[X25519_BYTES], uint8_t s[X25519_BYTES],
+                    const uint8_t a[X25519_BYTES], const uint8_t b[X25519_BYTES]);
+
+#endif